@@ -24,6 +24,9 @@ const char *source_files[] = {
     "src/generator.c",
     "src/l_system.c",
     "src/parser.c",
+    "src/parallel.c",
+    "src/arena.c",
+    "src/l_native.c",
 
     NULL
 };
@@ -50,6 +53,7 @@ const char *libs[] = {
     "Xi",
     "dl",
     "m",
+    "pthread",
 #else
     "User32.lib",
     "Gdi32.lib",
@@ -75,6 +79,28 @@ const char *debug_raw[] = {
     NULL
 };
 
+/* linalg */
+
+// NOTE: SSE is on for every x86-64 target, `avx` widens `matrix_multiply`
+//       and `scalar` turns the kernels off to compare against.
+const char *avx_raw[] = {
+#ifndef _WIN32
+    "-mavx",
+#else
+    "/arch:AVX",
+#endif
+    NULL
+};
+
+const char *scalar_defines[] = {
+    "LINALG_SCALAR",
+    NULL
+};
+
+const char *no_params[] = {
+    NULL
+};
+
 
 int main(int argc, char *argv[])
 {
@@ -83,7 +109,17 @@ int main(int argc, char *argv[])
     if (res != -1)
         return res;
 
-    int debug = contains("debug", argc, argv);
+    int debug  = contains("debug", argc, argv);
+    int avx    = contains("avx", argc, argv);
+    int scalar = contains("scalar", argc, argv);
+
+    const char **build_defines = debug  ? merge(defines, debug_defines) : defines;
+    const char **build_raw     = debug  ? debug_raw : no_params;
+
+    if (scalar)
+        build_defines = merge(build_defines, scalar_defines);
+    if (avx)
+        build_raw = merge(build_raw, avx_raw);
 
     res = compile_w((compile_info_t) {
         .output = output,
@@ -92,10 +128,9 @@ int main(int argc, char *argv[])
 
         .source_files = source_files,
         .includes = includes,
-        .defines = debug ? merge(defines, debug_defines)
-                         : defines,
+        .defines = build_defines,
         .libs = libs,
-        .raw_params = debug ? debug_raw : NULL,
+        .raw_params = build_raw,
 
         .warnings = nice_warnings,
         .warnings_off = nice_warnings_off,
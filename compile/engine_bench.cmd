@@ -0,0 +1,3 @@
+cl /O2 /std:c17 /W4 /nologo /Feengine_bench src/engine_bench.c src/l_system.c src/l_native.c src/parser.c src/generator.c src/arena.c src/parallel.c src/res.c src/obj_parser.c src/utils.c src/glad/gl.c /Isrc /Isrc/glad/include /D_CRT_SECURE_NO_WARNINGS
+
+@echo off
@@ -0,0 +1,3 @@
+cl /O2 /std:c11 /W4 /nologo /Fel_math_bench src/l_math_bench.c /Isrc /D_CRT_SECURE_NO_WARNINGS
+
+@echo off
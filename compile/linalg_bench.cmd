@@ -0,0 +1,3 @@
+cl /O2 /std:c11 /W4 /nologo /Felinalg_bench src/linalg_bench.c /Isrc /D_CRT_SECURE_NO_WARNINGS
+
+@echo off
@@ -0,0 +1,217 @@
+// NOTE: `MAP_ANONYMOUS` and `MADV_HUGEPAGE` are not POSIX.
+#ifndef _WIN32
+    #define _DEFAULT_SOURCE
+#endif // _WIN32
+
+#include "arena.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+#endif // _WIN32
+
+
+// NOTE: Commits go in steps of at least this much, the size of a huge page.
+#define ARENA_STEP ((size_t)2 << 20)
+
+static bool use_huge_pages = false;
+
+
+void arena_use_huge_pages(bool use)
+{
+    use_huge_pages = use;
+}
+
+bool arena_huge_pages(void)
+{
+    return use_huge_pages;
+}
+
+
+static size_t round_up(size_t size, size_t step)
+{
+    return (size + step - 1) / step * step;
+}
+
+// NOTE: A reservation takes at most a sixteenth of an address space limit,
+//       so a few arenas leave room for everything else.
+static size_t first_reserve(void)
+{
+    size_t size = ARENA_RESERVE;
+
+#ifndef _WIN32
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_AS, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        while (size > ARENA_MIN_RESERVE && size > limit.rlim_cur / 16) {
+            size /= 2;
+        }
+    }
+#endif // _WIN32
+
+    return size;
+}
+
+static bool reserve(arena_t *arena)
+{
+    for (size_t size = first_reserve(); size >= ARENA_MIN_RESERVE; size /= 2) {
+#ifdef _WIN32
+        arena->base = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void *base = mmap(NULL, size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        arena->base = base == MAP_FAILED ? NULL : base;
+#endif // _WIN32
+
+        if (arena->base) {
+            arena->reserved = size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void release(arena_t *arena)
+{
+#ifdef _WIN32
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+    munmap(arena->base, arena->reserved);
+#endif // _WIN32
+}
+
+static bool commit(unsigned char *begin, size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(begin, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    if (mprotect(begin, size, PROT_READ | PROT_WRITE) != 0)
+        return false;
+
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages) {
+        madvise(begin, size, MADV_HUGEPAGE);
+    }
+#endif // MADV_HUGEPAGE
+
+    return true;
+#endif // _WIN32
+}
+
+static void decommit(unsigned char *begin, size_t size)
+{
+#ifdef _WIN32
+    VirtualFree(begin, size, MEM_DECOMMIT);
+#else
+    madvise(begin, size, MADV_DONTNEED);
+    mprotect(begin, size, PROT_NONE);
+#endif // _WIN32
+}
+
+
+// NOTE: The heap copy of a buffer with no room left in its reservation.
+static void *grow_moving(arena_t *arena, size_t committed)
+{
+    unsigned char *base;
+
+    if (arena->moving) {
+        base = realloc(arena->base, committed);
+        if (!base)
+            return NULL;
+    }
+    else {
+        base = malloc(committed);
+        if (!base)
+            return NULL;
+
+        if (arena->base) {
+            memcpy(base, arena->base, arena->committed);
+            release(arena);
+        }
+
+        arena->moving = true;
+        arena->reserved = 0;
+    }
+
+    arena->base = base;
+    arena->committed = committed;
+    return base;
+}
+
+// NOTE: The commits at least double, like the stretchy buffers, so a buffer
+//       growing one item at a time does not go to the system every time.
+void *arena_grow(arena_t *arena, size_t size)
+{
+    if (size <= arena->committed)
+        return arena->base;
+
+    if (!arena->base && !arena->moving && !reserve(arena)) {
+        arena->moving = true;
+    }
+
+    size_t committed = arena->committed * 2 > size ? arena->committed * 2 : size;
+    committed = round_up(committed, ARENA_STEP);
+
+    if (committed < size)
+        return NULL;
+
+    if (arena->moving || size > arena->reserved)
+        return grow_moving(arena, committed);
+
+    if (committed > arena->reserved) {
+        committed = arena->reserved;
+    }
+
+    if (!commit(arena->base + arena->committed, committed - arena->committed))
+        return NULL;
+
+    arena->committed = committed;
+    return arena->base;
+}
+
+void arena_trim(arena_t *arena, size_t size)
+{
+    size = round_up(size, ARENA_STEP);
+
+    if (size >= arena->committed)
+        return;
+
+    if (arena->moving) {
+        // NOTE: Shrinking in place may still fail, the bigger block is kept.
+        unsigned char *base = size ? realloc(arena->base, size) : NULL;
+
+        if (!size) {
+            free(arena->base);
+        }
+        else if (!base) {
+            return;
+        }
+
+        arena->base = base;
+        arena->committed = size;
+        return;
+    }
+
+    decommit(arena->base + size, arena->committed - size);
+    arena->committed = size;
+}
+
+void arena_free(arena_t *arena)
+{
+    if (arena->moving) {
+        free(arena->base);
+    }
+    else if (arena->base) {
+        release(arena);
+    }
+
+    *arena = (arena_t) {0};
+}
@@ -0,0 +1,79 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Growable buffer that rarely moves.
+ * The first growth reserves up to `ARENA_RESERVE` bytes of address space,
+ * the pages are committed as the buffer grows into them, so growing copies
+ * nothing and the address stays the same. Under an address space limit the
+ * reservation is halved until it fits, down to `ARENA_MIN_RESERVE`. A buffer
+ * that got no reservation or outgrows it moves to the heap and from then on
+ * grows like a stretchy buffer, so the address is only stable up to the
+ * next growth. `arena_trim` gives the pages past a size back to the system.
+ */
+
+#define ARENA_RESERVE     ((size_t)1 << 38)
+#define ARENA_MIN_RESERVE ((size_t)64 << 20)
+
+typedef struct
+{
+    unsigned char *base;
+    size_t committed, reserved;
+    bool moving;
+} arena_t;
+
+// NOTE: Process wide and off by default, applies to the pages committed from
+//       then on. Only Linux backs arenas with transparent huge pages.
+void arena_use_huge_pages(bool use);
+bool arena_huge_pages(void);
+
+// NOTE: Makes the first `size` bytes usable, returns NULL when the memory
+//       could not be had, the buffer is left as it was then.
+void *arena_grow(arena_t *arena, size_t size);
+
+// NOTE: The content past `size` is lost.
+void arena_trim(arena_t *arena, size_t size);
+
+void arena_free(arena_t *arena);
+
+
+/* argument must be an 'lvalue', except for `amount` */
+#define dck_arena_t(data_type, size_type) \
+    struct { data_type *data; size_type count, capacity; arena_t arena; }
+
+/* argument must be an 'lvalue', except for `amount`, see `dck_arena_has_room` */
+#define dck_arena_reserve(dck, amount)                                                  \
+do {                                                                                    \
+    if ((dck).count + (amount) > (dck).capacity) {                                      \
+        void *new_data = arena_grow(&(dck).arena,                                       \
+                                    sizeof(*((dck).data)) * ((size_t)(dck).count + (amount)));\
+        if (new_data) {                                                                 \
+            (dck).data = new_data;                                                      \
+            (dck).capacity = (dck).arena.committed / sizeof(*((dck).data));             \
+        }                                                                               \
+    }                                                                                   \
+} while (0)
+
+/* false when the last `dck_arena_reserve` of `amount` ran out of memory */
+#define dck_arena_has_room(dck, amount) ((size_t)(dck).count + (amount) <= (dck).capacity)
+
+/* argument must be an 'lvalue', except for `item` */
+#define dck_arena_push(dck, item)                                                       \
+do {                                                                                    \
+    dck_arena_reserve(dck, 1);                                                          \
+    malloc_check(dck_arena_has_room(dck, 1));                                           \
+    (dck).data[(dck).count] = item;                                                     \
+    (dck).count++;                                                                      \
+} while (0)
+
+/* argument must be an 'lvalue' */
+#define dck_arena_trim(dck)                                                             \
+do {                                                                                    \
+    arena_trim(&(dck).arena, sizeof(*((dck).data)) * (size_t)(dck).count);              \
+    (dck).data = (void *)(dck).arena.base;                                              \
+    (dck).capacity = (dck).arena.committed / sizeof(*((dck).data));                     \
+} while (0)
+
+#endif // ARENA_H
@@ -150,6 +150,7 @@ void editor_replace(editor_t *editor, int pos,   int dst_size,
     memcpy(editor->text_buffer + pos, src, src_size);
 
     editor->text_size = new_len;
+    ++editor->version;
 }
 
 void editor_reserve(editor_t *editor, int pos, int size)
@@ -174,6 +175,7 @@ void editor_reserve(editor_t *editor, int pos, int size)
             editor->text_size - pos);
 
     editor->text_size = new_len;
+    ++editor->version;
 }
 
 void editor_init(editor_t *editor)
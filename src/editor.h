@@ -13,6 +13,9 @@ typedef struct
     char *text_buffer;
     int text_size, text_capacity;
 
+    // NOTE: Changes with every edit of the text.
+    unsigned version;
+
     int cursor_index;
     int screen_index;
 
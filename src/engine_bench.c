@@ -0,0 +1,262 @@
+#include "l_system.h"
+#include "l_native.h"
+#include "parser.h"
+#include "generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define RUNS 5
+
+typedef struct
+{
+    const char *name;
+    int iterations;
+    const char *source;
+} grammar_t;
+
+// NOTE: Run from the root of the repository, like the program, for the
+//       texture. Matrices, the math builtins, integers, random() and a
+//       successor without a frame.
+static const grammar_t grammars[] = {
+    { "tree", 16,
+        "tex stone_tex(\"res/stone.png\")\n"
+        "res ball = sphere(3, stone_tex)\n"
+        "def b(m: mat, n: int, end: bool) {\n"
+        "    ball(m * scale(0.3))\n"
+        "}\n"
+        "def stem(m: mat, n: int) {\n"
+        "    ball(m)\n"
+        "}\n"
+        "rule b(!end && n < 14) {\n"
+        "    stem(m * position(0.0, 1.0, 0.0), n)\n"
+        "    b(m * position(0.0, 1.0, 0.0) * rotation(0.0, 0.0, 0.5) * scale(0.8), n + 1, false)\n"
+        "    b(m * (rotation(0.0, 0.5, -0.5) * scale(0.7)), n + 1, n > 11)\n"
+        "}\n"
+        "rule b(n >= 14 || end) {\n"
+        "    b(m, n, true)\n"
+        "}\n"
+        "b(position(0.0, 0.0, 0.0), 0, false)\n" },
+
+    { "math", 16,
+        "tex stone_tex(\"res/stone.png\")\n"
+        "res ball = sphere(3, stone_tex)\n"
+        "def b(m: mat, n: int, a: float, end: bool) {\n"
+        "    ball(m * scale(clamp(0.3 * sqrt(a), 0.05, 0.4)))\n"
+        "}\n"
+        "rule b(!end && n < 14 && min(a, 2.0) > 0.01) {\n"
+        "    b(m * position(sin(a), 1.0, cos(a)) * rotation(0.0, 0.0, lerp(0.2, 0.9, a)) * scale(max(pow(a, 0.5), 0.6)), n + 1, a * 1.3, false)\n"
+        "    b(m * rotation(0.0, sin(a * 2.0), -0.5) * scale(0.7), n + 1, pow(a, 1.1) + 0.1, n > 11)\n"
+        "}\n"
+        "rule b(n >= 14 || end) {\n"
+        "    b(m, n, a, true)\n"
+        "}\n"
+        "b(position(0.0, 0.0, 0.0), 0, 0.5, false)\n" },
+
+    { "random", 14,
+        "tex stone_tex(\"res/stone.png\")\n"
+        "res ball = sphere(3, stone_tex)\n"
+        "def b(n: int, x: float) {\n"
+        "    ball(position(x, float(n), 0.0) * scale(0.5))\n"
+        "}\n"
+        "rule b(n < 14) : 2 {\n"
+        "    b(n + 1, x + random())\n"
+        "    b(n + 1, x - random())\n"
+        "}\n"
+        "rule b(n < 14) : 1 {\n"
+        "    b(n + 1, x * 0.5)\n"
+        "}\n"
+        "rule b(n >= 14) {\n"
+        "    b(n, x)\n"
+        "}\n"
+        "b(0, 0.0)\n" },
+
+    // NOTE: `b` has no frame and places its ball on its own, the memo must
+    //       not move it with the frame of `a`.
+    { "frameless", 12,
+        "tex stone_tex(\"res/stone.png\")\n"
+        "res ball = sphere(3, stone_tex)\n"
+        "def a(m: mat, n: int) {\n"
+        "    ball(m * scale(0.3))\n"
+        "}\n"
+        "def b(n: int) {\n"
+        "    ball(position(float(n), 5.0, 0.0) * scale(0.5))\n"
+        "}\n"
+        "rule a(n < 12) {\n"
+        "    a(m * position(1.0, 0.0, 0.0), n + 1)\n"
+        "    a(m * position(0.0, 1.0, 0.0), n + 1)\n"
+        "    b(n)\n"
+        "}\n"
+        "a(position(0.0, 0.0, 0.0), 0)\n" },
+};
+
+static l_system_t sys = {
+    .history_budget = (size_t)256 << 20,
+    .memory_budget  = (size_t)4 << 30,
+};
+
+static parse_state_t parse_state;
+static model_builder_t builder;
+
+// NOTE: Parsing uploads the texture atlas, there is no GL context here and
+//       the atlas is never drawn.
+unsigned create_texture_object(texture_data_t data)
+{
+    (void)data;
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// NOTE: The memo moves the geometry it repeats by the difference of the
+//       frames, which rounds differently from deriving it, so the models are
+//       compared with a tolerance rather than bit by bit.
+#define MAX_DIFF 1e-3f
+
+static model_data_t first_model;
+
+static float max_diff(model_data_t a, model_data_t b)
+{
+    if (a.vertex_count != b.vertex_count || a.index_count != b.index_count)
+        return INFINITY;
+
+    if (memcmp(a.indices, b.indices, sizeof(unsigned) * a.index_count) != 0)
+        return INFINITY;
+
+    const float *fa = (const float *)a.vertices, *fb = (const float *)b.vertices;
+    size_t count = sizeof(vertex_t) / sizeof(float) * a.vertex_count;
+    float diff = 0.0f;
+
+    for (size_t i = 0; i < count; ++i) {
+        diff = fmaxf(diff, fabsf(fa[i] - fb[i]));
+    }
+
+    return diff;
+}
+
+static void keep_model(model_data_t model)
+{
+    first_model.vertex_count = model.vertex_count;
+    first_model.index_count  = model.index_count;
+
+    first_model.vertices = realloc(first_model.vertices, sizeof(vertex_t) * model.vertex_count);
+    malloc_check(first_model.vertices);
+    memcpy(first_model.vertices, model.vertices, sizeof(vertex_t) * model.vertex_count);
+
+    first_model.indices = realloc(first_model.indices, sizeof(unsigned) * model.index_count);
+    malloc_check(first_model.indices);
+    memcpy(first_model.indices, model.indices, sizeof(unsigned) * model.index_count);
+}
+
+// NOTE: Parsing starts the system over, so every run iterates from the
+//       axiom. Only `l_system_seek` is timed, the model is built once to
+//       compare the engines. The time is that of whole generations, the
+//       expressions the engines run are only a small part of it next to
+//       rewriting the symbols, the memory and with `emit` the models.
+static char *run(const grammar_t *grammar, char *text, size_t size, double *best)
+{
+    *best = 0.0;
+
+    for (int r = 0; r < RUNS; ++r) {
+        parse(&sys, &parse_state, text, size);
+        if (!parse_state.res.success)
+            return "Failed to parse!";
+
+        if (sys.engine == l_engine_Native) {
+            char *error = l_native_load(&sys, text, size);
+            if (error)
+                return error;
+        }
+
+        builder.data.vertex_count = 0;
+        builder.data.index_count  = 0;
+
+        double begin = now();
+        char *error = l_system_seek(&sys, grammar->iterations);
+        double time = now() - begin;
+
+        if (error)
+            return error;
+
+        if (r == 0 || time < *best)
+            *best = time;
+    }
+
+    // NOTE: What was emitted while iterating stays, the rest is added.
+    if (!sys.emit) {
+        builder.data.vertex_count = 0;
+        builder.data.index_count  = 0;
+    }
+
+    l_build_t build = l_system_build(&sys, &builder);
+    if (build.error)
+        return build.error;
+
+    return NULL;
+}
+
+
+int main(void)
+{
+    int differences = 0;
+
+    printf("best of %d runs of l_system_seek, the time of whole generations,\n"
+           "the engines only differ in the expressions, rewriting, memory and\n"
+           "the models built with memo are the same work for all of them\n\n", RUNS);
+    printf("%-10s %-14s %12s %10s\n", "", "engine", "seeking", "vertices");
+
+    for (unsigned g = 0; g < sizeof(grammars) / sizeof(*grammars); ++g) {
+        const grammar_t *grammar = grammars + g;
+
+        size_t size = strlen(grammar->source);
+        char *text = malloc(size + 1);
+        malloc_check(text);
+        memcpy(text, grammar->source, size + 1);
+
+        // NOTE: Every engine once breadth first and once depth first with the
+        //       subtree memo, both have to build the very same model.
+        for (int c = 0; c < L_ENGINE_COUNT * 2; ++c) {
+            int e = c % L_ENGINE_COUNT;
+            bool memo = c >= L_ENGINE_COUNT;
+
+            sys.engine = e;
+            sys.depth_first = memo;
+            sys.emit = memo ? &builder : NULL;
+            sys.memo_budget = memo ? (size_t)16 << 20 : 0;
+
+            char config[32];
+            snprintf(config, sizeof(config), "%s%s", l_engine_name(e), memo ? " memo" : "");
+
+            double best;
+            char *error = run(grammar, text, size, &best);
+
+            if (error) {
+                printf("%-10s %-14s %s\n", grammar->name, config, error);
+                continue;
+            }
+
+            if (c == 0)
+                keep_model(builder.data);
+
+            float diff = max_diff(first_model, builder.data);
+            differences += !(diff <= MAX_DIFF);
+
+            printf("%-10s %-14s %9.3f ms %10d   max diff %g%s\n", grammar->name, config,
+                   best * 1000.0, builder.data.vertex_count, diff,
+                   diff <= MAX_DIFF ? "" : ", differs from the first engine!");
+        }
+
+        free(text);
+    }
+
+    return differences != 0;
+}
@@ -2,52 +2,68 @@
 
 #include "utils.h"
 
+#include <limits.h>
 
-static inline void stretch(model_builder_t *builder, int vertex_count, int index_count)
+
+// NOTE: The arenas commit more than asked for, the capacities follow them.
+static void update_capacities(model_builder_t *builder)
+{
+    size_t vertex_capacity = builder->vertex_arena.committed / sizeof(vertex_t);
+    size_t index_capacity  = builder->index_arena.committed  / sizeof(unsigned);
+
+    builder->vertex_capacity = vertex_capacity < INT_MAX ? (int)vertex_capacity : INT_MAX;
+    builder->index_capacity  = index_capacity  < INT_MAX ? (int)index_capacity  : INT_MAX;
+}
+
+// NOTE: False when out of memory, the builder is left as it was.
+static inline bool stretch(model_builder_t *builder, int vertex_count, int index_count)
 {
     int new_count = builder->data.vertex_count + vertex_count;
 
     if (new_count > builder->vertex_capacity) {
-        int capacity = builder->vertex_capacity;
+        vertex_t *vertices = arena_grow(&builder->vertex_arena, new_count * sizeof(vertex_t));
+        if (!vertices)
+            return false;
 
-        capacity = capacity ? capacity * 2
-                            : (4096 / sizeof(vertex_t));
+        builder->data.vertices = vertices;
+        update_capacities(builder);
+    }
 
-        while (new_count > capacity) {
-            capacity *= 2;
-        }
+    new_count = builder->data.index_count + index_count;
 
-        builder->data.vertices = realloc(builder->data.vertices,
-                                         capacity * sizeof(vertex_t));
-        malloc_check(builder->data.vertices);
+    if (new_count > builder->index_capacity) {
+        unsigned *indices = arena_grow(&builder->index_arena, new_count * sizeof(unsigned));
+        if (!indices)
+            return false;
 
-        builder->vertex_capacity = capacity;
+        builder->data.indices = indices;
+        update_capacities(builder);
     }
 
-    new_count = builder->data.index_count + index_count;
+    return true;
+}
 
-    if (new_count > builder->index_capacity) {
-        int capacity = builder->index_capacity;
 
-        capacity = capacity ? capacity * 2
-                            : (4096 / sizeof(unsigned));
+bool model_builder_reserve(model_builder_t *builder, int vertex_count, int index_count)
+{
+    return stretch(builder, vertex_count, index_count);
+}
 
-        while (new_count > capacity) {
-            capacity *= 2;
-        }
+void model_builder_trim(model_builder_t *builder)
+{
+    arena_trim(&builder->vertex_arena, builder->data.vertex_count * sizeof(vertex_t));
+    arena_trim(&builder->index_arena,  builder->data.index_count  * sizeof(unsigned));
 
-        builder->data.indices = realloc(builder->data.indices,
-                                        capacity * sizeof(unsigned));
-        malloc_check(builder->data.indices);
+    builder->data.vertices = (vertex_t *)builder->vertex_arena.base;
+    builder->data.indices  = (unsigned *)builder->index_arena.base;
 
-        builder->index_capacity = capacity;
-    }
+    update_capacities(builder);
 }
 
 
 void model_builder_push(model_builder_t *builder, model_data_t data)
 {
-    stretch(builder, data.vertex_count, data.index_count);
+    malloc_check(stretch(builder, data.vertex_count, data.index_count));
 
     memcpy(builder->data.vertices + builder->data.vertex_count,
            data.vertices,
@@ -67,38 +83,26 @@ void model_builder_push(model_builder_t *builder, model_data_t data)
 
 void model_builder_merge(model_builder_t *builder,
                          model_data_t data,
-                         matrix_t transform)
+                         affine_t transform)
 {
-    stretch(builder, data.vertex_count, data.index_count);
+    malloc_check(stretch(builder, data.vertex_count, data.index_count));
 
-    matrix_t norm_transform = matrix_transpose(matrix_inverse(transform));
+    affine_t norm_transform = affine_normal(transform);
 
     int vertex_count = builder->data.vertex_count;
 
     for (int i = 0; i < data.vertex_count; ++i) {
         vertex_t vert = data.vertices[i];
 
-        vector_t p = {
-            vert.positions[0],
-            vert.positions[1],
-            vert.positions[2],
-            1.0f,
-        };
-
-        p = vector_transform(p, transform);
+        vec3_t p = {{ vert.positions[0], vert.positions[1], vert.positions[2] }};
+        p = affine_transform_point(transform, p);
 
         vert.positions[0] = p.x;
         vert.positions[1] = p.y;
         vert.positions[2] = p.z;
 
-        vector_t n = {
-            vert.normals[0],
-            vert.normals[1],
-            vert.normals[2],
-            0.0f,
-        };
-
-        n = vector_transform(n, norm_transform);
+        vec3_t n = {{ vert.normals[0], vert.normals[1], vert.normals[2] }};
+        n = affine_transform_vector(norm_transform, n);
 
         vert.normals[0] = n.x;
         vert.normals[1] = n.y;
@@ -120,6 +124,63 @@ void model_builder_merge(model_builder_t *builder,
 }
 
 
+void model_builder_repeat(model_builder_t *builder,
+                          int vertex_begin, int vertex_end,
+                          int index_begin,  int index_end)
+{
+    malloc_check(stretch(builder, vertex_end - vertex_begin, index_end - index_begin));
+
+    int vertex_count = builder->data.vertex_count;
+
+    memcpy(builder->data.vertices + vertex_count,
+           builder->data.vertices + vertex_begin,
+           (vertex_end - vertex_begin) * sizeof(vertex_t));
+
+    builder->data.vertex_count += vertex_end - vertex_begin;
+
+
+    int index_count = builder->data.index_count;
+    unsigned offset = vertex_count - vertex_begin;
+
+    for (int i = 0; i < index_end - index_begin; ++i) {
+        builder->data.indices[index_count + i] = offset + builder->data.indices[index_begin + i];
+    }
+
+    builder->data.index_count += index_end - index_begin;
+}
+
+
+void model_builder_repeat_transformed(model_builder_t *builder,
+                                      int vertex_begin, int vertex_end,
+                                      int index_begin,  int index_end,
+                                      affine_t transform)
+{
+    int vertex_count = builder->data.vertex_count;
+
+    model_builder_repeat(builder, vertex_begin, vertex_end, index_begin, index_end);
+
+    affine_t norm_transform = affine_normal(transform);
+
+    for (int i = vertex_count; i < builder->data.vertex_count; ++i) {
+        vertex_t *vert = builder->data.vertices + i;
+
+        vec3_t p = {{ vert->positions[0], vert->positions[1], vert->positions[2] }};
+        p = affine_transform_point(transform, p);
+
+        vert->positions[0] = p.x;
+        vert->positions[1] = p.y;
+        vert->positions[2] = p.z;
+
+        vec3_t n = {{ vert->normals[0], vert->normals[1], vert->normals[2] }};
+        n = affine_transform_vector(norm_transform, n);
+
+        vert->normals[0] = n.x;
+        vert->normals[1] = n.y;
+        vert->normals[2] = n.z;
+    }
+}
+
+
 model_data_t generate_cylinder(int n, frect_t view)
 {
     assert(n > 1);
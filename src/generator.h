@@ -3,20 +3,42 @@
 
 #include "linalg.h"
 #include "res.h"
+#include "arena.h"
 
+// NOTE: The vertices and indices live in arenas, growing never copies them.
 typedef struct
 {
     model_data_t data;
 
     int vertex_capacity, index_capacity;
+    arena_t vertex_arena, index_arena;
 } model_builder_t;
 
 
+// NOTE: Makes room for `vertex_count` and `index_count` more, false when out
+//       of memory. The other functions grow the builder as needed.
+bool model_builder_reserve(model_builder_t *builder, int vertex_count, int index_count);
+
+// NOTE: Gives the memory past the current counts back to the system.
+void model_builder_trim(model_builder_t *builder);
+
 void model_builder_push(model_builder_t *builder, model_data_t data);
 
 void model_builder_merge(model_builder_t *builder,
                          model_data_t data,
-                         matrix_t transform);
+                         affine_t transform);
+
+// NOTE: Appends a copy of geometry the builder already holds, the indices
+//       in the range may only point at the vertices in the range.
+void model_builder_repeat(model_builder_t *builder,
+                          int vertex_begin, int vertex_end,
+                          int index_begin,  int index_end);
+
+// NOTE: Same as `model_builder_repeat` with the copy moved by `transform`.
+void model_builder_repeat_transformed(model_builder_t *builder,
+                                      int vertex_begin, int vertex_end,
+                                      int index_begin,  int index_end,
+                                      affine_t transform);
 
 model_data_t generate_cylinder(int n, frect_t view);
 model_data_t generate_quad_sphere(int n, frect_t view);
@@ -0,0 +1,207 @@
+#ifndef L_MATH_H
+#define L_MATH_H
+
+// NOTE: The native engine compiles this file into every grammar as it is, so
+//       it includes nothing of the project and only has `static inline`
+//       functions, see `l_native_load`.
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* math builtins
+ *
+ * `sin`, `cos` and `pow` of the code are truncated series on a reduced range
+ * without calls or branches, so the batch engine vectorizes them and every
+ * engine gets the same floats. The first term left out is below the float
+ * resolution of the range, the error is a few ulp from the reduction and
+ * the rounding. `exact_math` runs `sinf`, `cosf` and `powf` instead to
+ * compare against. The rounding tricks only hold without `-ffast-math`.
+ */
+
+#define L_ROUND_MAGIC 12582912.0f
+
+typedef union
+{
+    float f;
+    uint32_t u;
+} l_float_bits_t;
+
+// NOTE: `pick ? a : b` on the bits. The special cases are picked at the end,
+//       with a plain select GCC moves the whole series into a branch for
+//       the other case, and a loop with branches does not vectorize.
+static inline float l_pick(bool pick, float a, float b)
+{
+    l_float_bits_t x = { a }, y = { b };
+    uint32_t mask = -(uint32_t)pick;
+
+    x.u = (x.u & mask) | (y.u & ~mask);
+    return x.f;
+}
+
+// NOTE: sin(x + half * PI) for `half` 0 or 0.5. With `k` the nearest integer
+//       to x / PI + half the result is (-1)^k sin(r), r = x - (k - half) PI in
+//       [-PI / 2, PI / 2]. Adding 1.5 * 2^23 rounds to an integer, the lowest
+//       bit of the sum is its parity. PI is split in three (Cody and Waite),
+//       so r stays exact up to |x| of about 10^5. Past 2^22 PI nothing of
+//       the angle is left, the result only stays in [-1, 1].
+static inline float l_sin_shifted(float x, float half)
+{
+    l_float_bits_t k = { x * 0.31830988618f + half + L_ROUND_MAGIC };
+    float m = (k.f - L_ROUND_MAGIC) - half;
+
+    float r = x - m * 3.140625f;
+    r = r - m * 9.67502593994140625e-4f;
+    r = r - m * 1.509957990978376432e-7f;
+
+    float r2 = r * r;
+    float p = 1.0f / 6227020800.0f;
+    p = p * r2 - 1.0f / 39916800.0f;
+    p = p * r2 + 1.0f / 362880.0f;
+    p = p * r2 - 1.0f / 5040.0f;
+    p = p * r2 + 1.0f / 120.0f;
+    p = p * r2 - 1.0f / 6.0f;
+    p = r + r * r2 * p;
+
+    p = k.u & 1 ? -p : p;
+    p = p >  1.0f ?  1.0f : p;
+    p = p < -1.0f ? -1.0f : p;
+
+    return p;
+}
+
+static inline float l_sin(float x)
+{
+    return l_sin_shifted(x, 0.0f);
+}
+
+static inline float l_cos(float x)
+{
+    return l_sin_shifted(x, 0.5f);
+}
+
+// NOTE: The hardware square root is already exact and about as fast as
+//       a multiplication.
+static inline float l_sqrt(float x)
+{
+    return sqrtf(x);
+}
+
+// NOTE: log2 of |x| is the exponent plus 2 / ln 2 atanh((m - 1) / (m + 1))
+//       with the mantissa m in [sqrt(1/2), sqrt(2)). Zero, infinity and NaN
+//       have no mantissa and are picked out at the end.
+static inline float l_log2(float x)
+{
+    // NOTE: Subnormals are scaled by 2^23 first.
+    float ax = fabsf(x);
+    bool subnormal = ax < 1.17549435e-38f;
+
+    l_float_bits_t b = { l_pick(subnormal, ax * 8388608.0f, ax) };
+    int e = (int)(b.u >> 23) - 127 - 23 * subnormal;
+
+    b.u = (b.u & 0x007FFFFFu) | 0x3F800000u;
+
+    bool high = b.f > 1.41421356f;
+    b.u -= (uint32_t)high << 23;
+    e += high;
+
+    float m = b.f;
+
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+
+    float p = 1.0f / 9.0f;
+    p = p * t2 + 1.0f / 7.0f;
+    p = p * t2 + 1.0f / 5.0f;
+    p = p * t2 + 1.0f / 3.0f;
+    p = p * t2 + 1.0f;
+
+    float res = (float)e + t * p * 2.88539008f;
+
+    res = l_pick(ax == 0.0f, -INFINITY, res);
+    res = l_pick((ax == INFINITY) | (ax != ax), ax, res);
+
+    return res;
+}
+
+// NOTE: 2^x is 2^n e^(f ln 2) with n the nearest integer. 2^n is two
+//       factors, so it reaches the subnormals and the top exponent. Out of
+//       range n is garbage and the result is picked at the end.
+static inline float l_exp2(float x)
+{
+    l_float_bits_t k = { x + L_ROUND_MAGIC };
+    float g = (x - (k.f - L_ROUND_MAGIC)) * 0.69314718f;
+
+    float p = 1.0f / 5040.0f;
+    p = p * g + 1.0f / 720.0f;
+    p = p * g + 1.0f / 120.0f;
+    p = p * g + 1.0f / 24.0f;
+    p = p * g + 1.0f / 6.0f;
+    p = p * g + 1.0f / 2.0f;
+    p = p * g + 1.0f;
+    p = p * g + 1.0f;
+
+    int n = (int)(k.u - 0x4B400000u);
+    int half = n / 2;
+
+    l_float_bits_t low  = { .u = (uint32_t)(half + 127) << 23 };
+    l_float_bits_t high = { .u = (uint32_t)(n - half + 127) << 23 };
+
+    float res = p * low.f * high.f;
+
+    res = l_pick(x >= 128.0f, INFINITY, res);
+    res = l_pick(x < -150.0f, 0.0f, res);
+
+    return res;
+}
+
+// NOTE: Fixes up `power` = 2^(y log2 |x|) into x^y with the special cases of
+//       `powf`. A negative base only has a power for integer exponents,
+//       floats past 2^23 are all integers and past 2^24 all even.
+static inline float l_pow_signs(float x, float y, float power)
+{
+    l_float_bits_t res = { power }, xb = { x };
+
+    // NOTE: Adding 2^23 rounds away the fraction of anything below it.
+    float ay = fabsf(y), half = ay * 0.5f;
+    bool integer = (ay >= 8388608.0f) | ((ay + 8388608.0f) - 8388608.0f == ay);
+    bool odd = integer & (ay < 16777216.0f) & ((half + 8388608.0f) - 8388608.0f != half);
+
+    // NOTE: The sign bit of `x` is taken rather than `x < 0`, odd powers of
+    //       -0 are -0 or -inf.
+    res.u ^= ((uint32_t)odd & (xb.u >> 31)) << 31;
+
+    // NOTE: -inf to a fraction is +inf or +0, the magnitude from `l_log2` is
+    //       right already.
+    res.f = l_pick((x < 0.0f) & (x != -INFINITY) & !integer, NAN, res.f);
+    res.f = l_pick((x == 1.0f) | (y == 0.0f) | ((x == -1.0f) & (ay == INFINITY)), 1.0f, res.f);
+
+    return res.f;
+}
+
+static inline float l_pow(float x, float y)
+{
+    return l_pow_signs(x, y, l_exp2(y * l_log2(x)));
+}
+
+static inline float l_min(float a, float b)
+{
+    return b < a ? b : a;
+}
+
+static inline float l_max(float a, float b)
+{
+    return a < b ? b : a;
+}
+
+static inline float l_lerp(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+static inline float l_clamp(float x, float lo, float hi)
+{
+    return l_min(l_max(x, lo), hi);
+}
+
+#endif // L_MATH_H
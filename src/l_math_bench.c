@@ -0,0 +1,170 @@
+#include "l_math.h"
+
+#include <stdio.h>
+#include <time.h>
+
+
+#define INPUT_COUNT 4096
+#define ROUNDS      1024
+
+// NOTE: Everything the functions return is folded in here, so none of the
+//       calls can be thrown away.
+static volatile float sink;
+
+static float xs[INPUT_COUNT], ys[INPUT_COUNT], out[INPUT_COUNT];
+
+static double now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// NOTE: A small xorshift, the inputs only have to be the same every run.
+static float next_float(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return (float)(x >> 8) / (float)(1u << 24);
+}
+
+static void report(const char *name, double exact, double fast, double error)
+{
+    double ops = (double)INPUT_COUNT * ROUNDS;
+
+    printf("%-8s %8.2f ns %8.2f ns %6.2fx   max error %g\n", name,
+           exact * 1e9 / ops, fast * 1e9 / ops, exact / fast, error);
+}
+
+
+/* throughput */
+
+// NOTE: A loop over an array like the lanes of the batch engine, the series
+//       are meant to vectorize there.
+#define BENCH(call, out_time)                                                  \
+    {                                                                          \
+        double begin = now();                                                  \
+        for (int r = 0; r < ROUNDS; r++) {                                     \
+            for (int i = 0; i < INPUT_COUNT; i++)                              \
+                out[i] = call;                                                 \
+            sink += out[r % INPUT_COUNT];                                      \
+        }                                                                      \
+        out_time = now() - begin;                                              \
+    }
+
+static void bench_sin(void)
+{
+    double exact, fast;
+
+    BENCH(sinf(xs[i]), exact);
+    BENCH(l_sin(xs[i]), fast);
+
+    // NOTE: Absolute error against double, over the whole range of the inputs.
+    double error = 0.0;
+    for (int i = -2000000; i <= 2000000; i++) {
+        float x = (float)i * 0.0005f;
+        error = fmax(error, fabs((double)l_sin(x) - sin((double)x)));
+        error = fmax(error, fabs((double)l_cos(x) - cos((double)x)));
+    }
+
+    report("sin/cos", exact, fast, error);
+}
+
+static void bench_pow(void)
+{
+    double exact, fast;
+
+    BENCH(powf(xs[i] + 1000.0f, ys[i]), exact);
+    BENCH(l_pow(xs[i] + 1000.0f, ys[i]), fast);
+
+    // NOTE: Relative error, only where `powf` stays a normal float.
+    double error = 0.0;
+    for (int i = 1; i < 100000; i++) {
+        for (int j = -40; j <= 40; j++) {
+            float x = (float)i * 0.001f, y = (float)j * 0.25f;
+            float r = powf(x, y);
+
+            if (r < 1e-30f || r > 1e30f)
+                continue;
+
+            error = fmax(error, fabs((double)l_pow(x, y) - r) / r);
+        }
+    }
+
+    report("pow", exact, fast, error);
+}
+
+
+/* special cases */
+
+// NOTE: Finite results are only rounded differently, those are in the error
+//       above. Here the kind and the sign have to match.
+static bool same_case(float a, float b)
+{
+    if (a != a || b != b)
+        return a != a && b != b;
+
+    bool a_edge = a == 0.0f || isinf(a), b_edge = b == 0.0f || isinf(b);
+
+    return signbit(a) == signbit(b) && a_edge == b_edge && (!a_edge || a == b);
+}
+
+// NOTE: Every pair of these against `powf`, the cases where the sign or a
+//       NaN comes from the inputs rather than from the series.
+static int check_pow(void)
+{
+    static const float bases[] = {
+        0.0f, -0.0f, 0.5f, 1.0f, 2.0f, 123.4f, -0.5f, -1.0f, -2.0f, -3.0f,
+        INFINITY, -INFINITY, NAN,
+    };
+    static const float exponents[] = {
+        0.0f, -0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 2.5f, -2.5f, 3.0f, -3.0f, 7.3f,
+        20.0f, 5000001.0f, 10000001.0f, 1e9f, INFINITY, -INFINITY, NAN,
+    };
+
+    int count = sizeof(bases) / sizeof(*bases);
+    int exponent_count = sizeof(exponents) / sizeof(*exponents);
+    int mismatches = 0;
+
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < exponent_count; j++) {
+            float x = bases[i], y = exponents[j];
+            float a = powf(x, y), b = l_pow(x, y);
+
+            if (same_case(a, b))
+                continue;
+
+            printf("pow(%g, %g): powf %g, l_pow %g\n", x, y, a, b);
+            mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+
+int main(void)
+{
+    uint32_t state = 0x9E3779B9u;
+
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        xs[i] = (next_float(&state) * 2.0f - 1.0f) * 100.0f;
+        ys[i] = (next_float(&state) * 2.0f - 1.0f) * 10.0f;
+    }
+
+    printf("%d x %d calls each\n\n", ROUNDS, INPUT_COUNT);
+    printf("%-8s %11s %11s %7s\n", "", "libm", "series", "");
+
+    bench_sin();
+    bench_pow();
+
+    int mismatches = check_pow();
+    printf("\npow special cases: %d mismatches\n", mismatches);
+
+    return mismatches != 0 || sink != sink;
+}
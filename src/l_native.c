@@ -0,0 +1,866 @@
+#include "l_native.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _WIN32
+    #include <dlfcn.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/wait.h>
+#endif // _WIN32
+
+
+// NOTE: Part of the cache key, bump it whenever the generated code changes.
+#define L_NATIVE_VERSION 7
+
+#define MAX_NATIVE_DEPTH 256
+#define MAX_PATH_SIZE    1024
+
+// NOTE: The longest name put into the cache is the temporary object, the
+//       directory is left that much less room, so no path is ever cut off.
+#define CACHE_NAME_SIZE  (sizeof("/0123456789abcdef.so.XXXXXX") - 1)
+#define CACHE_DIR_SIZE   (MAX_PATH_SIZE - CACHE_NAME_SIZE)
+#define CACHE_APP_SIZE   (sizeof("/severe-artism") - 1)
+
+// NOTE: The math builtins are read next to the shaders and written after the
+//       prelude, so native code runs the very same series as the VMs.
+#define L_MATH_PATH "src/l_math.h"
+
+static const char *native_prelude =
+    "#include <math.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <stddef.h>\n"
+    "\n"
+    "typedef struct { float data[12]; } affine_t;\n"
+    "\n"
+    "typedef struct\n"
+    "{\n"
+    "    int type;\n"
+    "    union { int integer; float floating; bool boolean; unsigned matrix; } data;\n"
+    "} l_value_t;\n"
+    "\n"
+    "typedef int (*l_native_fn_t)(const l_value_t *params, const affine_t *matrices,\n"
+    "                             l_value_t *out, affine_t *out_matrix);\n"
+    "\n"
+    "static affine_t m_multiply(affine_t aff1, affine_t aff2)\n"
+    "{\n"
+    "    const float *a = aff1.data, *b = aff2.data;\n"
+    "    affine_t res;\n"
+    "    for (int j = 0; j < 4; j++) {\n"
+    "        for (int i = 0; i < 3; i++)\n"
+    "            res.data[j * 3 + i] = a[i] * b[j * 3] + a[3 + i] * b[j * 3 + 1] + a[6 + i] * b[j * 3 + 2];\n"
+    "    }\n"
+    "    res.data[9] += a[9]; res.data[10] += a[10]; res.data[11] += a[11];\n"
+    "    return res;\n"
+    "}\n"
+    "\n"
+    "static affine_t m_scale(float x, float y, float z)\n"
+    "{\n"
+    "    return (affine_t) {{ x, 0, 0,  0, y, 0,  0, 0, z,  0, 0, 0 }};\n"
+    "}\n"
+    "\n"
+    "static affine_t m_translation(float x, float y, float z)\n"
+    "{\n"
+    "    return (affine_t) {{ 1, 0, 0,  0, 1, 0,  0, 0, 1,  x, y, z }};\n"
+    "}\n"
+    "\n"
+    "static affine_t m_rotation(float x, float y, float z)\n"
+    "{\n"
+    "    float cx = cosf(x), sx = sinf(x);\n"
+    "    float cy = cosf(y), sy = sinf(y);\n"
+    "    float cz = cosf(z), sz = sinf(z);\n"
+    "    return (affine_t) {{ cz * cy, sz * cy, -sy,\n"
+    "                         cz * sy * sx - sz * cx, sz * sy * sx + cz * cx, cy * sx,\n"
+    "                         cz * sy * cx + sz * sx, sz * sy * cx - cz * sx, cy * cx,\n"
+    "                         0, 0, 0 }};\n"
+    "}\n"
+    "\n";
+
+
+static const char *c_type_name(l_basic_t type)
+{
+    switch (type) {
+        case l_basic_Int:   return "int";
+        case l_basic_Float: return "float";
+        case l_basic_Bool:  return "bool";
+        case l_basic_Mat4:  return "affine_t";
+
+        case L_BASIC_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+static const char *c_field_name(l_basic_t type)
+{
+    switch (type) {
+        case l_basic_Int:   return "integer";
+        case l_basic_Float: return "floating";
+        case l_basic_Bool:  return "boolean";
+        case l_basic_Mat4:  return "matrix";
+
+        case L_BASIC_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+// NOTE: Hexadecimal literals, so the native code sees the exact same floats.
+static void fprint_float(FILE *file, float x)
+{
+    if (x != x) {
+        fprintf(file, "NAN");
+    }
+    else if (x == INFINITY || x == -INFINITY) {
+        fprintf(file, "%sINFINITY", x < 0 ? "-" : "");
+    }
+    else {
+        fprintf(file, "%af", (double)x);
+    }
+}
+
+
+typedef struct
+{
+    l_basic_t type;
+    unsigned temp;
+} l_slot_t;
+
+typedef struct
+{
+    const char *op;
+    l_basic_t operand, result;
+} l_c_binary_t;
+
+static const l_c_binary_t c_binaries[L_INST_COUNT] = {
+    [l_inst_AddI] = { "+", l_basic_Int,   l_basic_Int   },
+    [l_inst_AddF] = { "+", l_basic_Float, l_basic_Float },
+    [l_inst_SubI] = { "-", l_basic_Int,   l_basic_Int   },
+    [l_inst_SubF] = { "-", l_basic_Float, l_basic_Float },
+    [l_inst_MulI] = { "*", l_basic_Int,   l_basic_Int   },
+    [l_inst_MulF] = { "*", l_basic_Float, l_basic_Float },
+    [l_inst_DivI] = { "/", l_basic_Int,   l_basic_Int   },
+    [l_inst_DivF] = { "/", l_basic_Float, l_basic_Float },
+    [l_inst_ModI] = { "%", l_basic_Int,   l_basic_Int   },
+
+    [l_inst_LessI]     = { "<",  l_basic_Int,   l_basic_Bool },
+    [l_inst_LessF]     = { "<",  l_basic_Float, l_basic_Bool },
+    [l_inst_MoreI]     = { ">",  l_basic_Int,   l_basic_Bool },
+    [l_inst_MoreF]     = { ">",  l_basic_Float, l_basic_Bool },
+    [l_inst_LessEqI]   = { "<=", l_basic_Int,   l_basic_Bool },
+    [l_inst_LessEqF]   = { "<=", l_basic_Float, l_basic_Bool },
+    [l_inst_MoreEqI]   = { ">=", l_basic_Int,   l_basic_Bool },
+    [l_inst_MoreEqF]   = { ">=", l_basic_Float, l_basic_Bool },
+    [l_inst_EqualI]    = { "==", l_basic_Int,   l_basic_Bool },
+    [l_inst_EqualF]    = { "==", l_basic_Float, l_basic_Bool },
+    [l_inst_NotEqualI] = { "!=", l_basic_Int,   l_basic_Bool },
+    [l_inst_NotEqualF] = { "!=", l_basic_Float, l_basic_Bool },
+
+    [l_inst_And] = { "&&", l_basic_Bool, l_basic_Bool },
+    [l_inst_Or]  = { "||", l_basic_Bool, l_basic_Bool },
+};
+
+typedef struct
+{
+    l_basic_t from, to;
+} l_c_cast_t;
+
+static const l_c_cast_t c_casts[L_INST_COUNT] = {
+    [l_inst_IntToFloat]  = { l_basic_Int,   l_basic_Float },
+    [l_inst_FloatToInt]  = { l_basic_Float, l_basic_Int   },
+    [l_inst_BoolToInt]   = { l_basic_Bool,  l_basic_Int   },
+    [l_inst_BoolToFloat] = { l_basic_Bool,  l_basic_Float },
+    [l_inst_IntToBool]   = { l_basic_Int,   l_basic_Bool  },
+    [l_inst_FloatToBool] = { l_basic_Float, l_basic_Bool  },
+};
+
+
+// NOTE: The type of a value is the one of the instruction that ends its code.
+static l_basic_t result_type(l_instruction_t *code, unsigned end, l_basic_t *param_types)
+{
+    while (end > 1 && code[end - 1].id == l_inst_Noop) {
+        --end;
+    }
+
+    l_instruction_t inst = code[end - 1];
+    l_inst_id_t id = inst.id;
+
+    if (id == l_inst_Value)
+        return inst.op.type;
+
+    if (id == l_inst_Param)
+        return param_types[inst.op.data.integer];
+
+    if (c_binaries[id].op)
+        return c_binaries[id].result;
+
+    if (c_casts[id].from != c_casts[id].to)
+        return c_casts[id].to;
+
+    switch (id) {
+        case l_inst_NegI: return l_basic_Int;
+        case l_inst_NegF: return l_basic_Float;
+
+        case l_inst_Sin:
+        case l_inst_Cos:
+        case l_inst_Sqrt:
+        case l_inst_Pow:
+        case l_inst_Min:
+        case l_inst_Max:
+        case l_inst_Lerp:
+        case l_inst_Clamp:
+            return l_basic_Float;
+        case l_inst_Not:  return l_basic_Bool;
+
+        case l_inst_Matrix:
+        case l_inst_MulM:
+        case l_inst_Rotation:
+        case l_inst_Stretch:
+        case l_inst_Position:
+        case l_inst_Scale:
+            return l_basic_Mat4;
+
+        default:
+            return L_BASIC_COUNT;
+    }
+}
+
+// NOTE: `exact_math` calls the C library where the prelude has a series.
+static const char *math_name(l_inst_id_t id, bool exact)
+{
+    switch (id) {
+        case l_inst_Sin:   return exact ? "sinf" : "l_sin";
+        case l_inst_Cos:   return exact ? "cosf" : "l_cos";
+        case l_inst_Sqrt:  return "l_sqrt";
+        case l_inst_Pow:   return exact ? "powf" : "l_pow";
+        case l_inst_Min:   return "l_min";
+        case l_inst_Max:   return "l_max";
+        case l_inst_Lerp:  return "l_lerp";
+        case l_inst_Clamp: return "l_clamp";
+
+        default: unreachable();
+    }
+}
+
+static unsigned math_eats(l_inst_id_t id)
+{
+    switch (id) {
+        case l_inst_Sin:
+        case l_inst_Cos:
+        case l_inst_Sqrt:
+            return 1;
+
+        case l_inst_Pow:
+        case l_inst_Min:
+        case l_inst_Max:
+            return 2;
+
+        default:
+            return 3;
+    }
+}
+
+typedef struct
+{
+    unsigned target, temp;
+} l_c_join_t;
+
+// NOTE: Every stack slot gets its own single assignment temporary,
+//       the C compiler takes care of the rest. Branches become `if`s,
+//       both sides assign the temporary declared in front of them.
+static char *emit_expr(FILE *file, l_system_t *sys, l_expr_t expr,
+                       l_basic_t *param_types, unsigned index)
+{
+    l_slot_t stack[MAX_NATIVE_DEPTH];
+    unsigned size = 0;
+    unsigned temp = 0;
+
+    l_c_join_t joins[MAX_NATIVE_DEPTH];
+    unsigned join_count = 0;
+
+    if (expr.depth > MAX_NATIVE_DEPTH)
+        return "Expression too deep for native code!";
+
+    fprintf(file, "static int e%u(const l_value_t *p, const affine_t *m,\n"
+                  "              l_value_t *out, affine_t *out_matrix)\n{\n", index);
+    fprintf(file, "    (void)p; (void)m; (void)out_matrix;\n");
+
+    l_instruction_t *code = sys->instructions.data + expr.index;
+
+    for (unsigned i = 0; i <= expr.count; ++i) {
+        while (join_count > 0 && joins[join_count - 1].target == i) {
+            l_c_join_t join = joins[--join_count];
+
+            fprintf(file, "    t%u = t%u;\n    }\n", join.temp, stack[size - 1].temp);
+            stack[size - 1].temp = join.temp;
+        }
+
+        if (i == expr.count)
+            break;
+
+        l_instruction_t inst = code[i];
+        l_inst_id_t id = inst.id;
+
+        if (id == l_inst_Noop)
+            continue;
+
+        if (id == l_inst_Value) {
+            l_basic_t type = inst.op.type;
+            fprintf(file, "    %s t%u = ", c_type_name(type), temp);
+
+            switch (type) {
+                case l_basic_Int: {
+                    fprintf(file, "(int)%d", inst.op.data.integer);
+                } break;
+
+                case l_basic_Float: {
+                    fprint_float(file, inst.op.data.floating);
+                } break;
+
+                case l_basic_Bool: {
+                    fprintf(file, "%s", inst.op.data.boolean ? "true" : "false");
+                } break;
+
+                case l_basic_Mat4: {
+                    return "Matrix literal in native code!";
+                }
+
+                case L_BASIC_COUNT: unreachable();
+            }
+
+            fprintf(file, ";\n");
+            stack[size++] = (l_slot_t) { type, temp++ };
+            continue;
+        }
+
+        if (id == l_inst_Matrix) {
+            affine_t mat = sys->const_matrices.data[inst.op.data.matrix];
+
+            fprintf(file, "    affine_t t%u = {{", temp);
+
+            for (int j = 0; j < 12; ++j) {
+                fprintf(file, j ? ", " : " ");
+                fprint_float(file, mat.data[j]);
+            }
+
+            fprintf(file, " }};\n");
+            stack[size++] = (l_slot_t) { l_basic_Mat4, temp++ };
+            continue;
+        }
+
+        if (id == l_inst_Param) {
+            unsigned param = (unsigned)inst.op.data.integer;
+            l_basic_t type = param_types[param];
+
+            if (type == l_basic_Mat4) {
+                fprintf(file, "    affine_t t%u = m[p[%u].data.matrix];\n", temp, param);
+            }
+            else {
+                fprintf(file, "    %s t%u = p[%u].data.%s;\n",
+                        c_type_name(type), temp, param, c_field_name(type));
+            }
+
+            stack[size++] = (l_slot_t) { type, temp++ };
+            continue;
+        }
+
+        if (c_binaries[id].op) {
+            l_c_binary_t bin = c_binaries[id];
+            l_slot_t a = stack[size - 2];
+            l_slot_t b = stack[size - 1];
+
+            if (id == l_inst_DivI || id == l_inst_ModI) {
+                fprintf(file, "    if (t%u == 0) return %d;\n", b.temp,
+                        id == l_inst_DivI ? l_native_error_DivByZero
+                                          : l_native_error_ModByZero);
+            }
+
+            fprintf(file, "    %s t%u = t%u %s t%u;\n",
+                    c_type_name(bin.result), temp, a.temp, bin.op, b.temp);
+
+            size -= 2;
+            stack[size++] = (l_slot_t) { bin.result, temp++ };
+            continue;
+        }
+
+        if (c_casts[id].from != c_casts[id].to) {
+            l_c_cast_t cast = c_casts[id];
+            l_slot_t a = stack[size - 1];
+
+            fprintf(file, "    %s t%u = (%s)t%u;\n",
+                    c_type_name(cast.to), temp, c_type_name(cast.to), a.temp);
+
+            stack[size - 1] = (l_slot_t) { cast.to, temp++ };
+            continue;
+        }
+
+        switch (id) {
+            case l_inst_IntToFloatBelow: {
+                fprintf(file, "    float t%u = (float)t%u;\n", temp, stack[size - 2].temp);
+                stack[size - 2] = (l_slot_t) { l_basic_Float, temp++ };
+            } break;
+
+            case l_inst_MulM: {
+                fprintf(file, "    affine_t t%u = m_multiply(t%u, t%u);\n",
+                        temp, stack[size - 2].temp, stack[size - 1].temp);
+                size -= 2;
+                stack[size++] = (l_slot_t) { l_basic_Mat4, temp++ };
+            } break;
+
+            case l_inst_NegI:
+            case l_inst_NegF:
+            case l_inst_Not: {
+                l_slot_t a = stack[size - 1];
+
+                fprintf(file, "    %s t%u = %st%u;\n",
+                        c_type_name(a.type), temp, id == l_inst_Not ? "!" : "-", a.temp);
+
+                stack[size - 1] = (l_slot_t) { a.type, temp++ };
+            } break;
+
+            case l_inst_Rotation:
+            case l_inst_Stretch:
+            case l_inst_Position: {
+                const char *fn = id == l_inst_Rotation ? "m_rotation"
+                               : id == l_inst_Stretch  ? "m_scale"
+                                                       : "m_translation";
+
+                fprintf(file, "    affine_t t%u = %s(t%u, t%u, t%u);\n", temp, fn,
+                        stack[size - 3].temp, stack[size - 2].temp, stack[size - 1].temp);
+
+                size -= 3;
+                stack[size++] = (l_slot_t) { l_basic_Mat4, temp++ };
+            } break;
+
+            case l_inst_Scale: {
+                unsigned x = stack[size - 1].temp;
+
+                fprintf(file, "    affine_t t%u = m_scale(t%u, t%u, t%u);\n", temp, x, x, x);
+                stack[size - 1] = (l_slot_t) { l_basic_Mat4, temp++ };
+            } break;
+
+            case l_inst_Sin:
+            case l_inst_Cos:
+            case l_inst_Sqrt:
+            case l_inst_Pow:
+            case l_inst_Min:
+            case l_inst_Max:
+            case l_inst_Lerp:
+            case l_inst_Clamp: {
+                unsigned eats = math_eats(id);
+
+                fprintf(file, "    float t%u = %s(", temp, math_name(id, sys->exact_math));
+
+                for (unsigned k = 0; k < eats; ++k) {
+                    fprintf(file, k ? ", t%u" : "t%u", stack[size - eats + k].temp);
+                }
+
+                fprintf(file, ");\n");
+
+                size -= eats;
+                stack[size++] = (l_slot_t) { l_basic_Float, temp++ };
+            } break;
+
+            case l_inst_AndJump:
+            case l_inst_OrJump: {
+                if (join_count == MAX_NATIVE_DEPTH)
+                    return "Expression too deep for native code!";
+
+                fprintf(file, "    bool t%u = t%u;\n    if (%st%u) {\n", temp, stack[--size].temp,
+                        id == l_inst_AndJump ? "" : "!", temp);
+
+                joins[join_count++] = (l_c_join_t) { i + (unsigned)inst.op.data.integer, temp++ };
+            } break;
+
+            // NOTE: The first branch ends right before the jump in front of the second.
+            case l_inst_JumpIfNot: {
+                if (join_count == MAX_NATIVE_DEPTH)
+                    return "Expression too deep for native code!";
+
+                unsigned target = i + (unsigned)inst.op.data.integer;
+                l_basic_t type = result_type(code, target - 1, param_types);
+
+                if (type == L_BASIC_COUNT)
+                    return "Untyped instruction in native code!";
+
+                fprintf(file, "    %s t%u;\n    if (t%u) {\n", c_type_name(type), temp,
+                        stack[--size].temp);
+
+                joins[join_count++] = (l_c_join_t) { target, temp++ };
+            } break;
+
+            case l_inst_Jump: {
+                l_c_join_t *join = joins + join_count - 1;
+
+                fprintf(file, "    t%u = t%u;\n    } else {\n", join->temp, stack[--size].temp);
+                join->target = i + (unsigned)inst.op.data.integer;
+            } break;
+
+            default: {
+                return "Untyped instruction in native code!";
+            }
+        }
+    }
+
+    assert(size == 1);
+
+    fprintf(file, "    out->type = %d;\n", (int)stack[0].type);
+
+    if (stack[0].type == l_basic_Mat4) {
+        fprintf(file, "    *out_matrix = t%u;\n", stack[0].temp);
+    }
+    else {
+        fprintf(file, "    out->data.%s = t%u;\n", c_field_name(stack[0].type), stack[0].temp);
+    }
+    fprintf(file, "    return 0;\n}\n\n");
+
+    return NULL;
+}
+
+
+// NOTE: The native functions only get the parameters, code drawing random
+//       numbers needs the counter of the symbol and stays on the stack machine.
+static char *number_expr(FILE *file, l_system_t *sys, l_expr_t *expr,
+                         l_basic_t *param_types, unsigned *index)
+{
+    for (unsigned i = 0; i < expr->count; ++i) {
+        if (sys->instructions.data[expr->index + i].id == l_inst_Random) {
+            expr->native_index = L_NO_NATIVE_CODE;
+            return NULL;
+        }
+    }
+
+    char *error;
+
+    if (file && (error = emit_expr(file, sys, *expr, param_types, *index)))
+        return error;
+
+    expr->native_index = (*index)++;
+    return NULL;
+}
+
+// NOTE: Numbers every expression of the system in a fixed order and emits it
+//       when `file` is not NULL. Loading a cached object only numbers them.
+static char *emit_system(FILE *file, l_system_t *sys, unsigned *count)
+{
+    unsigned index = 0;
+    char *error;
+
+    for (unsigned ti = 0; ti < sys->types.count; ++ti) {
+        l_type_t type = sys->types.data[ti];
+        l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+        for (unsigned li = 0; li < type.load_count; ++li) {
+            l_expr_t *expr = &sys->type_loads.data[type.load_index + li].expr;
+
+            if ((error = number_expr(file, sys, expr, param_types, &index)))
+                return error;
+        }
+    }
+
+    for (unsigned ri = 0; ri < sys->rules.count; ++ri) {
+        l_rule_t *rule = sys->rules.data + ri;
+
+        l_type_t type = sys->types.data[rule->left.type];
+        l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+        if ((error = number_expr(file, sys, &rule->left.predicate, param_types, &index)))
+            return error;
+
+        for (unsigned si = 0; si < rule->right_size; ++si) {
+            l_result_t result = sys->results.data[rule->right_index + si];
+            unsigned params_count = sys->types.data[result.type].params_count;
+
+            for (unsigned pi = 0; pi < params_count; ++pi) {
+                l_expr_t *expr = sys->params.data + result.params_index + pi;
+
+                if ((error = number_expr(file, sys, expr, param_types, &index)))
+                    return error;
+            }
+        }
+    }
+
+    if (file) {
+        fprintf(file, "_Static_assert(sizeof(l_value_t) == %zu, \"value size missmatch\");\n",
+                sizeof(l_value_t));
+        fprintf(file, "_Static_assert(offsetof(l_value_t, data) == %zu, \"value layout missmatch\");\n\n",
+                offsetof(l_value_t, data));
+
+        fprintf(file, "const unsigned l_native_count = %u;\n\n", index);
+        fprintf(file, "const l_native_fn_t l_native_table[] = {\n");
+
+        for (unsigned i = 0; i < index; ++i) {
+            fprintf(file, "    e%u,\n", i);
+        }
+
+        fprintf(file, "    NULL,\n};\n");
+    }
+
+    *count = index;
+    return NULL;
+}
+
+
+// NOTE: Composed rules, the math builtins and the functions called for them
+//       are part of the emitted code but not of the source, so the number of
+//       composed generations, the builtins and `exact_math` go into the key
+//       as well.
+static uint64_t source_hash(const char *source, size_t source_size, const char *math,
+                            unsigned composed, bool exact)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < source_size; ++i) {
+        hash = (hash ^ (unsigned char)source[i]) * 1099511628211ull;
+    }
+
+    for (const char *c = math; *c; ++c) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    }
+
+    hash = (hash ^ L_NATIVE_VERSION)    * 1099511628211ull;
+    hash = (hash ^ sizeof(l_value_t))   * 1099511628211ull;
+    hash = (hash ^ composed)            * 1099511628211ull;
+    hash = (hash ^ exact)               * 1099511628211ull;
+
+    return hash;
+}
+
+
+void l_native_unload(l_system_t *sys)
+{
+    sys->native_count = 0;
+    sys->native_fns = NULL;
+
+#ifndef _WIN32
+    if (sys->native_handle) {
+        dlclose(sys->native_handle);
+    }
+#endif // _WIN32
+
+    sys->native_handle = NULL;
+}
+
+
+#ifdef _WIN32
+
+char *l_native_load(l_system_t *sys, const char *source, size_t source_size)
+{
+    (void)source; (void)source_size;
+
+    l_native_unload(sys);
+    return "Native code is only supported with a POSIX compiler!";
+}
+
+#else
+
+// NOTE: Whatever is loaded from the cache runs inside the process, so only
+//       entries the user owns and nobody else can write are trusted.
+static bool private_entry(const struct stat *st, mode_t type)
+{
+    return (st->st_mode & S_IFMT) == type && st->st_uid == getuid()
+        && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// NOTE: `$XDG_CACHE_HOME/severe-artism`, or `~/.cache/severe-artism`, created
+//       0700. A directory someone else could plant objects in is refused.
+//       `path` holds `CACHE_DIR_SIZE` characters.
+static char *cache_dir(char *path)
+{
+    char parent[CACHE_DIR_SIZE - CACHE_APP_SIZE];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int written;
+
+    if (xdg && *xdg == '/') {
+        written = snprintf(parent, sizeof(parent), "%s", xdg);
+    }
+    else if (home && *home == '/') {
+        written = snprintf(parent, sizeof(parent), "%s/.cache", home);
+    }
+    else {
+        return "No directory for the native code cache, set HOME or XDG_CACHE_HOME!";
+    }
+
+    if (written < 0 || (size_t)written >= sizeof(parent))
+        return "Native code cache path is too long!";
+
+    written = snprintf(path, CACHE_DIR_SIZE, "%s/severe-artism", parent);
+    if (written < 0 || (size_t)written >= CACHE_DIR_SIZE)
+        return "Native code cache path is too long!";
+
+    mkdir(parent, 0700);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+        return "Failed to create the native code cache!";
+
+    struct stat st;
+    if (lstat(path, &st) != 0 || !private_entry(&st, S_IFDIR))
+        return "Native code cache is not private to the user!";
+
+    return NULL;
+}
+
+static bool is_cached(const char *so_path)
+{
+    int fd = open(so_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    bool res = fstat(fd, &st) == 0 && private_entry(&st, S_IFREG);
+    close(fd);
+
+    return res;
+}
+
+// NOTE: `CC` names the compiler alone, it is run without a shell. The source
+//       has no extension, so its language is given explicitly.
+static bool run_compiler(const char *cc, const char *out_path, const char *c_path)
+{
+    char *argv[] = {
+        (char *)cc, "-std=c17", "-O2", "-fwrapv", "-shared", "-fPIC",
+        "-o", (char *)out_path, "-x", "c", (char *)c_path, "-x", "none", "-lm",
+        NULL
+    };
+
+    pid_t pid = fork();
+    if (pid == -1)
+        return false;
+
+    if (pid == 0) {
+        execvp(cc, argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static char *build_native(l_system_t *sys, const char *source, size_t source_size,
+                          const char *math)
+{
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) {
+        cc = "cc";
+    }
+
+    char dir[CACHE_DIR_SIZE];
+    char *error = cache_dir(dir);
+    if (error)
+        return error;
+
+    char so_path[MAX_PATH_SIZE], c_path[MAX_PATH_SIZE], tmp_path[MAX_PATH_SIZE];
+    unsigned long long hash = source_hash(source, source_size, math,
+                                          sys->composed_generations, sys->exact_math);
+
+    // NOTE: A cut off path could lose the `XXXXXX` of a template or name
+    //       another object, the size of `dir` leaves room, this only makes
+    //       sure.
+    int so_size  = snprintf(so_path,  MAX_PATH_SIZE, "%s/%016llx.so",       dir, hash);
+    int c_size   = snprintf(c_path,   MAX_PATH_SIZE, "%s/%016llx.c.XXXXXX", dir, hash);
+    int tmp_size = snprintf(tmp_path, MAX_PATH_SIZE, "%s/%016llx.so.XXXXXX", dir, hash);
+
+    if (so_size  < 0 || so_size  >= MAX_PATH_SIZE
+     || c_size   < 0 || c_size   >= MAX_PATH_SIZE
+     || tmp_size < 0 || tmp_size >= MAX_PATH_SIZE)
+        return "Native code cache path is too long!";
+
+    unsigned count;
+
+    if (is_cached(so_path)) {
+        error = emit_system(NULL, sys, &count);
+        if (error)
+            return error;
+    }
+    else {
+        // NOTE: `mkstemp` opens fresh files exclusively, nothing planted under
+        //       the name is followed or written through.
+        int c_fd = mkstemp(c_path);
+        if (c_fd == -1)
+            return "Failed to write native source!";
+
+        FILE *file = fdopen(c_fd, "w");
+        if (!file) {
+            close(c_fd);
+            unlink(c_path);
+            return "Failed to write native source!";
+        }
+
+        fputs(native_prelude, file);
+        fputs(math, file);
+        error = emit_system(file, sys, &count);
+
+        if (fclose(file) != 0 && !error)
+            error = "Failed to write native source!";
+
+        int tmp_fd = error ? -1 : mkstemp(tmp_path);
+        if (!error && tmp_fd == -1)
+            error = "Failed to store native code!";
+
+        if (!error) {
+            close(tmp_fd);
+
+            if (!run_compiler(cc, tmp_path, c_path))
+                error = "Failed to compile native code!";
+            else if (chmod(tmp_path, 0700) != 0)
+                error = "Failed to store native code!";
+        }
+
+        unlink(c_path);
+
+        // NOTE: Renamed only once complete, so a cancelled build is never cached.
+        if (!error && rename(tmp_path, so_path) != 0)
+            error = "Failed to store native code!";
+
+        if (error) {
+            if (tmp_fd != -1)
+                unlink(tmp_path);
+            return error;
+        }
+    }
+
+    void *handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        return "Failed to load native code!";
+
+    const unsigned *native_count = dlsym(handle, "l_native_count");
+    l_native_fn_t *native_fns = dlsym(handle, "l_native_table");
+
+    if (!native_count || !native_fns || *native_count != count) {
+        dlclose(handle);
+        return "Native code does not match the grammar!";
+    }
+
+    sys->native_handle = handle;
+    sys->native_fns = native_fns;
+    sys->native_count = count;
+
+    return NULL;
+}
+
+char *l_native_load(l_system_t *sys, const char *source, size_t source_size)
+{
+    l_native_unload(sys);
+
+    char *math = read_file(L_MATH_PATH);
+    if (!math)
+        return "Failed to read the math builtins for native code!";
+
+    char *error = build_native(sys, source, source_size, math);
+    free(math);
+
+    return error;
+}
+
+#endif // _WIN32
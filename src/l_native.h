@@ -0,0 +1,21 @@
+#ifndef L_NATIVE_H
+#define L_NATIVE_H
+
+#include "l_system.h"
+
+/* native engine
+ *
+ * Every expression of a parsed system is translated to a C function, the
+ * whole file is built into a shared object by the system compiler (`CC`
+ * or `cc`) and loaded back. Objects are cached per user in
+ * `$XDG_CACHE_HOME/severe-artism` under a hash of the grammar source, so an
+ * unchanged grammar is only loaded again, the generated source is removed
+ * once built. The functions are used by `l_evaluate` when `sys->engine` is
+ * `l_engine_Native`.
+ */
+
+char *l_native_load(l_system_t *sys, const char *source, size_t source_size);
+
+void l_native_unload(l_system_t *sys);
+
+#endif // L_NATIVE_H
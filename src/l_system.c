@@ -1,8 +1,10 @@
 #include "l_system.h"
 
 #include "generator.h"
+#include "parallel.h"
 
 #include <stdio.h>
+#include <limits.h>
 
 
 unsigned l_system_add_type(l_system_t *sys,
@@ -33,6 +35,9 @@ unsigned l_system_add_type(l_system_t *sys,
     l_type_t type = {
         .params_index = params_index, .params_count = type_count,
         .load_index   = load_index,   .load_count   = load_count,
+        .mask_index   = L_NO_DECISION,
+        .identity_rule = L_NO_RULE,
+        .frame = L_NO_FRAME,
     };
 
     dck_stretchy_push(sys->types, type);
@@ -54,173 +59,4820 @@ l_expr_t l_system_add_code(l_system_t *sys, l_instruction_t *instructions, int c
     sys->instructions.count += count;
 
 
-    return (l_expr_t) { index, count };
+    return (l_expr_t) {
+        .index = index,
+        .count = count,
+        .depth = l_code_depth(instructions, count),
+        .reg_index = L_NO_REG_CODE,
+        .native_index = L_NO_NATIVE_CODE,
+    };
+}
+
+
+/* number of values every instruction takes from the stack, each pushes one
+ * apart from the jumps */
+// NOTE: `IntToFloatBelow` converts in place, so it counts as taking one.
+//       A jump that is not taken leaves its operand to the code after it,
+//       so on the straight line through the code the jumps take one.
+static const unsigned inst_eats[] = {
+    [l_inst_Value]    = 0,
+    [l_inst_Param]    = 0,
+
+    [l_inst_Add]      = 2,
+    [l_inst_Sub]      = 2,
+    [l_inst_Mul]      = 2,
+    [l_inst_Div]      = 2,
+    [l_inst_Mod]      = 2,
+    [l_inst_Neg]      = 1,
+
+    [l_inst_Less]     = 2,
+    [l_inst_More]     = 2,
+    [l_inst_LessEq]   = 2,
+    [l_inst_MoreEq]   = 2,
+    [l_inst_Equal]    = 2,
+    [l_inst_NotEqual] = 2,
+
+    [l_inst_And]      = 2,
+    [l_inst_Or]       = 2,
+    [l_inst_Not]      = 1,
+    [l_inst_Select]   = 3,
+
+    [l_inst_CastInt]   = 1,
+    [l_inst_CastFloat] = 1,
+    [l_inst_CastBool]  = 1,
+
+    [l_inst_Rotation] = 3,
+    [l_inst_Stretch]  = 3,
+    [l_inst_Position] = 3,
+    [l_inst_Scale]    = 1,
+
+    [l_inst_Sin]   = 1,
+    [l_inst_Cos]   = 1,
+    [l_inst_Sqrt]  = 1,
+    [l_inst_Pow]   = 2,
+    [l_inst_Min]   = 2,
+    [l_inst_Max]   = 2,
+    [l_inst_Lerp]  = 3,
+    [l_inst_Clamp] = 3,
+
+    [l_inst_Noop]     = 1,
+
+    [l_inst_AddI] = 2,
+    [l_inst_AddF] = 2,
+    [l_inst_SubI] = 2,
+    [l_inst_SubF] = 2,
+    [l_inst_MulI] = 2,
+    [l_inst_MulF] = 2,
+    [l_inst_MulM] = 2,
+    [l_inst_DivI] = 2,
+    [l_inst_DivF] = 2,
+    [l_inst_ModI] = 2,
+    [l_inst_NegI] = 1,
+    [l_inst_NegF] = 1,
+
+    [l_inst_LessI]     = 2,
+    [l_inst_LessF]     = 2,
+    [l_inst_MoreI]     = 2,
+    [l_inst_MoreF]     = 2,
+    [l_inst_LessEqI]   = 2,
+    [l_inst_LessEqF]   = 2,
+    [l_inst_MoreEqI]   = 2,
+    [l_inst_MoreEqF]   = 2,
+    [l_inst_EqualI]    = 2,
+    [l_inst_EqualF]    = 2,
+    [l_inst_NotEqualI] = 2,
+    [l_inst_NotEqualF] = 2,
+
+    [l_inst_IntToFloat]      = 1,
+    [l_inst_IntToFloatBelow] = 1,
+    [l_inst_FloatToInt]      = 1,
+    [l_inst_BoolToInt]       = 1,
+    [l_inst_BoolToFloat]     = 1,
+    [l_inst_IntToBool]       = 1,
+    [l_inst_FloatToBool]     = 1,
+
+    [l_inst_Matrix] = 0,
+    [l_inst_Store]  = 1,
+    [l_inst_Load]   = 0,
+
+    [l_inst_AndJump]   = 1,
+    [l_inst_OrJump]    = 1,
+    [l_inst_JumpIfNot] = 1,
+    [l_inst_Jump]      = 1,
+
+    [l_inst_Return] = 1,
+
+    [l_inst_Random] = 0,
+};
+static_assert(length(inst_eats) == L_INST_COUNT, "array length missmatch");
+
+static inline bool is_jump(l_inst_id_t id)
+{
+    return id >= l_inst_AndJump && id <= l_inst_Jump;
+}
+
+// NOTE: Runs one of the math builtins, the ones taking fewer arguments
+//       ignore `b` and `c`.
+static inline float l_math(l_inst_id_t id, bool exact, float a, float b, float c)
+{
+    switch (id) {
+        case l_inst_Sin:   return exact ? sinf(a)    : l_sin(a);
+        case l_inst_Cos:   return exact ? cosf(a)    : l_cos(a);
+        case l_inst_Sqrt:  return l_sqrt(a);
+        case l_inst_Pow:   return exact ? powf(a, b) : l_pow(a, b);
+        case l_inst_Min:   return l_min(a, b);
+        case l_inst_Max:   return l_max(a, b);
+        case l_inst_Lerp:  return l_lerp(a, b, c);
+        case l_inst_Clamp: return l_clamp(a, b, c);
+
+        default: unreachable();
+    }
+}
+
+unsigned l_code_depth(l_instruction_t *code, unsigned count)
+{
+    unsigned size = 0;
+    unsigned depth = 0;
+
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned eats = inst_eats[code[i].id];
+
+        assert(size >= eats);
+        size = size - eats + !is_jump(code[i].id);
+
+        if (size > depth) {
+            depth = size;
+        }
+    }
+
+    return depth;
+}
+
+
+// NOTE: Only integer division and modulo fail, unless the divisor is a nonzero
+//       constant. The constant right before them is only the end of a branch
+//       when a jump lands on them.
+static bool can_fail(l_instruction_t *code, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        if (code[i].id != l_inst_DivI && code[i].id != l_inst_ModI)
+            continue;
+
+        bool constant = i > 0 && code[i - 1].id == l_inst_Value && code[i - 1].op.data.integer != 0;
+
+        for (unsigned j = 0; j < i && constant; ++j) {
+            constant = !is_jump(code[j].id) || j + (unsigned)code[j].op.data.integer != i;
+        }
+
+        if (!constant)
+            return true;
+    }
+
+    return false;
+}
+
+// NOTE: A matrix can only come from a constant, a parameter or one of the
+//       matrix instructions and nothing turns it back into a scalar, so
+//       a scalar result with none of those is matrix free. The lanes run
+//       both sides of every branch, which is only the same when neither fails.
+bool l_code_is_scalar(l_instruction_t *code, unsigned count, l_basic_t type)
+{
+    if (type == l_basic_Mat4)
+        return false;
+
+    bool branches = false;
+
+    for (unsigned i = 0; i < count; ++i) {
+        switch (code[i].id) {
+            case l_inst_Value: {
+                if (code[i].op.type == l_basic_Mat4)
+                    return false;
+            } break;
+
+            case l_inst_Matrix:
+            case l_inst_MulM:
+            case l_inst_Rotation:
+            case l_inst_Stretch:
+            case l_inst_Position:
+            case l_inst_Scale:
+                return false;
+
+            // NOTE: The lanes do not know which symbol they run for.
+            case l_inst_Random:
+                return false;
+
+            case l_inst_AndJump:
+            case l_inst_OrJump:
+            case l_inst_JumpIfNot: {
+                branches = true;
+            } break;
+
+            default: break;
+        }
+    }
+
+    return !branches || !can_fail(code, count);
+}
+
+
+#define MAX_REGISTERS 256
+
+// NOTE: Translates the typed stack code of `expr`. Every stack slot becomes
+//       the register with the same index, loads of parameters and constants
+//       disappear and become operands of the instructions using them.
+//       The value of `&&` and `||` ends up in the register of its slot both
+//       when the jump is taken and when the right side runs, `Noop` moves
+//       it there when the right side is a parameter or a constant. Code with
+//       `select` is left to the stack machine.
+void l_compile_registers(l_system_t *sys, l_expr_t *expr, l_basic_t type)
+{
+    uint16_t operands[MAX_REGISTERS];
+    unsigned size = 0;
+
+    struct { unsigned target, jump; } joins[MAX_REGISTERS];
+    unsigned join_count = 0;
+
+    unsigned reg_index   = sys->reg_code.count;
+    unsigned const_index = sys->reg_consts.count;
+
+    if (expr->depth > MAX_REGISTERS)
+        goto fail;
+
+    for (unsigned i = 0; i <= expr->count; ++i) {
+        while (join_count > 0 && joins[join_count - 1].target == i) {
+            unsigned jump = joins[--join_count].jump;
+            uint16_t reg = L_OPERAND(l_operand_Register, size - 1);
+
+            if (operands[size - 1] != reg) {
+                l_reg_inst_t move = {
+                    .op  = l_inst_Noop,
+                    .dst = (uint8_t)(size - 1),
+                    .a   = operands[size - 1],
+                };
+
+                dck_stretchy_push(sys->reg_code, move);
+                operands[size - 1] = reg;
+            }
+
+            if (sys->reg_code.count - jump > UINT16_MAX)
+                goto fail;
+
+            sys->reg_code.data[jump].b = (uint16_t)(sys->reg_code.count - jump);
+        }
+
+        if (i == expr->count)
+            break;
+
+        l_instruction_t *inst = sys->instructions.data + expr->index + i;
+
+        switch (inst->id) {
+            case l_inst_AndJump:
+            case l_inst_OrJump: {
+                if (join_count == MAX_REGISTERS)
+                    goto fail;
+
+                --size;
+
+                l_reg_inst_t reg = {
+                    .op  = (uint8_t)inst->id,
+                    .dst = (uint8_t)size,
+                    .a   = operands[size],
+                };
+
+                joins[join_count++].target = i + (unsigned)inst->op.data.integer;
+                joins[join_count - 1].jump = sys->reg_code.count;
+
+                dck_stretchy_push(sys->reg_code, reg);
+            } break;
+
+            case l_inst_JumpIfNot:
+            case l_inst_Jump:
+            case l_inst_Select:
+            case l_inst_Random:
+                goto fail;
+
+            case l_inst_Value: {
+                unsigned k = sys->reg_consts.count - const_index;
+
+                if (k > L_OPERAND_MASK)
+                    goto fail;
+
+                dck_stretchy_push(sys->reg_consts, inst->op);
+                operands[size++] = L_OPERAND(l_operand_Const, k);
+            } break;
+
+            case l_inst_Param: {
+                unsigned p = (unsigned)inst->op.data.integer;
+
+                if (p > L_OPERAND_MASK)
+                    goto fail;
+
+                operands[size++] = L_OPERAND(l_operand_Param, p);
+            } break;
+
+            case l_inst_Noop: break;
+
+            case l_inst_Matrix: {
+                if (inst->op.data.matrix > UINT16_MAX)
+                    goto fail;
+
+                l_reg_inst_t reg = {
+                    .op  = l_inst_Matrix,
+                    .dst = (uint8_t)size,
+                    .a   = (uint16_t)inst->op.data.matrix,
+                };
+
+                dck_stretchy_push(sys->reg_code, reg);
+                operands[size] = L_OPERAND(l_operand_Register, size);
+                ++size;
+            } break;
+
+            case l_inst_IntToFloatBelow: {
+                l_reg_inst_t reg = {
+                    .op = l_inst_IntToFloat,
+                    .dst = (uint8_t)(size - 2),
+                    .a = operands[size - 2],
+                };
+
+                dck_stretchy_push(sys->reg_code, reg);
+                operands[size - 2] = L_OPERAND(l_operand_Register, size - 2);
+            } break;
+
+            default: {
+                unsigned eats = inst_eats[inst->id];
+
+                assert(size >= eats);
+                size -= eats;
+
+                l_reg_inst_t reg = {
+                    .op  = (uint8_t)inst->id,
+                    .dst = (uint8_t)size,
+                    .a = eats > 0 ? operands[size + 0] : 0,
+                    .b = eats > 1 ? operands[size + 1] : 0,
+                    .c = eats > 2 ? operands[size + 2] : 0,
+                };
+
+                dck_stretchy_push(sys->reg_code, reg);
+                operands[size] = L_OPERAND(l_operand_Register, size);
+                ++size;
+            } break;
+        }
+    }
+
+    assert(size == 1);
+
+    l_reg_inst_t ret = {
+        .op = l_inst_Return,
+        .a = operands[0],
+        .b = (uint16_t)type,
+    };
+
+    dck_stretchy_push(sys->reg_code, ret);
+
+    expr->reg_index   = reg_index;
+    expr->const_index = const_index;
+    return;
+
+fail:
+    sys->reg_code.count   = reg_index;
+    sys->reg_consts.count = const_index;
+
+    expr->reg_index = L_NO_REG_CODE;
+}
+
+
+/* optimizer
+ *
+ * Every stack slot remembers where its code starts. Once all the operands
+ * of an instruction are constant, the code of the slots is run by the stack
+ * machine and replaced by the single constant it produced, so the folded
+ * values are exactly the ones the evaluation would compute. Operations with
+ * a neutral constant operand lose the operand, double negations cancel out
+ * and `Noop`s are dropped. A constant left side of `&&` and `||` that decides
+ * the result drops the right side and a constant condition of `select` keeps
+ * only the branch it picks.
+ */
+
+#define MAX_OPTIMIZER_DEPTH 256
+
+typedef struct
+{
+    unsigned start;
+
+    // NOTE: The code of a constant slot is a single `Value` or `Matrix`.
+    bool constant;
+} l_opt_slot_t;
+
+// NOTE: Only the identities that give back the very same bits, `x + 0.0`
+//       turns `-0.0` into `0.0` so it stays.
+static bool is_neutral(l_inst_id_t id, l_value_t value, bool right)
+{
+    switch (id) {
+        case l_inst_AddI: return value.data.integer == 0;
+        case l_inst_SubI: return right && value.data.integer == 0;
+        case l_inst_MulI: return value.data.integer == 1;
+        case l_inst_DivI: return right && value.data.integer == 1;
+
+        case l_inst_AddF: return value.data.floating == 0.0f && signbit(value.data.floating);
+        case l_inst_SubF: return right && value.data.floating == 0.0f && !signbit(value.data.floating);
+        case l_inst_MulF: return value.data.floating == 1.0f;
+        case l_inst_DivF: return right && value.data.floating == 1.0f;
+
+        case l_inst_And: return value.data.boolean;
+        case l_inst_Or:  return !value.data.boolean;
+
+        default: return false;
+    }
+}
+
+static bool is_absorbing(l_inst_id_t id, l_value_t value)
+{
+    return (id == l_inst_And && !value.data.boolean) || (id == l_inst_Or && value.data.boolean);
+}
+
+unsigned l_optimize_code(l_system_t *sys, unsigned index, unsigned count)
+{
+    l_opt_slot_t slots[MAX_OPTIMIZER_DEPTH];
+    unsigned size = 0;
+
+    l_instruction_t *code = sys->instructions.data + index;
+
+    if (l_code_depth(code, count) > MAX_OPTIMIZER_DEPTH)
+        return count;
+
+    unsigned w = 0;
+
+    for (unsigned r = 0; r < count; ++r) {
+        l_instruction_t inst = code[r];
+
+        switch (inst.id) {
+            case l_inst_Noop: continue;
+
+            case l_inst_Value:
+            case l_inst_Matrix:
+            case l_inst_Param: {
+                slots[size++] = (l_opt_slot_t) {
+                    .start = w,
+                    .constant = inst.id != l_inst_Param,
+                };
+
+                code[w++] = inst;
+            } continue;
+
+            // NOTE: The conversion moves right behind the code of the slot it
+            //       converts, so the code of every slot stays contiguous.
+            case l_inst_IntToFloatBelow: {
+                l_opt_slot_t below = slots[size - 2];
+                l_opt_slot_t *top = slots + size - 1;
+
+                if (below.constant) {
+                    l_value_t *op = &code[below.start].op;
+                    op->data.floating = (float)op->data.integer;
+                    op->type = l_basic_Float;
+                    continue;
+                }
+
+                memmove(code + top->start + 1, code + top->start,
+                        sizeof(l_instruction_t) * (w - top->start));
+
+                code[top->start] = (l_instruction_t) { .id = l_inst_IntToFloat };
+                top->start++;
+                w++;
+            } continue;
+
+            case l_inst_NegI:
+            case l_inst_NegF:
+            case l_inst_Not: {
+                l_opt_slot_t top = slots[size - 1];
+
+                if (top.constant || w - 1 == top.start || code[w - 1].id != inst.id)
+                    break;
+
+                --w;
+            } continue;
+
+            case l_inst_Select: {
+                l_opt_slot_t cond = slots[size - 3];
+
+                if (!cond.constant)
+                    break;
+
+                bool first = code[cond.start].op.data.boolean;
+                l_opt_slot_t branch = slots[size - (first ? 2 : 1)];
+                unsigned end = first ? slots[size - 1].start : w;
+
+                memmove(code + cond.start, code + branch.start,
+                        sizeof(l_instruction_t) * (end - branch.start));
+
+                w = cond.start + end - branch.start;
+                size -= 3;
+
+                slots[size++] = (l_opt_slot_t) { .start = cond.start, .constant = branch.constant };
+            } continue;
+
+            default: break;
+        }
+
+        unsigned eats = inst_eats[inst.id];
+        assert(size >= eats);
+
+        if (eats == 2 && (slots[size - 2].constant != slots[size - 1].constant)) {
+            l_opt_slot_t a = slots[size - 2];
+            l_opt_slot_t b = slots[size - 1];
+
+            if (b.constant && is_neutral(inst.id, code[b.start].op, true)) {
+                w = b.start;
+                --size;
+                continue;
+            }
+
+            if (a.constant && is_absorbing(inst.id, code[a.start].op)) {
+                w = b.start;
+                --size;
+                continue;
+            }
+
+            if (a.constant && is_neutral(inst.id, code[a.start].op, false)) {
+                memmove(code + a.start, code + b.start, sizeof(l_instruction_t) * (w - b.start));
+                w -= b.start - a.start;
+                slots[--size - 1] = (l_opt_slot_t) { .start = a.start };
+                continue;
+            }
+        }
+
+        bool constant = eats > 0;
+
+        for (unsigned i = 0; i < eats; ++i) {
+            constant = constant && slots[size - 1 - i].constant;
+        }
+
+        size -= eats;
+        unsigned start = eats > 0 ? slots[size].start : w;
+
+        code[w++] = inst;
+
+        if (constant) {
+            l_expr_t folded = {
+                .index = index + start,
+                .count = w - start,
+                .depth = l_code_depth(code + start, w - start),
+                .reg_index = L_NO_REG_CODE,
+                .native_index = L_NO_NATIVE_CODE,
+            };
+
+            l_eval_res_t res = l_evaluate_params(sys, &sys->eval_stack, folded, NULL, 0);
+
+            // NOTE: Errors are left for the evaluation to report.
+            if (res.error) {
+                constant = false;
+            }
+            else if (res.val.type == l_basic_Mat4) {
+                code[start] = (l_instruction_t) {
+                    .id = l_inst_Matrix,
+                    .op = { .type = l_basic_Mat4, .data.matrix = sys->const_matrices.count },
+                };
+
+                dck_stretchy_push(sys->const_matrices, sys->eval_stack.matrices.data[0]);
+                w = start + 1;
+            }
+            else {
+                code[start] = (l_instruction_t) { .id = l_inst_Value, .op = res.val };
+                w = start + 1;
+            }
+        }
+
+        slots[size++] = (l_opt_slot_t) { .start = start, .constant = constant };
+    }
+
+    assert(size == 1);
+
+    return w;
+}
+
+
+/* branches
+ *
+ * `&&`, `||` and `select` are parsed and optimized as instructions taking
+ * all of their operands and lowered to jumps afterwards, so the right side of
+ * a logical operator runs only when it decides the result and `select` runs
+ * only the branch it picks:
+ *
+ *     a b And        ->  a AndJump(1 + |b|) b
+ *     c x y Select   ->  c JumpIfNot(2 + |x|) x Jump(1 + |y|) y
+ *
+ * The passes that look at the code as a tree walk it with `walk_next`, which
+ * puts the joins back as the instructions they came from.
+ */
+
+unsigned l_lower_branches(l_system_t *sys, unsigned index, unsigned count)
+{
+    assert(index + count == sys->instructions.count);
+
+    unsigned selects = 0;
+    bool branches = false;
+
+    for (unsigned i = 0; i < count; ++i) {
+        l_inst_id_t id = sys->instructions.data[index + i].id;
+
+        selects  += id == l_inst_Select;
+        branches |= id == l_inst_Select || id == l_inst_And || id == l_inst_Or;
+    }
+
+    if (!branches)
+        return count;
+
+    l_instruction_t *code = malloc(sizeof(l_instruction_t) * count);
+    malloc_check(code);
+    memcpy(code, sys->instructions.data + index, sizeof(l_instruction_t) * count);
+
+    unsigned *starts = malloc(sizeof(unsigned) * l_code_depth(code, count));
+    malloc_check(starts);
+    unsigned size = 0;
+
+    dck_stretchy_reserve(sys->instructions, selects);
+    l_instruction_t *out = sys->instructions.data + index;
+
+    unsigned w = 0;
+
+    for (unsigned r = 0; r < count; ++r) {
+        l_instruction_t inst = code[r];
+
+        switch (inst.id) {
+            // NOTE: The conversion moves right behind the code of the slot it
+            //       converts, a jump may land in between.
+            case l_inst_IntToFloatBelow: {
+                unsigned top = starts[size - 1];
+
+                memmove(out + top + 1, out + top, sizeof(l_instruction_t) * (w - top));
+                out[top] = (l_instruction_t) { .id = l_inst_IntToFloat };
+
+                starts[size - 1]++;
+                w++;
+            } continue;
+
+            case l_inst_And:
+            case l_inst_Or: {
+                unsigned b = starts[--size];
+
+                memmove(out + b + 1, out + b, sizeof(l_instruction_t) * (w - b));
+                out[b] = (l_instruction_t) {
+                    .id = inst.id == l_inst_And ? l_inst_AndJump : l_inst_OrJump,
+                    .op = { .type = l_basic_Int, .data.integer = (int)(w + 1 - b) },
+                };
+
+                w++;
+            } continue;
+
+            case l_inst_Select: {
+                unsigned y = starts[--size];
+                unsigned x = starts[--size];
+
+                memmove(out + y + 2, out + y, sizeof(l_instruction_t) * (w - y));
+                memmove(out + x + 1, out + x, sizeof(l_instruction_t) * (y - x));
+
+                out[x] = (l_instruction_t) {
+                    .id = l_inst_JumpIfNot,
+                    .op = { .type = l_basic_Int, .data.integer = (int)(y + 2 - x) },
+                };
+
+                out[y + 1] = (l_instruction_t) {
+                    .id = l_inst_Jump,
+                    .op = { .type = l_basic_Int, .data.integer = (int)(w + 1 - y) },
+                };
+
+                w += 2;
+            } continue;
+
+            default: {
+                unsigned eats = inst_eats[inst.id];
+
+                assert(size >= eats);
+                size -= eats;
+
+                starts[size] = eats > 0 ? starts[size] : w;
+                size++;
+
+                out[w++] = inst;
+            } continue;
+        }
+    }
+
+    assert(size == 1);
+
+    free(starts);
+    free(code);
+
+    return w;
+}
+
+l_expr_t l_compile_code(l_system_t *sys, unsigned index, l_basic_t type)
+{
+    unsigned parsed_count = sys->instructions.count - index;
+    unsigned count = l_optimize_code(sys, index, parsed_count);
+
+    sys->instructions.count = index + count;
+
+    unsigned saved = parsed_count - count;
+
+    count = l_lower_branches(sys, index, count);
+    sys->instructions.count = index + count;
+
+    l_expr_t expr = {
+        .index = index,
+        .count = count,
+        .depth = l_code_depth(sys->instructions.data + index, count),
+        .native_index = L_NO_NATIVE_CODE,
+        .scalar = l_code_is_scalar(sys->instructions.data + index, count, type),
+        .saved = saved,
+    };
+
+    l_compile_registers(sys, &expr, type);
+
+    return expr;
+}
+
+typedef struct
+{
+    l_instruction_t *code;
+    unsigned count, at;
+
+    dck_stretchy_t (l_join_t, unsigned) joins;
+} l_walk_t;
+
+// NOTE: Hands out the instructions of lowered code as if it was never
+//       lowered, `end` is where the code of the value ends and `lazy` tells
+//       whether it might not run. Returns false at the end of the code.
+static bool walk_next(l_walk_t *walk, l_instruction_t *inst, unsigned *end, bool *lazy)
+{
+    for (;;) {
+        unsigned top = walk->joins.count - 1;
+
+        if (walk->joins.count > 0 && walk->joins.data[top].target == walk->at) {
+            *inst = (l_instruction_t) { .id = walk->joins.data[top].id };
+            *end = walk->at;
+
+            walk->joins.count--;
+            *lazy = walk->joins.count > 0;
+            return true;
+        }
+
+        if (walk->at == walk->count)
+            return false;
+
+        l_instruction_t next = walk->code[walk->at];
+        unsigned target = walk->at + (unsigned)next.op.data.integer;
+
+        walk->at++;
+
+        switch (next.id) {
+            case l_inst_AndJump:
+            case l_inst_OrJump:
+            case l_inst_JumpIfNot: {
+                l_join_t join = {
+                    .id = next.id == l_inst_AndJump ? l_inst_And
+                        : next.id == l_inst_OrJump  ? l_inst_Or
+                                                    : l_inst_Select,
+                    .target = target,
+                };
+
+                dck_stretchy_push(walk->joins, join);
+            } break;
+
+            // NOTE: Past the first branch the `select` joins at the end of the second.
+            case l_inst_Jump: {
+                assert(walk->joins.data[top].id == l_inst_Select);
+                walk->joins.data[top].target = target;
+            } break;
+
+            default: {
+                *inst = next;
+                *end = walk->at;
+                *lazy = walk->joins.count > 0;
+            } return true;
+        }
+    }
+}
+
+
+/* rule bodies
+ *
+ * The parameter code of a rule is turned into a graph in which equal
+ * instructions with equal operands are one node. Nodes used more than once
+ * that are worth it get a temporary, the first use stores the value and the
+ * others load it, so a shared subterm is computed once per matched symbol.
+ */
+
+#define L_NO_NODE ((unsigned)-1)
+
+typedef struct
+{
+    l_instruction_t inst;
+    unsigned operands[3];
+
+    unsigned uses, size;
+
+    unsigned temp;
+    bool stored;
+
+    /* first seen where it might not run, it can't be stored there */
+    bool lazy;
+} l_node_t;
+
+typedef dck_stretchy_t (l_node_t, unsigned) l_nodes_t;
+
+static bool produces_matrix(l_inst_id_t id)
+{
+    switch (id) {
+        case l_inst_MulM:
+        case l_inst_Rotation:
+        case l_inst_Stretch:
+        case l_inst_Position:
+        case l_inst_Scale:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// NOTE: Floats compare by their bits, so `0.0` and `-0.0` stay apart.
+static bool same_value(l_value_t a, l_value_t b)
+{
+    if (a.type != b.type)
+        return false;
+
+    switch (a.type) {
+        case l_basic_Int:   return a.data.integer == b.data.integer;
+        case l_basic_Float: return memcmp(&a.data.floating, &b.data.floating, sizeof(float)) == 0;
+        case l_basic_Bool:  return a.data.boolean == b.data.boolean;
+        case l_basic_Mat4:  return a.data.matrix == b.data.matrix;
+
+        case L_BASIC_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+static unsigned intern_node(l_nodes_t *nodes, l_instruction_t inst, unsigned *operands, bool lazy)
+{
+    unsigned eats = inst_eats[inst.id];
+
+    for (unsigned i = 0; i < nodes->count; ++i) {
+        l_node_t *node = nodes->data + i;
+
+        if (node->inst.id != inst.id || !same_value(node->inst.op, inst.op))
+            continue;
+
+        bool same = true;
+        for (unsigned k = 0; k < eats; ++k) {
+            same = same && node->operands[k] == operands[k];
+        }
+
+        if (same)
+            return i;
+    }
+
+    l_node_t node = {
+        .inst = inst,
+        .operands = { L_NO_NODE, L_NO_NODE, L_NO_NODE },
+        .size = 1,
+        .temp = L_NO_NODE,
+        .lazy = lazy,
+    };
+
+    for (unsigned k = 0; k < eats; ++k) {
+        node.operands[k] = operands[k];
+        node.size += nodes->data[operands[k]].size;
+        nodes->data[operands[k]].uses++;
+    }
+
+    dck_stretchy_push(*nodes, node);
+    return nodes->count - 1;
+}
+
+static void emit_node(l_system_t *sys, l_nodes_t *nodes, unsigned index)
+{
+    l_node_t *node = nodes->data + index;
+
+    if (node->stored) {
+        l_instruction_t load = {
+            .id = l_inst_Load,
+            .op = { .type = l_basic_Int, .data.integer = (int)node->temp },
+        };
+
+        dck_stretchy_push(sys->instructions, load);
+        return;
+    }
+
+    // NOTE: Branches come out lowered, see `l_lower_branches`.
+    switch (node->inst.id) {
+        case l_inst_And:
+        case l_inst_Or: {
+            emit_node(sys, nodes, node->operands[0]);
+
+            unsigned jump = sys->instructions.count;
+            l_instruction_t inst = {
+                .id = node->inst.id == l_inst_And ? l_inst_AndJump : l_inst_OrJump,
+                .op.type = l_basic_Int,
+            };
+
+            dck_stretchy_push(sys->instructions, inst);
+            emit_node(sys, nodes, node->operands[1]);
+
+            sys->instructions.data[jump].op.data.integer = (int)(sys->instructions.count - jump);
+        } break;
+
+        case l_inst_Select: {
+            emit_node(sys, nodes, node->operands[0]);
+
+            unsigned jump_not = sys->instructions.count;
+            l_instruction_t inst = { .id = l_inst_JumpIfNot, .op.type = l_basic_Int };
+
+            dck_stretchy_push(sys->instructions, inst);
+            emit_node(sys, nodes, node->operands[1]);
+
+            unsigned jump = sys->instructions.count;
+            inst.id = l_inst_Jump;
+
+            dck_stretchy_push(sys->instructions, inst);
+            emit_node(sys, nodes, node->operands[2]);
+
+            sys->instructions.data[jump_not].op.data.integer = (int)(jump + 1 - jump_not);
+            sys->instructions.data[jump].op.data.integer = (int)(sys->instructions.count - jump);
+        } break;
+
+        default: {
+            for (unsigned k = 0; k < 3 && node->operands[k] != L_NO_NODE; ++k) {
+                emit_node(sys, nodes, node->operands[k]);
+            }
+
+            dck_stretchy_push(sys->instructions, nodes->data[index].inst);
+        } break;
+    }
+
+    node = nodes->data + index;
+
+    if (node->temp != L_NO_NODE) {
+        l_instruction_t store = {
+            .id = l_inst_Store,
+            .op = { .type = l_basic_Int, .data.integer = (int)node->temp },
+        };
+
+        dck_stretchy_push(sys->instructions, store);
+        node->stored = true;
+    }
+}
+
+void l_compile_rule(l_system_t *sys, l_rule_t *rule)
+{
+    rule->body = (l_expr_t) {0};
+    rule->temp_count = 0;
+
+    l_nodes_t nodes = {0};
+    dck_stretchy_t (unsigned, unsigned) roots = {0};
+    dck_stretchy_t (unsigned, unsigned) stack = {0};
+    l_walk_t walk = {0};
+
+    for (unsigned ri = 0; ri < rule->right_size; ++ri) {
+        l_result_t result = sys->results.data[rule->right_index + ri];
+        unsigned params_count = sys->types.data[result.type].params_count;
+
+        for (unsigned pi = 0; pi < params_count; ++pi) {
+            l_expr_t expr = sys->params.data[result.params_index + pi];
+
+            // NOTE: Walked as a tree the code can hold more than its depth.
+            stack.count = 0;
+            dck_stretchy_reserve(stack, expr.count);
+
+            walk.code  = sys->instructions.data + expr.index;
+            walk.count = expr.count;
+            walk.at    = 0;
+
+            l_instruction_t inst;
+            unsigned end;
+            bool lazy;
+
+            while (walk_next(&walk, &inst, &end, &lazy)) {
+                switch (inst.id) {
+                    case l_inst_Noop: break;
+
+                    case l_inst_IntToFloatBelow: {
+                        l_instruction_t cast = { .id = l_inst_IntToFloat };
+                        unsigned *below = stack.data + stack.count - 2;
+                        *below = intern_node(&nodes, cast, below, lazy);
+                    } break;
+
+                    default: {
+                        stack.count -= inst_eats[inst.id];
+                        stack.data[stack.count] = intern_node(&nodes, inst, stack.data + stack.count, lazy);
+                        stack.count++;
+                    } break;
+                }
+            }
+
+            assert(stack.count == 1);
+
+            nodes.data[stack.data[0]].uses++;
+            dck_stretchy_push(roots, stack.data[0]);
+        }
+    }
+
+    // NOTE: A temporary costs a store and the loads, for a short scalar
+    //       subterm that is as much as computing it again.
+    for (unsigned i = 0; i < nodes.count; ++i) {
+        l_node_t *node = nodes.data + i;
+
+        if (node->uses < 2 || inst_eats[node->inst.id] == 0 || node->lazy)
+            continue;
+
+        if (node->size >= 3 || produces_matrix(node->inst.id)) {
+            node->temp = rule->temp_count++;
+        }
+    }
+
+    if (rule->temp_count > 0) {
+        unsigned index = sys->instructions.count;
+
+        for (unsigned i = 0; i < roots.count; ++i) {
+            emit_node(sys, &nodes, roots.data[i]);
+        }
+
+        unsigned count = sys->instructions.count - index;
+
+        rule->body = (l_expr_t) {
+            .index = index,
+            .count = count,
+            .depth = l_code_depth(sys->instructions.data + index, count),
+            .reg_index = L_NO_REG_CODE,
+            .native_index = L_NO_NATIVE_CODE,
+        };
+    }
+
+    free(nodes.data);
+    free(roots.data);
+    free(stack.data);
+    free(walk.joins.data);
+}
+
+
+/* decision tables
+ *
+ * The predicates of the rules of one type are split into atoms, the boolean
+ * leaves joined by `&&`, `||` and `!`. Equal atoms are shared and integer
+ * `<=`, `>=` and `!=` are taken as negated `>`, `<` and `==`. With few enough
+ * atoms all the combinations of their values are run through the predicates
+ * up front, so the atoms of a symbol index straight into the bit mask of the
+ * rules it matches. Atoms that can fail are left to the predicates.
+ */
+
+#define L_MAX_DECISION_ATOMS 6
+#define L_MAX_DECISION_RULES 32
+#define MAX_DECISION_CODE    128
+
+typedef enum
+{
+    l_bool_Leaf,
+    l_bool_Const,
+    l_bool_And,
+    l_bool_Or,
+    l_bool_Not,
+} l_bool_kind_t;
+
+typedef struct
+{
+    l_bool_kind_t kind;
+
+    /* code of a leaf, the first instruction of the others */
+    unsigned start, end;
+
+    unsigned a, b;
+    bool value;
+} l_bool_node_t;
+
+typedef struct
+{
+    l_bool_kind_t kind;
+
+    /* atom of a leaf or the value of a constant */
+    unsigned atom;
+    bool negated;
+} l_bool_op_t;
+
+typedef struct
+{
+    unsigned index, count;
+    l_inst_id_t last;
+} l_atom_t;
+
+static l_inst_id_t complement(l_inst_id_t id)
+{
+    switch (id) {
+        case l_inst_LessEqI:   return l_inst_MoreI;
+        case l_inst_MoreEqI:   return l_inst_LessI;
+        case l_inst_NotEqualI: return l_inst_EqualI;
+        case l_inst_NotEqualF: return l_inst_EqualF;
+
+        default: return id;
+    }
+}
+
+static bool add_atom(l_system_t *sys, l_atom_t *atoms, unsigned *atom_count,
+                     unsigned start, unsigned end, l_bool_op_t *op)
+{
+    l_instruction_t *code = sys->instructions.data;
+
+    if (can_fail(code + start, end - start))
+        return false;
+
+    l_inst_id_t last = code[end - 1].id;
+
+    // NOTE: When a `select` ends the leaf its last instruction only ends
+    //       one of the branches.
+    bool branch = false;
+    for (unsigned i = start; i < end; ++i) {
+        branch = branch || (is_jump(code[i].id) && i + (unsigned)code[i].op.data.integer == end);
+    }
+
+    l_atom_t atom = {
+        .index = start,
+        .count = end - start,
+        .last  = branch ? last : complement(last),
+    };
+
+    // NOTE: The atom runs the code of its first leaf, other leaves negate
+    //       its value when exactly one of the two got complemented.
+    bool complemented = atom.last != last;
+
+    for (unsigned i = 0; i < *atom_count; ++i) {
+        l_atom_t other = atoms[i];
+
+        if (other.count != atom.count || other.last != atom.last)
+            continue;
+
+        // NOTE: The last instructions already compare by their complements.
+        bool same = true;
+        for (unsigned k = 0; k < atom.count && same; ++k) {
+            l_instruction_t x = code[atom.index + k];
+            l_instruction_t y = code[other.index + k];
+
+            same = (k + 1 == atom.count || x.id == y.id) && same_value(x.op, y.op);
+        }
+
+        if (same) {
+            l_inst_id_t other_last = code[other.index + other.count - 1].id;
+
+            *op = (l_bool_op_t) {
+                .kind = l_bool_Leaf,
+                .atom = i,
+                .negated = complemented != (other.last != other_last),
+            };
+            return true;
+        }
+    }
+
+    if (*atom_count == L_MAX_DECISION_ATOMS)
+        return false;
+
+    *op = (l_bool_op_t) { .kind = l_bool_Leaf, .atom = *atom_count };
+    atoms[(*atom_count)++] = atom;
+
+    return true;
+}
+
+static bool emit_bool(l_system_t *sys, l_bool_node_t *nodes, unsigned index,
+                      l_atom_t *atoms, unsigned *atom_count,
+                      l_bool_op_t *ops, unsigned *op_count)
+{
+    l_bool_node_t node = nodes[index];
+
+    switch (node.kind) {
+        case l_bool_Leaf: {
+            return add_atom(sys, atoms, atom_count, node.start, node.end, ops + (*op_count)++);
+        }
+
+        case l_bool_Const: {
+            ops[(*op_count)++] = (l_bool_op_t) { .kind = l_bool_Const, .negated = !node.value };
+        } return true;
+
+        case l_bool_And:
+        case l_bool_Or: {
+            if (!emit_bool(sys, nodes, node.a, atoms, atom_count, ops, op_count)
+             || !emit_bool(sys, nodes, node.b, atoms, atom_count, ops, op_count))
+                return false;
+        } break;
+
+        case l_bool_Not: {
+            if (!emit_bool(sys, nodes, node.a, atoms, atom_count, ops, op_count))
+                return false;
+        } break;
+    }
+
+    ops[(*op_count)++] = (l_bool_op_t) { .kind = node.kind };
+    return true;
+}
+
+// NOTE: Splits the predicate into its boolean structure over the atoms,
+//       `ops` gets it in postfix. A `select` ends up inside a leaf.
+static bool split_predicate(l_system_t *sys, l_expr_t expr,
+                            l_atom_t *atoms, unsigned *atom_count,
+                            l_bool_op_t *ops, unsigned *op_count)
+{
+    l_bool_node_t nodes[MAX_DECISION_CODE];
+    unsigned stack[MAX_DECISION_CODE];
+    unsigned node_count = 0, size = 0;
+
+    if (expr.count > MAX_DECISION_CODE)
+        return false;
+
+    l_walk_t walk = {
+        .code  = sys->instructions.data + expr.index,
+        .count = expr.count,
+    };
+
+    l_instruction_t inst;
+    unsigned end;
+    bool lazy;
+
+    while (walk_next(&walk, &inst, &end, &lazy)) {
+        l_bool_node_t node = {0};
+
+        switch (inst.id) {
+            case l_inst_And:
+            case l_inst_Or: {
+                size -= 2;
+                node = (l_bool_node_t) {
+                    .kind = inst.id == l_inst_And ? l_bool_And : l_bool_Or,
+                    .start = nodes[stack[size]].start,
+                    .a = stack[size],
+                    .b = stack[size + 1],
+                };
+            } break;
+
+            case l_inst_Not: {
+                --size;
+                node = (l_bool_node_t) {
+                    .kind = l_bool_Not,
+                    .start = nodes[stack[size]].start,
+                    .a = stack[size],
+                };
+            } break;
+
+            case l_inst_Value: {
+                if (inst.op.type == l_basic_Bool) {
+                    node = (l_bool_node_t) {
+                        .kind = l_bool_Const,
+                        .start = expr.index + end - 1,
+                        .value = inst.op.data.boolean,
+                    };
+                    break;
+                }
+            } // fallthrough
+
+            default: {
+                // NOTE: The conversion belongs to the numeric operand below,
+                //       which ends up inside a leaf either way.
+                if (inst.id == l_inst_IntToFloatBelow)
+                    continue;
+
+                unsigned eats = inst_eats[inst.id];
+                size -= eats;
+
+                node = (l_bool_node_t) {
+                    .kind = l_bool_Leaf,
+                    .start = eats > 0 ? nodes[stack[size]].start : expr.index + end - 1,
+                    .end = expr.index + end,
+                };
+            } break;
+        }
+
+        nodes[node_count] = node;
+        stack[size++] = node_count++;
+    }
+
+    free(walk.joins.data);
+
+    assert(size == 1);
+
+    return emit_bool(sys, nodes, stack[0], atoms, atom_count, ops, op_count);
+}
+
+static bool run_bool(l_bool_op_t *ops, unsigned op_count, unsigned combination)
+{
+    bool stack[MAX_DECISION_CODE];
+    unsigned size = 0;
+
+    for (unsigned i = 0; i < op_count; ++i) {
+        l_bool_op_t op = ops[i];
+
+        switch (op.kind) {
+            case l_bool_Leaf:  stack[size++] = ((combination >> op.atom) & 1) ^ op.negated; break;
+            case l_bool_Const: stack[size++] = !op.negated; break;
+            case l_bool_And:   --size; stack[size - 1] = stack[size - 1] && stack[size]; break;
+            case l_bool_Or:    --size; stack[size - 1] = stack[size - 1] || stack[size]; break;
+            case l_bool_Not:   stack[size - 1] = !stack[size - 1]; break;
+        }
+    }
+
+    assert(size == 1);
+
+    return stack[0];
+}
+
+void l_compile_decisions(l_system_t *sys)
+{
+    l_atom_t atoms[L_MAX_DECISION_ATOMS];
+    l_bool_op_t ops[L_MAX_DECISION_RULES][MAX_DECISION_CODE];
+    unsigned op_counts[L_MAX_DECISION_RULES];
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        l_type_t *type = sys->types.data + t;
+
+        type->mask_index = L_NO_DECISION;
+
+        if (type->rule_count < 2 || type->rule_count > L_MAX_DECISION_RULES)
+            continue;
+
+        unsigned atom_count = 0;
+        bool splits = true;
+
+        for (unsigned r = 0; r < type->rule_count && splits; ++r) {
+            op_counts[r] = 0;
+            splits = split_predicate(sys, sys->rules.data[type->rule_index + r].left.predicate,
+                                     atoms, &atom_count, ops[r], op_counts + r);
+        }
+
+        if (!splits)
+            continue;
+
+        unsigned index = sys->instructions.count;
+
+        for (unsigned i = 0; i < atom_count; ++i) {
+            dck_stretchy_reserve(sys->instructions, atoms[i].count);
+
+            memcpy(sys->instructions.data + sys->instructions.count,
+                   sys->instructions.data + atoms[i].index,
+                   sizeof(l_instruction_t) * atoms[i].count);
+
+            sys->instructions.count += atoms[i].count;
+        }
+
+        unsigned count = sys->instructions.count - index;
+
+        type->atoms = (l_expr_t) {
+            .index = index,
+            .count = count,
+            .depth = l_code_depth(sys->instructions.data + index, count),
+            .reg_index = L_NO_REG_CODE,
+            .native_index = L_NO_NATIVE_CODE,
+        };
+
+        type->atom_count = atom_count;
+
+        unsigned combination_count = 1u << atom_count;
+
+        type->mask_index = sys->decision_masks.count;
+        dck_stretchy_reserve(sys->decision_masks, combination_count);
+
+        for (unsigned c = 0; c < combination_count; ++c) {
+            uint32_t mask = 0;
+
+            for (unsigned r = 0; r < type->rule_count; ++r) {
+                mask |= (uint32_t)run_bool(ops[r], op_counts[r], c) << r;
+            }
+
+            sys->decision_masks.data[sys->decision_masks.count++] = mask;
+        }
+    }
+}
+
+
+/* rule composition
+ *
+ * Rules of several generations in a row are put together into rules that
+ * rewrite a symbol straight into the last of them. Composing rule `r` with
+ * rule `s` of the type of its `j`-th successor substitutes the parameters of
+ * that successor into the predicate and the parameters of `s`, the predicate
+ * of the result is `r && s`. Taken in the order of `r`, `j` and `s` the
+ * composed rules give the symbols in the order the single steps would, no
+ * matter how many of the rules match. Systems with code that can fail are
+ * not composed, which error comes first would change.
+ */
+
+#define L_MAX_COMPOSED_RULES 256
+
+typedef dck_stretchy_t (l_instruction_t, unsigned) l_code_t;
+
+// NOTE: Appends the code of `expr` as it was before `l_lower_branches`,
+//       with `Param p` replaced by the code of `args[p]` when there are any.
+static void append_unlowered(l_system_t *sys, l_code_t *code, l_expr_t expr, l_expr_t *args)
+{
+    l_walk_t walk = {
+        .code  = sys->instructions.data + expr.index,
+        .count = expr.count,
+    };
+
+    l_instruction_t inst;
+    unsigned end;
+    bool lazy;
+
+    while (walk_next(&walk, &inst, &end, &lazy)) {
+        if (inst.id == l_inst_Param && args) {
+            append_unlowered(sys, code, args[inst.op.data.integer], NULL);
+        }
+        else {
+            dck_stretchy_push(*code, inst);
+        }
+    }
+
+    free(walk.joins.data);
+}
+
+static l_expr_t compile_composed(l_system_t *sys, l_code_t *code, l_basic_t type)
+{
+    unsigned index = sys->instructions.count;
+
+    dck_stretchy_reserve(sys->instructions, code->count);
+    memcpy(sys->instructions.data + index, code->data, sizeof(l_instruction_t) * code->count);
+    sys->instructions.count += code->count;
+
+    code->count = 0;
+
+    return l_compile_code(sys, index, type);
+}
+
+// NOTE: `args` are the parameters of the successor of `first` that `second`
+//       rewrites, they must not live in `sys->params`.
+static void compose_rule(l_system_t *sys, l_code_t *code,
+                         l_rule_t first, l_rule_t second, l_expr_t *args)
+{
+    append_unlowered(sys, code, first.left.predicate, NULL);
+    append_unlowered(sys, code, second.left.predicate, args);
+    dck_stretchy_push(*code, (l_instruction_t) { .id = l_inst_And });
+
+    l_match_t left = {
+        .type = first.left.type,
+        .predicate = compile_composed(sys, code, l_basic_Bool),
+    };
+
+    unsigned *right_types = malloc(sizeof(unsigned) * (second.right_size + 1));
+    l_expr_t *params = malloc(sizeof(l_expr_t) * (second.param_count + 1));
+    malloc_check(right_types);
+    malloc_check(params);
+
+    unsigned param_pos = 0;
+
+    for (unsigned ri = 0; ri < second.right_size; ++ri) {
+        l_result_t result = sys->results.data[second.right_index + ri];
+        l_type_t type = sys->types.data[result.type];
+
+        right_types[ri] = result.type;
+
+        for (unsigned pi = 0; pi < type.params_count; ++pi) {
+            append_unlowered(sys, code, sys->params.data[result.params_index + pi], args);
+
+            params[param_pos++] = compile_composed(sys, code,
+                                      sys->param_types.data[type.params_index + pi]);
+        }
+    }
+
+    l_system_add_rule(sys, left, right_types, params, (int)second.right_size);
+
+    sys->rules.data[sys->rules.count - 1].composed = true;
+
+    free(right_types);
+    free(params);
+}
+
+// NOTE: The composed rules would draw for the successors what their
+//       ancestor draws, so stochastic systems are never composed.
+static bool can_compose(l_system_t *sys, unsigned generations)
+{
+    if (sys->stochastic || sys->hierarchical)
+        return false;
+
+    for (unsigned i = 0; i < sys->rules.count; ++i) {
+        l_rule_t rule = sys->rules.data[i];
+        l_expr_t predicate = rule.left.predicate;
+
+        if (can_fail(sys->instructions.data + predicate.index, predicate.count))
+            return false;
+
+        for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+            l_result_t result = sys->results.data[rule.right_index + ri];
+            unsigned params_count = sys->types.data[result.type].params_count;
+
+            for (unsigned pi = 0; pi < params_count; ++pi) {
+                l_expr_t expr = sys->params.data[result.params_index + pi];
+
+                if (can_fail(sys->instructions.data + expr.index, expr.count))
+                    return false;
+            }
+        }
+    }
+
+    // NOTE: The rules composed for `g` generations of a type are its rules
+    //       composed with the ones for `g - 1` generations of each successor.
+    unsigned *counts = malloc(sizeof(unsigned) * (sys->types.count * 2 + 1));
+    malloc_check(counts);
+
+    unsigned *prev = counts, *next = counts + sys->types.count;
+    bool fits = true;
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        prev[t] = sys->types.data[t].rule_count;
+    }
+
+    for (unsigned g = 2; g <= generations && fits; ++g) {
+        for (unsigned t = 0; t < sys->types.count && fits; ++t) {
+            l_type_t type = sys->types.data[t];
+            next[t] = 0;
+
+            for (unsigned r = type.rule_index; r < type.rule_index + type.rule_count; ++r) {
+                l_rule_t rule = sys->rules.data[r];
+
+                for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+                    next[t] += prev[sys->results.data[rule.right_index + ri].type];
+                }
+
+                if (next[t] > L_MAX_COMPOSED_RULES) {
+                    fits = false;
+                    break;
+                }
+            }
+        }
+
+        unsigned *swap = prev;
+        prev = next;
+        next = swap;
+    }
+
+    free(counts);
+    return fits;
+}
+
+static void swap_composed_types(l_system_t *sys)
+{
+    l_type_t *data = sys->types.data;
+    unsigned capacity = sys->types.capacity;
+
+    sys->types.data     = sys->composed_types.data;
+    sys->types.capacity = sys->composed_types.capacity;
+
+    sys->composed_types.data     = data;
+    sys->composed_types.capacity = capacity;
+}
+
+void l_compose_rules(l_system_t *sys)
+{
+    sys->composed_types.count = 0;
+    sys->composed_generations = 0;
+
+    unsigned generations = sys->compose < L_MAX_COMPOSE ? sys->compose : L_MAX_COMPOSE;
+
+    if (generations < 2 || !can_compose(sys, generations))
+        return;
+
+    unsigned type_count = sys->types.count;
+
+    dck_stretchy_reserve(sys->composed_types, type_count);
+    memcpy(sys->composed_types.data, sys->types.data, sizeof(l_type_t) * type_count);
+    sys->composed_types.count = type_count;
+
+    l_code_t code = {0};
+    dck_stretchy_t (l_expr_t, unsigned) args = {0};
+
+    for (unsigned g = 2; g <= generations; ++g) {
+        unsigned *begins = malloc(sizeof(unsigned) * (type_count + 1));
+        malloc_check(begins);
+
+        for (unsigned t = 0; t < type_count; ++t) {
+            l_type_t composed = sys->composed_types.data[t];
+            begins[t] = sys->rules.count;
+
+            for (unsigned r = 0; r < composed.rule_count; ++r) {
+                l_rule_t first = sys->rules.data[composed.rule_index + r];
+
+                for (unsigned ri = 0; ri < first.right_size; ++ri) {
+                    l_result_t result = sys->results.data[first.right_index + ri];
+                    l_type_t type = sys->types.data[result.type];
+
+                    args.count = 0;
+                    dck_stretchy_reserve(args, type.params_count);
+                    memcpy(args.data, sys->params.data + result.params_index,
+                           sizeof(l_expr_t) * type.params_count);
+
+                    for (unsigned s = 0; s < type.rule_count; ++s) {
+                        l_rule_t second = sys->rules.data[type.rule_index + s];
+                        compose_rule(sys, &code, first, second, args.data);
+                    }
+                }
+            }
+        }
+
+        for (unsigned t = 0; t < type_count; ++t) {
+            l_type_t *composed = sys->composed_types.data + t;
+
+            composed->rule_index = begins[t];
+            composed->rule_count = (t + 1 < type_count ? begins[t + 1] : sys->rules.count) - begins[t];
+        }
+
+        free(begins);
+    }
+
+    free(code.data);
+    free(args.data);
+
+    swap_composed_types(sys);
+    l_compile_decisions(sys);
+    swap_composed_types(sys);
+
+    sys->composed_generations = generations;
+}
+
+
+// NOTE: Only the plain `Param i` code for every parameter `i` counts, which
+//       is what the optimizer leaves of any longer way to say the same.
+static bool is_identity(l_system_t *sys, l_rule_t rule)
+{
+    if (rule.right_size != 1)
+        return false;
+
+    l_result_t result = sys->results.data[rule.right_index];
+
+    if (result.type != rule.left.type)
+        return false;
+
+    unsigned params_count = sys->types.data[result.type].params_count;
+
+    for (unsigned pi = 0; pi < params_count; ++pi) {
+        l_expr_t expr = sys->params.data[result.params_index + pi];
+        l_instruction_t inst = sys->instructions.data[expr.index];
+
+        if (expr.count != 1 || inst.id != l_inst_Param || inst.op.data.integer != (int)pi)
+            return false;
+    }
+
+    return true;
+}
+
+
+void l_system_add_rule(l_system_t *sys,
+                       l_match_t left,
+                       unsigned *right_types,
+                       l_expr_t *params,
+                       int right_size)
+{
+    unsigned acc_param_count = 0;
+    unsigned acc_matrix_count = 0;
+
+    for (int i = 0; i < right_size; ++i) {
+        l_type_t type = sys->types.data[right_types[i]];
+        acc_param_count += type.params_count;
+
+        for (unsigned pi = 0; pi < type.params_count; ++pi) {
+            if (sys->param_types.data[type.params_index + pi] == l_basic_Mat4) {
+                ++acc_matrix_count;
+            }
+        }
+    }
+
+    dck_stretchy_reserve(sys->params, acc_param_count);
+    dck_stretchy_reserve(sys->results, right_size);
+
+    unsigned right_index = sys->results.count;
+    unsigned param_pos = 0;
+
+    for (int ri = 0; ri < right_size; ++ri) {
+        unsigned type = right_types[ri];
+        unsigned params_count = sys->types.data[type].params_count;
+        unsigned params_index = sys->params.count;
+
+        for (unsigned pi = 0; pi < params_count; ++pi) {
+            sys->params.data[params_index + pi] = params[param_pos + pi];
+        }
+
+        sys->params.count += params_count;
+
+
+        sys->results.data[right_index + ri] = (l_result_t) {
+            .type = type,
+            .params_index = params_index,
+        };
+
+        param_pos += params_count;
+    }
+
+    sys->results.count += right_size;
+
+
+    l_rule_t rule = {
+        .left = left,
+        .right_index = right_index,
+        .right_size = right_size,
+        .param_count = acc_param_count,
+        .matrix_count = acc_matrix_count,
+    };
+
+    l_compile_rule(sys, &rule);
+
+    rule.identity = is_identity(sys, rule);
+
+    dck_stretchy_push(sys->rules, rule);
+}
+
+
+// NOTE: Stable counting sort, so the rules of one type keep their source order
+//       and the generated symbols come out in the same order as before.
+void l_system_index_rules(l_system_t *sys)
+{
+    for (unsigned i = 0; i < sys->types.count; ++i) {
+        sys->types.data[i].rule_count = 0;
+    }
+
+    for (unsigned i = 0; i < sys->rules.count; ++i) {
+        sys->types.data[sys->rules.data[i].left.type].rule_count++;
+    }
+
+    unsigned rule_index = 0;
+
+    for (unsigned i = 0; i < sys->types.count; ++i) {
+        sys->types.data[i].rule_index = rule_index;
+        rule_index += sys->types.data[i].rule_count;
+    }
+
+    if (sys->rules.count == 0)
+        return;
+
+    l_rule_t *sorted = malloc(sizeof(l_rule_t) * sys->rules.count);
+    malloc_check(sorted);
+
+    for (unsigned i = 0; i < sys->types.count; ++i) {
+        sys->types.data[i].rule_count = 0;
+    }
+
+    for (unsigned i = 0; i < sys->rules.count; ++i) {
+        l_rule_t rule = sys->rules.data[i];
+        l_type_t *type = sys->types.data + rule.left.type;
+
+        sorted[type->rule_index + type->rule_count++] = rule;
+    }
+
+    memcpy(sys->rules.data, sorted, sizeof(l_rule_t) * sys->rules.count);
+    free(sorted);
+
+    for (unsigned i = 0; i < sys->types.count; ++i) {
+        l_type_t *type = sys->types.data + i;
+        type->identity_rule = L_NO_RULE;
+        type->weighted = false;
+
+        for (unsigned r = type->rule_index; r < type->rule_index + type->rule_count; ++r) {
+            type->weighted = type->weighted || sys->rules.data[r].weight > 0.0f;
+        }
+
+        for (unsigned r = type->rule_index; r < type->rule_index + type->rule_count; ++r) {
+            if (sys->rules.data[r].identity) {
+                type->identity_rule = r;
+                break;
+            }
+        }
+    }
+}
+
+
+unsigned l_system_add_matrix(l_system_t *sys, affine_t matrix)
+{
+    unsigned index = sys->matrices[sys->id].count;
+
+    dck_arena_push(sys->matrices[sys->id], matrix);
+
+    return index;
+}
+
+
+// NOTE: Matrix parameters have to be added with `l_system_add_matrix` first.
+void l_system_append(l_system_t *sys, unsigned type, l_value_t *params)
+{
+    unsigned param_count = sys->types.data[type].params_count;
+    unsigned data_index = sys->values[sys->id].count;
+
+    dck_arena_reserve(sys->values[sys->id], param_count);
+
+    for (unsigned i = 0; i < param_count; ++i) {
+        sys->values[sys->id].data[data_index + i] = params[i];
+    }
+
+    sys->values[sys->id].count += param_count;
+
+
+    l_symbol_t symbol = {
+        .type = type,
+        .data_index = data_index,
+    };
+
+    dck_arena_push(sys->symbols[sys->id], symbol);
+}
+
+
+static char *rule_matches(l_system_t *sys, l_stack_t *stack,
+                          l_rule_t rule, l_symbol_t symbol,
+                          bool *matches)
+{
+    l_eval_res_t res = l_evaluate(sys, stack,
+                                  rule.left.predicate,
+                                  true,
+                                  rule.left.type,
+                                  symbol.data_index);
+    if (res.error)
+        return res.error;
+
+    assert(res.val.type == l_basic_Bool);
+
+    *matches = res.val.data.boolean;
+    return NULL;
+}
+
+
+// NOTE: The native engine keeps to its compiled predicates.
+static inline bool has_decisions(l_system_t *sys, l_type_t type)
+{
+    return type.mask_index != L_NO_DECISION && sys->engine != l_engine_Native;
+}
+
+// NOTE: The batch engine and the column layout run a rule over many symbols
+//       at once, a stochastic system needs the index of every symbol it
+//       rewrites and a hierarchical one adds frames as it goes, those go
+//       through the symbol layout one symbol at a time.
+static inline bool runs_batched(l_system_t *sys)
+{
+    return sys->engine == l_engine_Batch && !sys->stochastic && !sys->hierarchical;
+}
+
+static inline bool runs_columns(l_system_t *sys)
+{
+    return sys->layout == l_layout_Columns && !sys->stochastic && !sys->hierarchical;
+}
+
+// NOTE: Runs the atoms of the decision table of `type`, bit `i` of `decided`
+//       then tells whether rule `type.rule_index + i` matches `symbol`.
+static char *decide_rules(l_system_t *sys, l_stack_t *stack,
+                          l_type_t type, l_symbol_t symbol,
+                          uint32_t *decided)
+{
+    char *error = l_evaluate_body(sys, stack, type.atoms, 0,
+                                  sys->values[sys->id].data + symbol.data_index,
+                                  type.params_count);
+    if (error)
+        return error;
+
+    unsigned combination = 0;
+
+    for (unsigned i = 0; i < type.atom_count; ++i) {
+        assert(stack->values.data[i].type == l_basic_Bool);
+        combination |= (unsigned)stack->values.data[i].data.boolean << i;
+    }
+
+    *decided = sys->decision_masks.data[type.mask_index + combination];
+    return NULL;
+}
+
+// NOTE: Picks the one weighted rule of `type` applied to `symbol`, or
+//       `L_NO_RULE` when none of them match. Every matching rule replaces
+//       the pick with the chance of its share of the weights seen so far,
+//       which leaves each with the chance of its share of all of them.
+static char *choose_rule(l_system_t *sys, l_stack_t *stack,
+                         l_type_t type, l_symbol_t symbol,
+                         bool decides, uint32_t decided,
+                         unsigned *chosen)
+{
+    float total = 0.0f;
+
+    *chosen = L_NO_RULE;
+
+    for (unsigned rule_id = type.rule_index; rule_id < type.rule_index + type.rule_count; ++rule_id) {
+        l_rule_t rule = sys->rules.data[rule_id];
+
+        if (rule.weight <= 0.0f)
+            continue;
+
+        bool matches = decides && ((decided >> (rule_id - type.rule_index)) & 1);
+
+        if (!decides) {
+            char *error = rule_matches(sys, stack, rule, symbol, &matches);
+            if (error)
+                return error;
+        }
+
+        if (!matches)
+            continue;
+
+        total += rule.weight;
+
+        if (l_random(sys->seed, ~rule_id, stack->random) * total < rule.weight) {
+            *chosen = rule_id;
+        }
+    }
+
+    return NULL;
+}
+
+
+// NOTE: Copies the `count` parameters at `values` to `out` and the
+//       `matrix_count` matrices among them to `out_matrices` from
+//       `matrix_index` onwards. Parameter `frame` is an index into
+//       `frames` and is copied as it is, may be `L_NO_FRAME`.
+static inline void copy_params(l_system_t *sys,
+                               const l_value_t *values, unsigned count,
+                               l_value_t *out, unsigned matrix_count,
+                               affine_t *out_matrices, unsigned matrix_index,
+                               unsigned frame)
+{
+    memcpy(out, values, sizeof(l_value_t) * count);
+
+    if (matrix_count == 0)
+        return;
+
+    affine_t *matrices = sys->matrices[sys->id].data;
+
+    for (unsigned pi = 0; pi < count; ++pi) {
+        if (out[pi].type == l_basic_Mat4 && pi != frame) {
+            out_matrices[matrix_index] = matrices[out[pi].data.matrix];
+            out[pi].data.matrix = matrix_index++;
+        }
+    }
+}
+
+// NOTE: A symbol comes out frozen when this is the only rule it matched.
+//       In a stochastic system another draw could match other rules.
+static inline bool freezes(l_system_t *sys, l_rule_t rule)
+{
+    return rule.identity && !rule.composed && !sys->stochastic;
+}
+
+static bool all_frozen(l_symbol_t *symbols, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        if (!symbols[i].frozen)
+            return false;
+    }
+
+    return true;
+}
+
+
+// NOTE: Gives the successor of `result` its frame in a hierarchical system,
+//       the one of `symbol` or a new one in it. Without a frame to be carried
+//       by the whole transform is the local one of a new root.
+static char *inherit_frame(l_system_t *sys, l_stack_t *stack,
+                           l_result_t result, l_symbol_t symbol,
+                           l_value_t *out)
+{
+    l_type_t symbol_type = sys->types.data[symbol.type];
+    l_type_t type = sys->types.data[result.type];
+
+    unsigned parent = L_NO_FRAME;
+    l_expr_t code = sys->params.data[result.params_index + type.frame];
+
+    if (symbol_type.frame != L_NO_FRAME) {
+        *out = sys->values[sys->id].data[symbol.data_index + symbol_type.frame];
+
+        if (result.local.count == 0)
+            return NULL;
+
+        parent = out->data.matrix;
+        code = result.local;
+    }
+
+    l_eval_res_t ret = l_evaluate(sys, stack, code, true, symbol.type, symbol.data_index);
+    if (ret.error)
+        return ret.error;
+
+    assert(ret.val.type == l_basic_Mat4);
+
+    l_frame_t frame = {
+        .parent = parent,
+        .local = stack->matrices.data[0],
+    };
+
+    ret.val.data.matrix = sys->frames.count;
+    dck_stretchy_push(sys->frames, frame);
+
+    *out = ret.val;
+    return NULL;
+}
+
+
+// NOTE: Writes the parameters of the right side into `values` from `data_index`
+//       onwards, their matrices into `matrices` from `matrix_index` onwards and
+//       the resulting symbols to the beginning of `symbols`.
+static char *rule_expand(l_system_t *sys, l_stack_t *stack,
+                         l_rule_t rule, l_symbol_t symbol,
+                         l_value_t *values, unsigned data_index,
+                         affine_t *matrices, unsigned matrix_index,
+                         l_symbol_t *symbols)
+{
+    l_type_t symbol_type = sys->types.data[symbol.type];
+    unsigned frame = sys->hierarchical ? symbol_type.frame : L_NO_FRAME;
+
+    if (rule.identity) {
+        copy_params(sys, sys->values[sys->id].data + symbol.data_index, rule.param_count,
+                    values + data_index, rule.matrix_count, matrices, matrix_index, frame);
+
+        symbols[0] = (l_symbol_t) {
+            .type = symbol.type,
+            .data_index = data_index,
+        };
+
+        return NULL;
+    }
+
+    // NOTE: The body computes the frames of the successors from the frame of
+    //       the symbol, a hierarchical system needs them one by one.
+    if (rule.body.count > 0 && sys->engine != l_engine_Native && !sys->hierarchical) {
+        unsigned param_count = sys->types.data[rule.left.type].params_count;
+
+        char *error = l_evaluate_body(sys, stack, rule.body, rule.temp_count,
+                                      sys->values[sys->id].data + symbol.data_index,
+                                      param_count);
+        if (error)
+            return error;
+
+        l_value_t *results         = stack->values.data   + rule.temp_count;
+        affine_t  *result_matrices = stack->matrices.data + rule.temp_count;
+
+        for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+            l_result_t result = sys->results.data[rule.right_index + ri];
+            l_type_t type = sys->types.data[result.type];
+
+            for (unsigned pi = 0; pi < type.params_count; ++pi) {
+                l_value_t value = *results++;
+
+                if (value.type == l_basic_Mat4) {
+                    matrices[matrix_index] = *result_matrices;
+                    value.data.matrix = matrix_index++;
+                }
+
+                ++result_matrices;
+                values[data_index + pi] = value;
+            }
+
+            symbols[ri] = (l_symbol_t) {
+                .type = result.type,
+                .data_index = data_index,
+            };
+
+            data_index += type.params_count;
+        }
+
+        return NULL;
+    }
+
+    for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+        l_result_t result = sys->results.data[rule.right_index + ri];
+
+        l_type_t type = sys->types.data[result.type];
+        l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+        for (unsigned pi = 0; pi < type.params_count; ++pi) {
+            if (sys->hierarchical && pi == type.frame) {
+                char *error = inherit_frame(sys, stack, result, symbol,
+                                            values + data_index + pi);
+                if (error)
+                    return error;
+
+                continue;
+            }
+
+            l_eval_res_t ret = l_evaluate(sys, stack,
+                                          sys->params.data[result.params_index + pi],
+                                          true,
+                                          rule.left.type,
+                                          symbol.data_index);
+            if (ret.error)
+                return ret.error;
+
+            assert(ret.val.type == param_types[pi]);
+
+            if (ret.val.type == l_basic_Mat4) {
+                matrices[matrix_index] = stack->matrices.data[0];
+                ret.val.data.matrix = matrix_index++;
+            }
+
+            values[data_index + pi] = ret.val;
+        }
+
+        symbols[ri] = (l_symbol_t) {
+            .type = result.type,
+            .data_index = data_index,
+        };
+
+        data_index += type.params_count;
+    }
+
+    return NULL;
+}
+
+
+// NOTE: The generations can run out of memory when an arena is past its
+//       reservation, that stops the iteration like the memory budget does.
+static char memory_error[] = "Out of memory!";
+
+// NOTE: Appends the successors of `symbol` to the symbols of generation
+//       `symbol_id` and their parameters to generation `value_id`. `counter`
+//       is the one of the symbol, see `l_random_counter`.
+static char *rewrite_symbol(l_system_t *sys, l_symbol_t symbol, uint64_t counter,
+                            unsigned value_id, unsigned symbol_id)
+{
+    l_type_t symbol_type = sys->types.data[symbol.type];
+
+    sys->eval_stack.random = counter;
+
+    // NOTE: A frozen symbol only goes through its identity rule.
+    unsigned rule_begin = symbol.frozen ? symbol_type.identity_rule : symbol_type.rule_index;
+    unsigned rule_end = symbol.frozen ? rule_begin + 1
+                                      : symbol_type.rule_index + symbol_type.rule_count;
+
+    bool decides = !symbol.frozen && has_decisions(sys, symbol_type);
+    uint32_t decided = 0;
+
+    if (decides) {
+        char *error = decide_rules(sys, &sys->eval_stack, symbol_type, symbol, &decided);
+        if (error)
+            return error;
+    }
+
+    unsigned chosen = L_NO_RULE;
+
+    if (!symbol.frozen && symbol_type.weighted) {
+        char *error = choose_rule(sys, &sys->eval_stack, symbol_type, symbol,
+                                  decides, decided, &chosen);
+        if (error)
+            return error;
+    }
+
+    unsigned match_count = 0;
+    bool freezing = false;
+
+    for (unsigned rule_id = rule_begin; rule_id < rule_end; ++rule_id) {
+        l_rule_t rule = sys->rules.data[rule_id];
+
+        if (rule.weight > 0.0f && rule_id != chosen)
+            continue;
+
+        bool matches = symbol.frozen || rule_id == chosen
+                    || (decides && ((decided >> (rule_id - symbol_type.rule_index)) & 1));
+        char *error = NULL;
+
+        if (!decides && !symbol.frozen && rule_id != chosen) {
+            error = rule_matches(sys, &sys->eval_stack, rule, symbol, &matches);
+        }
+
+        if (error)
+            return error;
+
+        if (!matches)
+            continue;
+
+        freezing = freezes(sys, rule);
+        ++match_count;
+
+        // NOTE: Hierarchical frames live in `frames`.
+        unsigned matrix_count = rule.matrix_count - (sys->hierarchical ? rule.frame_count : 0);
+
+        dck_arena_reserve(sys->values  [value_id],  rule.param_count);
+        dck_arena_reserve(sys->matrices[value_id],  matrix_count);
+        dck_arena_reserve(sys->symbols [symbol_id], rule.right_size);
+
+        if (!dck_arena_has_room(sys->values  [value_id],  rule.param_count) ||
+            !dck_arena_has_room(sys->matrices[value_id],  matrix_count) ||
+            !dck_arena_has_room(sys->symbols [symbol_id], rule.right_size))
+            return memory_error;
+
+        error = rule_expand(sys, &sys->eval_stack, rule, symbol,
+                            sys->values[value_id].data,
+                            sys->values[value_id].count,
+                            sys->matrices[value_id].data,
+                            sys->matrices[value_id].count,
+                            sys->symbols[symbol_id].data + sys->symbols[symbol_id].count);
+        if (error)
+            return error;
+
+        sys->values  [value_id].count  += rule.param_count;
+        sys->matrices[value_id].count  += matrix_count;
+        sys->symbols [symbol_id].count += rule.right_size;
+    }
+
+    if (match_count == 1 && freezing) {
+        sys->symbols[symbol_id].data[sys->symbols[symbol_id].count - 1].frozen = 1;
+    }
+
+    return NULL;
+}
+
+static char *update_serial(l_system_t *sys, unsigned next_id)
+{
+    for (unsigned sym_id = 0; sym_id < sys->symbols[sys->id].count; ++sym_id) {
+        uint64_t counter = l_random_counter(sys->random_generation, sym_id);
+
+        char *error = rewrite_symbol(sys, sys->symbols[sys->id].data[sym_id], counter,
+                                     next_id, next_id);
+        if (error)
+            return error;
+    }
+
+    return NULL;
+}
+
+
+/* batch update
+ *
+ * The input is rewritten in windows of `L_BATCH_WINDOW` symbols. A window is
+ * bucketed by type and every predicate runs over the bucket of its type in
+ * batches of lanes, recording the symbols it hits. Walking the window in
+ * order then gives each hit its output position, after which every parameter
+ * expression runs over the hits of its rule in the same batches. The output
+ * is identical to `update_serial`.
+ */
+
+#define LANES(statement) for (unsigned k = 0; k < L_BATCH_LANES; ++k) { statement; }
+
+#define LANE_BINARY(field, res_field, op)                                   \
+do {                                                                        \
+    l_lanes_t res;                                                          \
+    LANES(res.res_field[k] = sp[-2].field[k] op sp[-1].field[k]);           \
+    sp[-2] = res;                                                           \
+    --sp;                                                                   \
+} while (0)
+
+#define LANE_UNARY(field, res_field, expr)                                  \
+do {                                                                        \
+    l_lanes_t res;                                                          \
+    LANES(res.res_field[k] = expr(sp[-1].field[k]));                        \
+    sp[-1] = res;                                                           \
+} while (0)
+
+#define LANE_CALL2(fn)                                                      \
+do {                                                                        \
+    l_lanes_t res;                                                          \
+    LANES(res.f[k] = fn(sp[-2].f[k], sp[-1].f[k]));                         \
+    sp[-2] = res;                                                           \
+    --sp;                                                                   \
+} while (0)
+
+#define LANE_CALL3(fn)                                                      \
+do {                                                                        \
+    l_lanes_t res;                                                          \
+    LANES(res.f[k] = fn(sp[-3].f[k], sp[-2].f[k], sp[-1].f[k]));            \
+    sp[-3] = res;                                                           \
+    sp -= 2;                                                                \
+} while (0)
+
+// NOTE: Combines the sides of a branch once all of them are on the stack.
+static l_lanes_t *join_lanes(l_lanes_t *sp, l_inst_id_t id)
+{
+    switch (id) {
+        case l_inst_And: { LANE_BINARY(i, i, &); } break;
+        case l_inst_Or:  { LANE_BINARY(i, i, |); } break;
+
+        case l_inst_Select: {
+            l_lanes_t res;
+            LANES(res.i[k] = sp[-3].i[k] ? sp[-2].i[k] : sp[-1].i[k]);
+            sp[-3] = res;
+            sp -= 2;
+        } break;
+
+        default: unreachable();
+    }
+
+    return sp;
+}
+
+// NOTE: Runs the scalar `expr` for `count` symbols, parameter `p` of symbol `k`
+//       is `values[p * stride + indices[k]]`. The unused lanes repeat the first
+//       symbol so they can't fault. Both sides of every branch run and the
+//       joins pick the result, see `l_code_is_scalar`.
+static char *evaluate_lanes(l_system_t *sys, l_batch_t *batch,
+                            l_expr_t expr, l_basic_t *param_types,
+                            l_value_t *values, unsigned stride,
+                            unsigned *indices, unsigned count,
+                            l_lanes_t *result)
+{
+    assert(expr.scalar);
+    assert(count > 0 && count <= L_BATCH_LANES);
+
+    unsigned data[L_BATCH_LANES];
+    LANES(data[k] = indices[k < count ? k : 0]);
+
+    // NOTE: Run eagerly the code can hold more than its depth.
+    batch->lanes.count = 0;
+    dck_stretchy_reserve(batch->lanes, expr.count);
+
+    batch->joins.count = 0;
+    dck_stretchy_reserve(batch->joins, expr.count);
+
+    l_lanes_t *sp = batch->lanes.data;
+    l_instruction_t *code = sys->instructions.data + expr.index;
+
+    l_join_t *joins = batch->joins.data;
+    unsigned join_count = 0;
+
+    for (l_instruction_t *inst = code, *end = code + expr.count; inst != end; ++inst) {
+        while (join_count > 0 && joins[join_count - 1].target == (unsigned)(inst - code)) {
+            sp = join_lanes(sp, joins[--join_count].id);
+        }
+
+        switch (inst->id) {
+            case l_inst_Value: {
+                switch (inst->op.type) {
+                    case l_basic_Int:   LANES(sp->i[k] = inst->op.data.integer);  break;
+                    case l_basic_Float: LANES(sp->f[k] = inst->op.data.floating); break;
+                    case l_basic_Bool:  LANES(sp->i[k] = inst->op.data.boolean);  break;
+                    default: unreachable();
+                }
+                ++sp;
+            } break;
+
+            case l_inst_Param: {
+                unsigned p = (unsigned)inst->op.data.integer;
+                l_value_t *column = values + p * stride;
+
+                switch (param_types[p]) {
+                    case l_basic_Int:   LANES(sp->i[k] = column[data[k]].data.integer);  break;
+                    case l_basic_Float: LANES(sp->f[k] = column[data[k]].data.floating); break;
+                    case l_basic_Bool:  LANES(sp->i[k] = column[data[k]].data.boolean);  break;
+                    default: unreachable();
+                }
+                ++sp;
+            } break;
+
+            case l_inst_AddI: { LANE_BINARY(i, i, +); } break;
+            case l_inst_AddF: { LANE_BINARY(f, f, +); } break;
+            case l_inst_SubI: { LANE_BINARY(i, i, -); } break;
+            case l_inst_SubF: { LANE_BINARY(f, f, -); } break;
+            case l_inst_MulI: { LANE_BINARY(i, i, *); } break;
+            case l_inst_MulF: { LANE_BINARY(f, f, *); } break;
+            case l_inst_DivF: { LANE_BINARY(f, f, /); } break;
+
+            case l_inst_DivI:
+            case l_inst_ModI: {
+                int zero = 0;
+                LANES(zero |= sp[-1].i[k] == 0);
+
+                if (zero)
+                    return inst->id == l_inst_DivI ? "Division by zero!" : "Modulo by zero!";
+
+                if (inst->id == l_inst_DivI) {
+                    LANE_BINARY(i, i, /);
+                }
+                else {
+                    LANE_BINARY(i, i, %);
+                }
+            } break;
+
+            case l_inst_NegI: { LANE_UNARY(i, i, -); } break;
+            case l_inst_NegF: { LANE_UNARY(f, f, -); } break;
+
+            case l_inst_LessI:     { LANE_BINARY(i, i, < ); } break;
+            case l_inst_LessF:     { LANE_BINARY(f, i, < ); } break;
+            case l_inst_MoreI:     { LANE_BINARY(i, i, > ); } break;
+            case l_inst_MoreF:     { LANE_BINARY(f, i, > ); } break;
+            case l_inst_LessEqI:   { LANE_BINARY(i, i, <=); } break;
+            case l_inst_LessEqF:   { LANE_BINARY(f, i, <=); } break;
+            case l_inst_MoreEqI:   { LANE_BINARY(i, i, >=); } break;
+            case l_inst_MoreEqF:   { LANE_BINARY(f, i, >=); } break;
+            case l_inst_EqualI:    { LANE_BINARY(i, i, ==); } break;
+            case l_inst_EqualF:    { LANE_BINARY(f, i, ==); } break;
+            case l_inst_NotEqualI: { LANE_BINARY(i, i, !=); } break;
+            case l_inst_NotEqualF: { LANE_BINARY(f, i, !=); } break;
+
+            // NOTE: Bool lanes are always 0 or 1, the bitwise forms vectorize.
+            case l_inst_And: { LANE_BINARY(i, i, &); } break;
+            case l_inst_Or:  { LANE_BINARY(i, i, |); } break;
+            case l_inst_Not: { LANE_UNARY(i, i, 1 ^); } break;
+
+            case l_inst_IntToFloat:  { LANE_UNARY(i, f, (float)); } break;
+            case l_inst_FloatToInt:  { LANE_UNARY(f, i, (int));   } break;
+            case l_inst_BoolToInt:   break;
+            case l_inst_BoolToFloat: { LANE_UNARY(i, f, (float)); } break;
+            case l_inst_IntToBool:   { LANE_UNARY(i, i, 0 !=);    } break;
+            case l_inst_FloatToBool: { LANE_UNARY(f, i, 0.0f !=); } break;
+
+            case l_inst_IntToFloatBelow: {
+                l_lanes_t res;
+                LANES(res.f[k] = (float)sp[-2].i[k]);
+                sp[-2] = res;
+            } break;
+
+            // NOTE: The series have no branches, so these loops vectorize.
+            case l_inst_Sin: {
+                if (sys->exact_math) { LANE_UNARY(f, f, sinf); }
+                else                 { LANE_UNARY(f, f, l_sin); }
+            } break;
+
+            case l_inst_Cos: {
+                if (sys->exact_math) { LANE_UNARY(f, f, cosf); }
+                else                 { LANE_UNARY(f, f, l_cos); }
+            } break;
+
+            case l_inst_Sqrt: { LANE_UNARY(f, f, l_sqrt); } break;
+
+            case l_inst_Pow: {
+                if (sys->exact_math) { LANE_CALL2(powf); }
+                else {
+                    // NOTE: Whole, `l_pow` is past what GCC inlines at -O2
+                    //       and the loop around the call stays scalar.
+                    l_lanes_t res;
+                    LANES(res.f[k] = l_exp2(sp[-1].f[k] * l_log2(sp[-2].f[k])));
+                    LANES(res.f[k] = l_pow_signs(sp[-2].f[k], sp[-1].f[k], res.f[k]));
+                    sp[-2] = res;
+                    --sp;
+                }
+            } break;
+
+            case l_inst_Min: { LANE_CALL2(l_min); } break;
+            case l_inst_Max: { LANE_CALL2(l_max); } break;
+
+            case l_inst_Lerp:  { LANE_CALL3(l_lerp);  } break;
+            case l_inst_Clamp: { LANE_CALL3(l_clamp); } break;
+
+            case l_inst_Noop: break;
+
+            case l_inst_AndJump:
+            case l_inst_OrJump:
+            case l_inst_JumpIfNot: {
+                joins[join_count++] = (l_join_t) {
+                    .id = inst->id == l_inst_AndJump ? l_inst_And
+                        : inst->id == l_inst_OrJump  ? l_inst_Or
+                                                     : l_inst_Select,
+                    .target = (unsigned)(inst - code) + (unsigned)inst->op.data.integer,
+                };
+            } break;
+
+            case l_inst_Jump: {
+                joins[join_count - 1].target = (unsigned)(inst - code) + (unsigned)inst->op.data.integer;
+            } break;
+
+            default: {
+                return "Untyped instruction in trusted code!";
+            }
+        }
+    }
+
+    while (join_count > 0) {
+        sp = join_lanes(sp, joins[--join_count].id);
+    }
+
+    assert(sp == batch->lanes.data + 1);
+
+    *result = batch->lanes.data[0];
+    return NULL;
+}
+
+#undef LANE_CALL3
+#undef LANE_CALL2
+#undef LANE_UNARY
+#undef LANE_BINARY
+#undef LANES
+
+static l_value_t lane_value(l_lanes_t *lanes, unsigned k, l_basic_t type)
+{
+    l_value_t value = { .type = type };
+
+    switch (type) {
+        case l_basic_Int:   value.data.integer  = lanes->i[k];      break;
+        case l_basic_Float: value.data.floating = lanes->f[k];      break;
+        case l_basic_Bool:  value.data.boolean  = lanes->i[k] != 0; break;
+        default: unreachable();
+    }
+
+    return value;
+}
+
+
+typedef struct
+{
+    unsigned symbols, values, matrices;
+} l_output_t;
+
+static char *reserve_generation(l_system_t *sys, unsigned id, l_output_t count)
+{
+    dck_arena_reserve(sys->values  [id], count.values);
+    dck_arena_reserve(sys->matrices[id], count.matrices);
+    dck_arena_reserve(sys->symbols [id], count.symbols);
+
+    if (!dck_arena_has_room(sys->values  [id], count.values) ||
+        !dck_arena_has_room(sys->matrices[id], count.matrices) ||
+        !dck_arena_has_room(sys->symbols [id], count.symbols))
+        return memory_error;
+
+    return NULL;
+}
+
+// NOTE: Buckets the window [begin, end) by type, collects the hits of every
+//       rule and adds up how much output they are going to produce.
+static char *batch_match(l_system_t *sys, l_batch_t *batch, l_stack_t *stack,
+                         unsigned begin, unsigned end, l_output_t *count)
+{
+    l_symbol_t *symbols = sys->symbols[sys->id].data;
+    unsigned type_count = sys->types.count;
+
+    /* bucket by type */
+    batch->bucket_index.count = 0;
+    dck_stretchy_reserve(batch->bucket_index, type_count + 1);
+    unsigned *bucket_index = batch->bucket_index.data;
+
+    memset(bucket_index, 0, sizeof(unsigned) * (type_count + 1));
+
+    // NOTE: Frozen symbols stay out of the buckets, `batch_expand` copies them.
+    for (unsigned s = begin; s < end; ++s) {
+        if (symbols[s].frozen) {
+            l_rule_t rule = sys->rules.data[sys->types.data[symbols[s].type].identity_rule];
+
+            count->symbols  += 1;
+            count->values   += rule.param_count;
+            count->matrices += rule.matrix_count;
+            continue;
+        }
+
+        bucket_index[symbols[s].type + 1]++;
+    }
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        bucket_index[t + 1] += bucket_index[t];
+    }
+
+    batch->buckets.count = 0;
+    dck_stretchy_reserve(batch->buckets, end - begin);
+    unsigned *buckets = batch->buckets.data;
+
+    for (unsigned s = begin; s < end; ++s) {
+        if (!symbols[s].frozen) {
+            buckets[bucket_index[symbols[s].type]++] = s;
+        }
+    }
+
+    for (unsigned t = type_count; t > 0; --t) {
+        bucket_index[t] = bucket_index[t - 1];
+    }
+
+    bucket_index[0] = 0;
+
+    /* predicates */
+    batch->rule_hits.count = 0;
+    dck_stretchy_reserve(batch->rule_hits, sys->rules.count);
+    memset(batch->rule_hits.data, 0, sizeof(l_rule_hits_t) * sys->rules.count);
+
+    batch->hits.count = 0;
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        unsigned bucket_begin = bucket_index[t];
+        unsigned bucket_end   = bucket_index[t + 1];
+
+        if (bucket_begin == bucket_end)
+            continue;
+
+        l_type_t type = sys->types.data[t];
+        l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+        for (unsigned r = type.rule_index; r < type.rule_index + type.rule_count; ++r) {
+            l_rule_t rule = sys->rules.data[r];
+            l_rule_hits_t *rule_hits = batch->rule_hits.data + r;
+
+            dck_stretchy_reserve(batch->hits, bucket_end - bucket_begin);
+            rule_hits->begin = batch->hits.count;
+
+            for (unsigned b = bucket_begin; b < bucket_end; b += L_BATCH_LANES) {
+                unsigned count = bucket_end - b < L_BATCH_LANES ? bucket_end - b : L_BATCH_LANES;
+
+                bool matches[L_BATCH_LANES];
+
+                if (rule.left.predicate.scalar) {
+                    unsigned data[L_BATCH_LANES];
+                    for (unsigned k = 0; k < count; ++k) {
+                        data[k] = symbols[buckets[b + k]].data_index;
+                    }
+
+                    l_lanes_t lanes;
+                    char *error = evaluate_lanes(sys, batch, rule.left.predicate, param_types,
+                                                 sys->values[sys->id].data, 1,
+                                                 data, count, &lanes);
+                    if (error)
+                        return error;
+
+                    for (unsigned k = 0; k < count; ++k) {
+                        matches[k] = lanes.i[k] != 0;
+                    }
+                }
+                else for (unsigned k = 0; k < count; ++k) {
+                    char *error = rule_matches(sys, stack, rule, symbols[buckets[b + k]], matches + k);
+                    if (error)
+                        return error;
+                }
+
+                for (unsigned k = 0; k < count; ++k) {
+                    if (matches[k]) {
+                        batch->hits.data[batch->hits.count++] = (l_hit_t) { .symbol = buckets[b + k] };
+                    }
+                }
+            }
+
+            rule_hits->end = batch->hits.count;
+            rule_hits->cursor = rule_hits->begin;
+
+            unsigned hit_count = rule_hits->end - rule_hits->begin;
+
+            count->symbols  += hit_count * rule.right_size;
+            count->values   += hit_count * rule.param_count;
+            count->matrices += hit_count * rule.matrix_count;
+        }
+    }
+
+    return NULL;
+}
+
+
+// NOTE: Writes the output of the window matched by `batch_match` into
+//       generation `next_id` starting at the positions in `pos`.
+static char *batch_expand(l_system_t *sys, l_batch_t *batch, l_stack_t *stack,
+                          unsigned begin, unsigned end,
+                          unsigned next_id, l_output_t pos)
+{
+    l_value_t  *next_values   = sys->values  [next_id].data;
+    affine_t   *next_matrices = sys->matrices[next_id].data;
+    l_symbol_t *next_symbols  = sys->symbols [next_id].data;
+
+    l_symbol_t *symbols = sys->symbols[sys->id].data;
+    l_hit_t *hits = batch->hits.data;
+
+    /* output positions in symbol order */
+    for (unsigned s = begin; s < end; ++s) {
+        l_type_t type = sys->types.data[symbols[s].type];
+
+        if (symbols[s].frozen) {
+            l_rule_t rule = sys->rules.data[type.identity_rule];
+
+            copy_params(sys, sys->values[sys->id].data + symbols[s].data_index,
+                        rule.param_count, next_values + pos.values,
+                        rule.matrix_count, next_matrices, pos.matrices, L_NO_FRAME);
+
+            next_symbols[pos.symbols++] = (l_symbol_t) {
+                .type = symbols[s].type,
+                .frozen = 1,
+                .data_index = pos.values,
+            };
+
+            pos.values   += rule.param_count;
+            pos.matrices += rule.matrix_count;
+            continue;
+        }
+
+        unsigned match_count = 0;
+        bool freezing = false;
+
+        for (unsigned r = type.rule_index; r < type.rule_index + type.rule_count; ++r) {
+            l_rule_hits_t *rule_hits = batch->rule_hits.data + r;
+
+            if (rule_hits->cursor == rule_hits->end || hits[rule_hits->cursor].symbol != s)
+                continue;
+
+            l_rule_t rule = sys->rules.data[r];
+
+            freezing = freezes(sys, rule);
+            ++match_count;
+
+            hits[rule_hits->cursor].value_pos  = pos.values;
+            hits[rule_hits->cursor].matrix_pos = pos.matrices;
+            rule_hits->cursor++;
+
+            for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+                l_result_t result = sys->results.data[rule.right_index + ri];
+
+                next_symbols[pos.symbols++] = (l_symbol_t) {
+                    .type = result.type,
+                    .data_index = pos.values,
+                };
+
+                pos.values += sys->types.data[result.type].params_count;
+            }
+
+            pos.matrices += rule.matrix_count;
+        }
+
+        if (match_count == 1 && freezing) {
+            next_symbols[pos.symbols - 1].frozen = 1;
+        }
+    }
+
+    /* parameters rule by rule */
+    for (unsigned r = 0; r < sys->rules.count; ++r) {
+        l_rule_hits_t rule_hits = batch->rule_hits.data[r];
+
+        if (rule_hits.begin == rule_hits.end)
+            continue;
+
+        l_rule_t rule = sys->rules.data[r];
+
+        if (rule.identity) {
+            for (unsigned h = rule_hits.begin; h < rule_hits.end; ++h) {
+                copy_params(sys, sys->values[sys->id].data + symbols[hits[h].symbol].data_index,
+                            rule.param_count, next_values + hits[h].value_pos,
+                            rule.matrix_count, next_matrices, hits[h].matrix_pos, L_NO_FRAME);
+            }
+
+            continue;
+        }
+
+        l_type_t left_type = sys->types.data[rule.left.type];
+        l_basic_t *left_param_types = sys->param_types.data + left_type.params_index;
+
+        unsigned offset = 0;
+        unsigned matrix_offset = 0;
+
+        for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+            l_result_t result = sys->results.data[rule.right_index + ri];
+
+            l_type_t type = sys->types.data[result.type];
+            l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+            for (unsigned pi = 0; pi < type.params_count; ++pi, ++offset) {
+                l_expr_t expr = sys->params.data[result.params_index + pi];
+
+                for (unsigned h = rule_hits.begin; h < rule_hits.end; h += L_BATCH_LANES) {
+                    unsigned count = rule_hits.end - h < L_BATCH_LANES ? rule_hits.end - h : L_BATCH_LANES;
+
+                    if (!expr.scalar) {
+                        for (unsigned k = 0; k < count; ++k) {
+                            l_eval_res_t ret = l_evaluate(sys, stack, expr, true, rule.left.type,
+                                                          symbols[hits[h + k].symbol].data_index);
+                            if (ret.error)
+                                return ret.error;
+
+                            assert(ret.val.type == param_types[pi]);
+
+                            if (ret.val.type == l_basic_Mat4) {
+                                ret.val.data.matrix = hits[h + k].matrix_pos + matrix_offset;
+                                next_matrices[ret.val.data.matrix] = stack->matrices.data[0];
+                            }
+
+                            next_values[hits[h + k].value_pos + offset] = ret.val;
+                        }
+
+                        continue;
+                    }
+
+                    unsigned data[L_BATCH_LANES];
+                    for (unsigned k = 0; k < count; ++k) {
+                        data[k] = symbols[hits[h + k].symbol].data_index;
+                    }
+
+                    l_lanes_t lanes;
+                    char *error = evaluate_lanes(sys, batch, expr, left_param_types,
+                                                 sys->values[sys->id].data, 1,
+                                                 data, count, &lanes);
+                    if (error)
+                        return error;
+
+                    for (unsigned k = 0; k < count; ++k) {
+                        next_values[hits[h + k].value_pos + offset] = lane_value(&lanes, k, param_types[pi]);
+                    }
+                }
+
+                if (param_types[pi] == l_basic_Mat4) {
+                    ++matrix_offset;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static char *update_batch(l_system_t *sys, unsigned next_id)
+{
+    unsigned symbol_count = sys->symbols[sys->id].count;
+
+    l_batch_t *batch = sys->worker_batches.data;
+
+    for (unsigned begin = 0; begin < symbol_count; begin += L_BATCH_WINDOW) {
+        unsigned end = symbol_count - begin < L_BATCH_WINDOW ? symbol_count : begin + L_BATCH_WINDOW;
+
+        l_output_t count = {0};
+
+        char *error = batch_match(sys, batch, &sys->eval_stack, begin, end, &count);
+        if (error)
+            return error;
+
+        error = reserve_generation(sys, next_id, count);
+        if (error)
+            return error;
+
+        l_output_t pos = {
+            .symbols  = sys->symbols [next_id].count,
+            .values   = sys->values  [next_id].count,
+            .matrices = sys->matrices[next_id].count,
+        };
+
+        error = batch_expand(sys, batch, &sys->eval_stack, begin, end, next_id, pos);
+        if (error)
+            return error;
+
+        sys->values  [next_id].count += count.values;
+        sys->matrices[next_id].count += count.matrices;
+        sys->symbols [next_id].count += count.symbols;
+    }
+
+    return NULL;
+}
+
+
+/* memory budget
+ *
+ * Before a generation is allocated its size is known, either from the static
+ * fan-out of the rules or from counting the rules that match. A generation
+ * that would take the two live generations over `memory_budget` stops the
+ * iteration with an error instead of failing to allocate.
+ */
+
+static char budget_error[] = "Would go over the memory budget!";
+
+static size_t output_size(l_output_t output)
+{
+    return (size_t)output.symbols  * sizeof(l_symbol_t)
+         + (size_t)output.values   * sizeof(l_value_t)
+         + (size_t)output.matrices * sizeof(affine_t);
+}
+
+static size_t generation_size(l_system_t *sys, unsigned id)
+{
+    return (size_t)sys->symbols [id].count * sizeof(l_symbol_t)
+         + (size_t)sys->values  [id].count * sizeof(l_value_t)
+         + (size_t)sys->matrices[id].count * sizeof(affine_t);
+}
+
+static char *check_budget(l_system_t *sys, size_t size)
+{
+    if (sys->memory_budget == 0 || size <= sys->memory_budget)
+        return NULL;
+
+    sys->memory_needed = size;
+    return budget_error;
+}
+
+// NOTE: Every matching rule adds its right side, so a symbol turns into at
+//       most the right sides of all the rules of its type. Returns the bound
+//       in bytes, `bound` gets the counts unless they do not fit.
+static uint64_t predict_generation(l_system_t *sys, l_output_t *bound)
+{
+    unsigned type_count = sys->types.count;
+
+    uint64_t *counts = calloc(type_count * 2, sizeof(uint64_t));
+    malloc_check(counts);
+
+    for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
+        l_symbol_t symbol = sys->symbols[sys->id].data[i];
+        ++counts[symbol.type * 2 + symbol.frozen];
+    }
+
+    uint64_t symbols = 0, values = 0, matrices = 0;
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        l_type_t type = sys->types.data[t];
+
+        for (unsigned r = type.rule_index; r < type.rule_index + type.rule_count; ++r) {
+            l_rule_t rule = sys->rules.data[r];
+
+            uint64_t count = counts[t * 2] + (r == type.identity_rule ? counts[t * 2 + 1] : 0);
+
+            symbols  += count * rule.right_size;
+            values   += count * rule.param_count;
+            matrices += count * rule.matrix_count;
+        }
+    }
+
+    free(counts);
+
+    bool fits = symbols <= UINT_MAX && values <= UINT_MAX && matrices <= UINT_MAX;
+
+    *bound = fits ? (l_output_t) { (unsigned)symbols, (unsigned)values, (unsigned)matrices }
+                  : (l_output_t) {0};
+
+    return symbols  * sizeof(l_symbol_t)
+         + values   * sizeof(l_value_t)
+         + matrices * sizeof(affine_t);
+}
+
+// NOTE: The models of a symbol only depend on its type.
+static void predict_model(l_system_t *sys, unsigned type_id, uint64_t *vertices, uint64_t *indices)
+{
+    l_type_t type = sys->types.data[type_id];
+
+    for (unsigned l = 0; l < type.load_count; ++l) {
+        model_data_t model = sys->resources.data[sys->type_loads.data[type.load_index + l].resource_index].model;
+
+        *vertices += model.vertex_count;
+        *indices  += model.index_count;
+    }
+}
+
+// NOTE: Checks `vertices` and `indices` more in `builder` on top of the
+//       current generation, the builder counts them in ints.
+static char *check_model(l_system_t *sys, model_builder_t *builder, uint64_t vertices, uint64_t indices)
+{
+    vertices += builder->data.vertex_count;
+    indices  += builder->data.index_count;
+
+    if (vertices > INT_MAX || indices > INT_MAX)
+        return "Model would be too big!";
+
+    return check_budget(sys, generation_size(sys, sys->id)
+                           + vertices * sizeof(vertex_t)
+                           + indices  * sizeof(unsigned));
+}
+
+
+/* column layout
+ *
+ * The predicates of a type run straight down the columns of its bucket. The
+ * hits add the sizes of their right sides to the position of their symbol,
+ * a prefix sum over the positions then gives every symbol the position of its
+ * first successor. Walking the rules in order hands out the positions and the
+ * parameter expressions fill the columns of the next generation linearly.
+ */
+
+static void reserve_buckets(l_system_t *sys, unsigned id)
+{
+    unsigned type_count = sys->types.count;
+
+    dck_stretchy_reserve(sys->buckets[id], type_count);
+
+    for (unsigned i = sys->buckets[id].count; i < type_count; ++i) {
+        sys->buckets[id].data[i] = (l_bucket_t) {0};
+    }
+
+    if (sys->buckets[id].count < type_count) {
+        sys->buckets[id].count = type_count;
+    }
+
+    for (unsigned i = 0; i < type_count; ++i) {
+        sys->buckets[id].data[i].count = 0;
+    }
+}
+
+// NOTE: Makes room for `count` symbols, the old content is thrown away.
+static void reserve_bucket(l_bucket_t *bucket, unsigned param_count, unsigned count)
+{
+    if (count <= bucket->stride && param_count == bucket->param_count)
+        return;
+
+    unsigned stride = bucket->stride ? bucket->stride : 64;
+
+    while (stride < count) {
+        stride *= 2;
+    }
+
+    free(bucket->columns);
+    free(bucket->order);
+
+    bucket->columns = malloc(sizeof(l_value_t) * stride * (param_count ? param_count : 1));
+    malloc_check(bucket->columns);
+
+    bucket->order = malloc(sizeof(unsigned) * stride);
+    malloc_check(bucket->order);
+
+    bucket->stride = stride;
+    bucket->param_count = param_count;
+}
+
+static void scatter_columns(l_system_t *sys)
+{
+    unsigned id = sys->id;
+
+    reserve_buckets(sys, id);
+
+    l_bucket_t *buckets = sys->buckets[id].data;
+    l_symbol_t *symbols = sys->symbols[id].data;
+    l_value_t  *values  = sys->values [id].data;
+
+    for (unsigned o = 0; o < sys->symbols[id].count; ++o) {
+        buckets[symbols[o].type].count++;
+    }
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        reserve_bucket(buckets + t, sys->types.data[t].params_count, buckets[t].count);
+        buckets[t].count = 0;
+    }
+
+    for (unsigned o = 0; o < sys->symbols[id].count; ++o) {
+        l_symbol_t symbol = symbols[o];
+        l_bucket_t *bucket = buckets + symbol.type;
+        unsigned params_count = sys->types.data[symbol.type].params_count;
+
+        unsigned i = bucket->count++;
+        bucket->order[i] = o;
+
+        for (unsigned p = 0; p < params_count; ++p) {
+            bucket->columns[p * bucket->stride + i] = values[symbol.data_index + p];
+        }
+    }
+
+    sys->columnar = true;
+}
+
+char *l_system_flatten(l_system_t *sys)
+{
+    if (!sys->columnar)
+        return NULL;
+
+    unsigned id = sys->id;
+    l_bucket_t *buckets = sys->buckets[id].data;
+
+    unsigned symbol_count = 0;
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        symbol_count += buckets[t].count;
+    }
+
+    sys->symbols[id].count = 0;
+    dck_arena_reserve(sys->symbols[id], symbol_count);
+    if (!dck_arena_has_room(sys->symbols[id], symbol_count))
+        return memory_error;
+
+    l_symbol_t *symbols = sys->symbols[id].data;
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        for (unsigned i = 0; i < buckets[t].count; ++i) {
+            symbols[buckets[t].order[i]] = (l_symbol_t) { .type = t };
+        }
+    }
+
+    unsigned value_count = 0;
+
+    for (unsigned o = 0; o < symbol_count; ++o) {
+        symbols[o].data_index = value_count;
+        value_count += sys->types.data[symbols[o].type].params_count;
+    }
+
+    sys->values[id].count = 0;
+    dck_arena_reserve(sys->values[id], value_count);
+    if (!dck_arena_has_room(sys->values[id], value_count))
+        return memory_error;
+
+    l_value_t *values = sys->values[id].data;
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        l_bucket_t bucket = buckets[t];
+        unsigned params_count = sys->types.data[t].params_count;
+
+        for (unsigned i = 0; i < bucket.count; ++i) {
+            unsigned data_index = symbols[bucket.order[i]].data_index;
+
+            for (unsigned p = 0; p < params_count; ++p) {
+                values[data_index + p] = bucket.columns[p * bucket.stride + i];
+            }
+        }
+    }
+
+    sys->symbols[id].count = symbol_count;
+    sys->values [id].count = value_count;
+
+    sys->columnar = false;
+    return NULL;
+}
+
+// NOTE: Evaluates `expr` for symbol `i` of `bucket` outside of the lanes.
+static l_eval_res_t evaluate_column(l_system_t *sys, l_batch_t *batch, l_stack_t *stack,
+                                    l_expr_t expr, l_bucket_t *bucket, unsigned i)
+{
+    batch->params.count = 0;
+    dck_stretchy_reserve(batch->params, bucket->param_count);
+
+    for (unsigned p = 0; p < bucket->param_count; ++p) {
+        batch->params.data[p] = bucket->columns[p * bucket->stride + i];
+    }
+
+    return l_evaluate_params(sys, stack, expr, batch->params.data, bucket->param_count);
+}
+
+static char *update_columns(l_system_t *sys, unsigned next_id)
+{
+    if (!sys->columnar) {
+        scatter_columns(sys);
+    }
+
+    reserve_buckets(sys, next_id);
+
+    l_batch_t *batch = sys->worker_batches.data;
+    l_stack_t *stack = &sys->eval_stack;
+
+    l_bucket_t *buckets      = sys->buckets[sys->id].data;
+    l_bucket_t *next_buckets = sys->buckets[next_id].data;
+
+    unsigned type_count = sys->types.count;
+    unsigned symbol_count = 0;
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        symbol_count += buckets[t].count;
+    }
+
+    batch->cursors.count = 0;
+    dck_stretchy_reserve(batch->cursors, symbol_count);
+    unsigned *cursors = batch->cursors.data;
+    memset(cursors, 0, sizeof(unsigned) * symbol_count);
+
+    batch->type_counts.count = 0;
+    dck_stretchy_reserve(batch->type_counts, type_count);
+    unsigned *type_counts = batch->type_counts.data;
+    memset(type_counts, 0, sizeof(unsigned) * type_count);
+
+    batch->rule_hits.count = 0;
+    dck_stretchy_reserve(batch->rule_hits, sys->rules.count);
+    memset(batch->rule_hits.data, 0, sizeof(l_rule_hits_t) * sys->rules.count);
+
+    batch->hits.count = 0;
+
+    unsigned matrix_count = 0;
+
+    // NOTE: The column layout keeps no frozen symbols, the generation is a
+    //       fixed point when every symbol hits nothing but one identity rule.
+    bool fixed = true;
+
+    /* predicates */
+    for (unsigned t = 0; t < type_count; ++t) {
+        l_bucket_t *bucket = buckets + t;
+
+        if (bucket->count == 0)
+            continue;
+
+        l_type_t type = sys->types.data[t];
+        l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+        for (unsigned r = type.rule_index; r < type.rule_index + type.rule_count; ++r) {
+            l_rule_t rule = sys->rules.data[r];
+            l_rule_hits_t *rule_hits = batch->rule_hits.data + r;
+
+            dck_stretchy_reserve(batch->hits, bucket->count);
+            rule_hits->begin = batch->hits.count;
+
+            for (unsigned b = 0; b < bucket->count; b += L_BATCH_LANES) {
+                unsigned count = bucket->count - b < L_BATCH_LANES ? bucket->count - b : L_BATCH_LANES;
+
+                bool matches[L_BATCH_LANES];
+
+                if (rule.left.predicate.scalar) {
+                    unsigned indices[L_BATCH_LANES];
+                    for (unsigned k = 0; k < count; ++k) {
+                        indices[k] = b + k;
+                    }
+
+                    l_lanes_t lanes;
+                    char *error = evaluate_lanes(sys, batch, rule.left.predicate, param_types,
+                                                 bucket->columns, bucket->stride,
+                                                 indices, count, &lanes);
+                    if (error)
+                        return error;
+
+                    for (unsigned k = 0; k < count; ++k) {
+                        matches[k] = lanes.i[k] != 0;
+                    }
+                }
+                else for (unsigned k = 0; k < count; ++k) {
+                    l_eval_res_t res = evaluate_column(sys, batch, stack, rule.left.predicate,
+                                                       bucket, b + k);
+                    if (res.error)
+                        return res.error;
+
+                    matches[k] = res.val.data.boolean;
+                }
+
+                for (unsigned k = 0; k < count; ++k) {
+                    if (!matches[k])
+                        continue;
+
+                    batch->hits.data[batch->hits.count++] = (l_hit_t) { .symbol = b + k };
+                    cursors[bucket->order[b + k]] += rule.right_size;
+                }
+            }
+
+            rule_hits->end = batch->hits.count;
+
+            unsigned hit_count = rule_hits->end - rule_hits->begin;
+
+            if (hit_count > 0 && !freezes(sys, rule)) {
+                fixed = false;
+            }
+
+            for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+                type_counts[sys->results.data[rule.right_index + ri].type] += hit_count;
+            }
+
+            matrix_count += hit_count * rule.matrix_count;
+        }
+    }
+
+    /* positions of the first successors */
+    unsigned position = 0;
+
+    for (unsigned o = 0; o < symbol_count; ++o) {
+        unsigned size = cursors[o];
+        cursors[o] = position;
+        position += size;
+        fixed &= size == 1;
+    }
+
+    /* memory budget */
+    size_t size = ((size_t)sys->matrices[sys->id].count + matrix_count) * sizeof(affine_t);
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        size_t symbol_size = sys->types.data[t].params_count * sizeof(l_value_t) + sizeof(unsigned);
+        size += ((size_t)buckets[t].count + type_counts[t]) * symbol_size;
+    }
+
+    char *error = check_budget(sys, size);
+    if (error)
+        return error;
+
+    for (unsigned t = 0; t < type_count; ++t) {
+        reserve_bucket(next_buckets + t, sys->types.data[t].params_count, type_counts[t]);
+    }
+
+    sys->matrices[next_id].count = 0;
+    dck_arena_reserve(sys->matrices[next_id], matrix_count);
+    if (!dck_arena_has_room(sys->matrices[next_id], matrix_count))
+        return memory_error;
+
+    affine_t *next_matrices = sys->matrices[next_id].data;
+
+    /* successors */
+    for (unsigned r = 0; r < sys->rules.count; ++r) {
+        l_rule_hits_t rule_hits = batch->rule_hits.data[r];
+
+        if (rule_hits.begin == rule_hits.end)
+            continue;
+
+        l_rule_t rule = sys->rules.data[r];
+        l_hit_t *hits = batch->hits.data + rule_hits.begin;
+        unsigned hit_count = rule_hits.end - rule_hits.begin;
+
+        l_bucket_t *bucket = buckets + rule.left.type;
+        l_type_t left_type = sys->types.data[rule.left.type];
+        l_basic_t *left_param_types = sys->param_types.data + left_type.params_index;
+
+        for (unsigned h = 0; h < hit_count; ++h) {
+            unsigned *cursor = cursors + bucket->order[hits[h].symbol];
+
+            hits[h].value_pos = *cursor;
+            *cursor += rule.right_size;
+
+            hits[h].matrix_pos = sys->matrices[next_id].count;
+            sys->matrices[next_id].count += rule.matrix_count;
+        }
+
+        unsigned matrix_offset = 0;
+
+        for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+            l_result_t result = sys->results.data[rule.right_index + ri];
+
+            l_type_t type = sys->types.data[result.type];
+            l_basic_t *param_types = sys->param_types.data + type.params_index;
+
+            l_bucket_t *next = next_buckets + result.type;
+            unsigned start = next->count;
+            next->count += hit_count;
+
+            for (unsigned h = 0; h < hit_count; ++h) {
+                next->order[start + h] = hits[h].value_pos + ri;
+            }
+
+            for (unsigned pi = 0; pi < type.params_count; ++pi) {
+                l_expr_t expr = sys->params.data[result.params_index + pi];
+                l_value_t *column = next->columns + pi * next->stride + start;
+
+                if (rule.identity) {
+                    l_value_t *source = bucket->columns + pi * bucket->stride;
+                    affine_t *matrices = sys->matrices[sys->id].data;
+
+                    for (unsigned h = 0; h < hit_count; ++h) {
+                        l_value_t value = source[hits[h].symbol];
+
+                        if (value.type == l_basic_Mat4) {
+                            next_matrices[hits[h].matrix_pos + matrix_offset] = matrices[value.data.matrix];
+                            value.data.matrix = hits[h].matrix_pos + matrix_offset;
+                        }
+
+                        column[h] = value;
+                    }
+                }
+                else for (unsigned h = 0; h < hit_count; h += L_BATCH_LANES) {
+                    unsigned count = hit_count - h < L_BATCH_LANES ? hit_count - h : L_BATCH_LANES;
+
+                    if (!expr.scalar) {
+                        for (unsigned k = 0; k < count; ++k) {
+                            l_eval_res_t ret = evaluate_column(sys, batch, stack, expr,
+                                                               bucket, hits[h + k].symbol);
+                            if (ret.error)
+                                return ret.error;
+
+                            assert(ret.val.type == param_types[pi]);
+
+                            if (ret.val.type == l_basic_Mat4) {
+                                ret.val.data.matrix = hits[h + k].matrix_pos + matrix_offset;
+                                next_matrices[ret.val.data.matrix] = stack->matrices.data[0];
+                            }
+
+                            column[h + k] = ret.val;
+                        }
+
+                        continue;
+                    }
+
+                    unsigned indices[L_BATCH_LANES];
+                    for (unsigned k = 0; k < count; ++k) {
+                        indices[k] = hits[h + k].symbol;
+                    }
+
+                    l_lanes_t lanes;
+                    char *error = evaluate_lanes(sys, batch, expr, left_param_types,
+                                                 bucket->columns, bucket->stride,
+                                                 indices, count, &lanes);
+                    if (error)
+                        return error;
+
+                    for (unsigned k = 0; k < count; ++k) {
+                        column[h + k] = lane_value(&lanes, k, param_types[pi]);
+                    }
+                }
+
+                if (param_types[pi] == l_basic_Mat4) {
+                    ++matrix_offset;
+                }
+            }
+        }
+    }
+
+    sys->symbols[next_id].count = 0;
+    sys->values [next_id].count = 0;
+
+    sys->fixed = fixed;
+
+    return NULL;
+}
+
+
+/* parallel update
+ *
+ * The input symbols are split into chunks that are handed out to the workers
+ * round-robin. The first pass only evaluates predicates and counts the symbols,
+ * values and matrices every chunk produces. A prefix sum over the chunks gives each one
+ * its output offsets, so the second pass writes straight into the next
+ * generation. The result is identical to `update_serial`.
+ */
+
+#define L_CHUNKS_PER_WORKER 8
+
+typedef struct
+{
+    unsigned symbol_begin, symbol_end;
+
+    l_output_t count, offset;
+
+    char *error;
+} l_chunk_t;
+
+typedef struct
+{
+    l_system_t *sys;
+    unsigned next_id;
+    bool counting;
+
+    l_chunk_t *chunks;
+    unsigned chunk_count;
+    unsigned worker_count;
+} l_update_job_t;
+
+// NOTE: The batch engine goes through its chunk window by window.
+static char *batch_chunk(l_system_t *sys, l_batch_t *batch, l_stack_t *stack,
+                         l_chunk_t *chunk, bool counting, unsigned next_id)
+{
+    l_output_t pos = chunk->offset;
+
+    for (unsigned begin = chunk->symbol_begin; begin < chunk->symbol_end; begin += L_BATCH_WINDOW) {
+        unsigned end = chunk->symbol_end - begin < L_BATCH_WINDOW ? chunk->symbol_end
+                                                                  : begin + L_BATCH_WINDOW;
+
+        l_output_t count = {0};
+
+        char *error = batch_match(sys, batch, stack, begin, end, &count);
+        if (error)
+            return error;
+
+        if (counting) {
+            chunk->count.symbols  += count.symbols;
+            chunk->count.values   += count.values;
+            chunk->count.matrices += count.matrices;
+            continue;
+        }
+
+        error = batch_expand(sys, batch, stack, begin, end, next_id, pos);
+        if (error)
+            return error;
+
+        pos.symbols  += count.symbols;
+        pos.values   += count.values;
+        pos.matrices += count.matrices;
+    }
+
+    return NULL;
+}
+
+static void update_worker(void *context, unsigned worker_index)
+{
+    l_update_job_t *job = context;
+    l_system_t *sys = job->sys;
+    l_stack_t *stack = sys->worker_stacks.data + worker_index;
+
+    l_value_t  *next_values   = sys->values  [job->next_id].data;
+    affine_t   *next_matrices = sys->matrices[job->next_id].data;
+    l_symbol_t *next_symbols  = sys->symbols [job->next_id].data;
+
+    for (unsigned ci = worker_index; ci < job->chunk_count; ci += job->worker_count) {
+        l_chunk_t *chunk = job->chunks + ci;
+
+        if (runs_batched(sys)) {
+            chunk->error = batch_chunk(sys, sys->worker_batches.data + worker_index, stack,
+                                       chunk, job->counting, job->next_id);
+            continue;
+        }
+
+        l_output_t pos = chunk->offset;
+
+        for (unsigned sym_id = chunk->symbol_begin; sym_id < chunk->symbol_end; ++sym_id) {
+            l_symbol_t symbol = sys->symbols[sys->id].data[sym_id];
+            l_type_t symbol_type = sys->types.data[symbol.type];
+
+            unsigned rule_begin = symbol.frozen ? symbol_type.identity_rule : symbol_type.rule_index;
+            unsigned rule_end = symbol.frozen ? rule_begin + 1
+                                              : symbol_type.rule_index + symbol_type.rule_count;
+
+            bool decides = !symbol.frozen && has_decisions(sys, symbol_type);
+            uint32_t decided = 0;
+
+            stack->random = l_random_counter(sys->random_generation, sym_id);
+
+            if (decides) {
+                chunk->error = decide_rules(sys, stack, symbol_type, symbol, &decided);
+                if (chunk->error)
+                    goto next_chunk;
+            }
+
+            unsigned chosen = L_NO_RULE;
+
+            if (!symbol.frozen && symbol_type.weighted) {
+                chunk->error = choose_rule(sys, stack, symbol_type, symbol,
+                                           decides, decided, &chosen);
+                if (chunk->error)
+                    goto next_chunk;
+            }
+
+            unsigned match_count = 0;
+            bool freezing = false;
+
+            for (unsigned rule_id = rule_begin; rule_id < rule_end; ++rule_id) {
+                l_rule_t rule = sys->rules.data[rule_id];
+
+                if (rule.weight > 0.0f && rule_id != chosen)
+                    continue;
+
+                bool matches = symbol.frozen || rule_id == chosen
+                            || (decides && ((decided >> (rule_id - symbol_type.rule_index)) & 1));
+
+                if (!decides && !symbol.frozen && rule_id != chosen) {
+                    chunk->error = rule_matches(sys, stack, rule, symbol, &matches);
+                }
+
+                if (chunk->error)
+                    goto next_chunk;
+
+                if (!matches)
+                    continue;
+
+                freezing = freezes(sys, rule);
+                ++match_count;
+
+                if (job->counting) {
+                    chunk->count.symbols  += rule.right_size;
+                    chunk->count.values   += rule.param_count;
+                    chunk->count.matrices += rule.matrix_count;
+                    continue;
+                }
+
+                chunk->error = rule_expand(sys, stack, rule, symbol,
+                                           next_values, pos.values,
+                                           next_matrices, pos.matrices,
+                                           next_symbols + pos.symbols);
+                if (chunk->error)
+                    goto next_chunk;
+
+                pos.symbols  += rule.right_size;
+                pos.values   += rule.param_count;
+                pos.matrices += rule.matrix_count;
+            }
+
+            if (!job->counting && match_count == 1 && freezing) {
+                next_symbols[pos.symbols - 1].frozen = 1;
+            }
+        }
+
+next_chunk:
+        ;
+    }
+}
+
+static void reserve_workers(l_system_t *sys, unsigned worker_count)
+{
+    dck_stretchy_reserve(sys->worker_stacks,  worker_count);
+    dck_stretchy_reserve(sys->worker_batches, worker_count);
+
+    for (unsigned i = sys->worker_stacks.count; i < worker_count; ++i) {
+        sys->worker_stacks.data[i] = (l_stack_t) {0};
+    }
+
+    for (unsigned i = sys->worker_batches.count; i < worker_count; ++i) {
+        sys->worker_batches.data[i] = (l_batch_t) {0};
+    }
+
+    if (sys->worker_stacks.count < worker_count) {
+        sys->worker_stacks.count = worker_count;
+    }
+
+    if (sys->worker_batches.count < worker_count) {
+        sys->worker_batches.count = worker_count;
+    }
+}
+
+// NOTE: The counting pass of the parallel update on the calling thread.
+static char *count_generation(l_system_t *sys, l_output_t *count)
+{
+    reserve_workers(sys, 1);
+
+    l_chunk_t chunk = { .symbol_end = sys->symbols[sys->id].count };
+
+    l_update_job_t job = {
+        .sys = sys,
+        .counting = true,
+        .chunks = &chunk,
+        .chunk_count = 1,
+        .worker_count = 1,
+    };
+
+    update_worker(&job, 0);
+
+    *count = chunk.count;
+    return chunk.error;
+}
+
+// NOTE: The serial updates grow the generation as they go, it is allocated
+//       once up front for the bound instead. The matches are only counted
+//       when the bound does not fit into the budget, the exact count may.
+static char *prepare_serial(l_system_t *sys, unsigned next_id)
+{
+    l_output_t count;
+
+    size_t size = generation_size(sys, sys->id);
+    uint64_t bound = predict_generation(sys, &count);
+
+    if (sys->memory_budget && size + bound > sys->memory_budget) {
+        char *error = count_generation(sys, &count);
+        if (error)
+            return error;
+
+        error = check_budget(sys, size + output_size(count));
+        if (error)
+            return error;
+    }
+
+    return reserve_generation(sys, next_id, count);
+}
+
+
+static char *update_parallel(l_system_t *sys, unsigned next_id, unsigned worker_count)
+{
+    unsigned symbol_count = sys->symbols[sys->id].count;
+
+    reserve_workers(sys, worker_count);
+
+    unsigned chunk_count = worker_count * L_CHUNKS_PER_WORKER;
+    unsigned chunk_size = (symbol_count + chunk_count - 1) / chunk_count;
+
+    l_chunk_t *chunks = malloc(sizeof(l_chunk_t) * chunk_count);
+    malloc_check(chunks);
+
+    for (unsigned i = 0; i < chunk_count; ++i) {
+        unsigned begin = i * chunk_size;
+        unsigned end = begin + chunk_size;
+
+        if (begin > symbol_count) begin = symbol_count;
+        if (end   > symbol_count) end   = symbol_count;
+
+        chunks[i] = (l_chunk_t) { .symbol_begin = begin, .symbol_end = end };
+    }
+
+    l_update_job_t job = {
+        .sys = sys,
+        .next_id = next_id,
+        .counting = true,
+        .chunks = chunks,
+        .chunk_count = chunk_count,
+        .worker_count = worker_count,
+    };
+
+    char *error = NULL;
+
+    /* counting pass */
+    parallel_run(update_worker, &job, worker_count);
+
+    l_output_t total = {0};
+
+    for (unsigned i = 0; i < chunk_count; ++i) {
+        if (chunks[i].error) {
+            error = chunks[i].error;
+            goto exit;
+        }
+
+        chunks[i].offset = total;
+
+        total.symbols  += chunks[i].count.symbols;
+        total.values   += chunks[i].count.values;
+        total.matrices += chunks[i].count.matrices;
+    }
+
+    error = check_budget(sys, generation_size(sys, sys->id) + output_size(total));
+    if (error)
+        goto exit;
+
+    error = reserve_generation(sys, next_id, total);
+    if (error)
+        goto exit;
+
+    /* writing pass */
+    job.counting = false;
+    parallel_run(update_worker, &job, worker_count);
+
+    for (unsigned i = 0; i < chunk_count; ++i) {
+        if (chunks[i].error) {
+            error = chunks[i].error;
+            goto exit;
+        }
+    }
+
+    sys->values  [next_id].count = total.values;
+    sys->matrices[next_id].count = total.matrices;
+    sys->symbols [next_id].count = total.symbols;
+
+exit:
+    free(chunks);
+    return error;
+}
+
+
+/* hierarchical transforms */
+
+typedef struct
+{
+    l_system_t *sys;
+    unsigned begin, end;
+    unsigned worker_count;
+} l_resolve_job_t;
+
+static void resolve_worker(void *context, unsigned worker_index)
+{
+    l_resolve_job_t *job = context;
+
+    l_frame_t *frames = job->sys->frames.data;
+    affine_t  *worlds = job->sys->frame_worlds.data;
+
+    unsigned count = job->end - job->begin;
+    unsigned begin = job->begin + (unsigned)((uint64_t)count *  worker_index      / job->worker_count);
+    unsigned end   = job->begin + (unsigned)((uint64_t)count * (worker_index + 1) / job->worker_count);
+
+    for (unsigned i = begin; i < end; ++i) {
+        l_frame_t frame = frames[i];
+
+        worlds[i] = frame.parent == L_NO_FRAME ? frame.local
+                                               : affine_multiply(worlds[frame.parent], frame.local);
+    }
+}
+
+// NOTE: The parents of the frames of a level come before it, so the frames
+//       of one level are resolved at the same time.
+static void resolve_frames(l_system_t *sys)
+{
+    unsigned begin = sys->frame_worlds.count;
+    unsigned level = 0;
+
+    unsigned worker_count = sys->thread_count ? sys->thread_count
+                                              : parallel_core_count();
+
+    dck_stretchy_reserve(sys->frame_worlds, sys->frames.count - begin);
+
+    while (begin < sys->frames.count) {
+        while (level < sys->frame_levels.count && sys->frame_levels.data[level] <= begin) {
+            ++level;
+        }
+
+        unsigned end = level < sys->frame_levels.count ? sys->frame_levels.data[level]
+                                                       : sys->frames.count;
+
+        l_resolve_job_t job = {
+            .sys = sys,
+            .begin = begin,
+            .end = end,
+            .worker_count = end - begin >= L_PARALLEL_MIN_SYMBOLS ? worker_count : 1,
+        };
+
+        parallel_run(resolve_worker, &job, job.worker_count);
+
+        begin = end;
+    }
+
+    sys->frame_worlds.count = sys->frames.count;
+}
+
+// NOTE: Forgets the frames from `count` on, with their levels.
+static void drop_frames(l_system_t *sys, unsigned count)
+{
+    if (sys->frames.count > count) {
+        sys->frames.count = count;
+    }
+
+    if (sys->frame_worlds.count > count) {
+        sys->frame_worlds.count = count;
+    }
+
+    while (sys->frame_levels.count > 0
+        && sys->frame_levels.data[sys->frame_levels.count - 1] >= count) {
+        --sys->frame_levels.count;
+    }
+}
+
+
+static char *build_symbol(l_system_t *sys, model_builder_t *builder,
+                          l_symbol_t sym, uint64_t counter)
+{
+    l_type_t type = sys->types.data[sym.type];
+
+    sys->eval_stack.random = counter;
+
+    // NOTE: The hierarchical frames are resolved by now.
+    bool inherits = sys->hierarchical && type.frame != L_NO_FRAME;
+
+    for (unsigned lid = 0; lid < type.load_count; ++lid) {
+        l_type_load_t load = sys->type_loads.data[type.load_index + lid];
+
+        if (inherits) {
+            unsigned frame = sys->values[sys->id].data[sym.data_index + type.frame].data.matrix;
+            affine_t world = sys->frame_worlds.data[frame];
+
+            if (load.local.count > 0) {
+                l_eval_res_t res = l_evaluate(sys, &sys->eval_stack, load.local, true, sym.type, sym.data_index);
+
+                if (res.error)
+                    return res.error;
+
+                world = affine_multiply(world, sys->eval_stack.matrices.data[0]);
+            }
+
+            model_builder_merge(builder, sys->resources.data[load.resource_index].model, world);
+            continue;
+        }
+
+        l_eval_res_t res = l_evaluate(sys, &sys->eval_stack, load.expr, true, sym.type, sym.data_index);
+
+        if (res.error)
+            return res.error;
+
+        assert(res.val.type == l_basic_Mat4);
+
+        model_builder_merge(builder,
+                            sys->resources.data[load.resource_index].model,
+                            sys->eval_stack.matrices.data[0]);
+    }
+
+    return NULL;
+}
+
+// NOTE: A frozen symbol reaches the last generation as it is, so its models
+//       can be built right away. Only the order of the geometry changes.
+static char *emit_frozen(l_system_t *sys)
+{
+    l_symbol_t *symbols = sys->symbols[sys->id].data;
+    unsigned count = 0;
+
+    uint64_t vertices = 0, indices = 0;
+
+    for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
+        if (symbols[i].frozen) {
+            predict_model(sys, symbols[i].type, &vertices, &indices);
+        }
+    }
+
+    char *error = check_model(sys, sys->emit, vertices, indices);
+    if (error)
+        return error;
+
+    if (!model_builder_reserve(sys->emit, (int)vertices, (int)indices))
+        return memory_error;
+
+    resolve_frames(sys);
+
+    for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
+        if (!symbols[i].frozen) {
+            symbols[count++] = symbols[i];
+            continue;
+        }
+
+        // NOTE: Stochastic systems have no frozen symbols, nothing draws here.
+        error = build_symbol(sys, sys->emit, symbols[i], 0);
+        if (error)
+            return error;
+    }
+
+    sys->symbols[sys->id].count = count;
+    return NULL;
+}
+
+
+char *l_system_update(l_system_t *sys)
+{
+    unsigned next_id = 1 - sys->id;
+
+    sys->values  [next_id].count = 0;
+    sys->matrices[next_id].count = 0;
+    sys->symbols [next_id].count = 0;
+
+    unsigned worker_count = sys->thread_count ? sys->thread_count
+                                              : parallel_core_count();
+
+    if (!runs_columns(sys)) {
+        char *error = l_system_flatten(sys);
+        if (error)
+            return error;
+    }
+
+    if (sys->hierarchical) {
+        dck_stretchy_push(sys->frame_levels, sys->frames.count);
+    }
+
+    char *error;
+
+    if (runs_columns(sys)) {
+        reserve_workers(sys, 1);
+        error = update_columns(sys, next_id);
+    }
+    else if (worker_count > 1 && sys->symbols[sys->id].count >= L_PARALLEL_MIN_SYMBOLS
+          && !sys->hierarchical) {
+        error = update_parallel(sys, next_id, worker_count);
+    }
+    else {
+        error = prepare_serial(sys, next_id);
+
+        if (!error && runs_batched(sys)) {
+            reserve_workers(sys, 1);
+            error = update_batch(sys, next_id);
+        }
+        else if (!error) {
+            error = update_serial(sys, next_id);
+        }
+    }
+
+    if (error)
+        return error;
+
+    if (!runs_columns(sys)) {
+        sys->fixed = all_frozen(sys->symbols[next_id].data, sys->symbols[next_id].count);
+    }
+
+    sys->id = next_id;
+
+    // NOTE: The column layout keeps no frozen symbols to emit.
+    if (sys->emit && !runs_columns(sys))
+        return emit_frozen(sys);
+
+    return NULL;
+}
+
+
+/* depth first derivation
+ *
+ * Every symbol is rewritten all the way down before its next sibling, so the
+ * leaves come out in the order of the last generation and go straight into
+ * `emit`. The pending successors wait on `pending` with their parameters on
+ * top of the current generation, only the successors of the ancestors of the
+ * symbol being rewritten are alive at any time. The memory grows with the
+ * depth times the fan-out of the rules rather than with the last generation.
+ * The spare generation holds the successors of one symbol at a time.
+ */
+
+#define L_MEMO_MIN_SLOTS 1024
+
+static bool uses_param(l_system_t *sys, l_expr_t expr, unsigned param)
+{
+    l_instruction_t *code = sys->instructions.data + expr.index;
+
+    for (unsigned i = 0; i < expr.count; ++i) {
+        if (code[i].id == l_inst_Param && (unsigned)code[i].op.data.integer == param)
+            return true;
+    }
+
+    return false;
+}
+
+// NOTE: The code starts with the parameter and only ever multiplies it from
+//       the right, `param * a * b` or `param * (a * b)`. The bottom of the
+//       stack is the parameter, nothing but such a product may take it.
+static bool is_carried(l_system_t *sys, l_expr_t expr, unsigned param)
+{
+    l_instruction_t *code = sys->instructions.data + expr.index;
+
+    if (expr.count == 0 || code[0].id != l_inst_Param || (unsigned)code[0].op.data.integer != param)
+        return false;
+
+    unsigned size = 1;
+
+    for (unsigned i = 1; i < expr.count; ++i) {
+        l_inst_id_t id = code[i].id;
+        unsigned eats = inst_eats[id];
+
+        if (is_jump(id) || id == l_inst_Store || id == l_inst_Load)
+            return false;
+
+        if (id == l_inst_Param && (unsigned)code[i].op.data.integer == param)
+            return false;
+
+        if (eats >= size && !(id == l_inst_MulM && size == 2))
+            return false;
+
+        size = size - eats + 1;
+    }
+
+    return size == 1;
+}
+
+// NOTE: Whether a symbol of the type can leave any geometry behind, either
+//       its own models or those of its successors.
+static bool emits_geometry(l_system_t *sys, unsigned type_id)
+{
+    l_type_t type = sys->types.data[type_id];
+
+    if (type.load_count > 0)
+        return true;
+
+    for (unsigned r = 0; r < type.rule_count; ++r) {
+        if (sys->rules.data[type.rule_index + r].right_size > 0)
+            return true;
+    }
+
+    return false;
+}
+
+static bool keeps_frame(l_system_t *sys, unsigned type_id)
+{
+    l_type_t type = sys->types.data[type_id];
+    unsigned frame = type.frame;
+
+    for (unsigned l = 0; l < type.load_count; ++l) {
+        if (!is_carried(sys, sys->type_loads.data[type.load_index + l].expr, frame))
+            return false;
+    }
+
+    for (unsigned r = 0; r < type.rule_count; ++r) {
+        l_rule_t rule = sys->rules.data[type.rule_index + r];
+
+        if (uses_param(sys, rule.left.predicate, frame))
+            return false;
+
+        for (unsigned ri = 0; ri < rule.right_size; ++ri) {
+            l_result_t result = sys->results.data[rule.right_index + ri];
+            l_type_t successor = sys->types.data[result.type];
+
+            // NOTE: Geometry of a successor without a frame is placed without
+            //       it too, moving it by the frame on a memo hit is wrong.
+            if (successor.frame == L_NO_FRAME && emits_geometry(sys, result.type))
+                return false;
+
+            for (unsigned p = 0; p < successor.params_count; ++p) {
+                l_expr_t param = sys->params.data[result.params_index + p];
+
+                bool fine = p == successor.frame ? is_carried(sys, param, frame)
+                                                 : !uses_param(sys, param, frame);
+                if (!fine)
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// NOTE: The frame of a type is its first matrix parameter if the models of
+//       the symbol and of all its descendants are placed by it from the left
+//       and nothing else depends on it. Two symbols that differ only in the
+//       frame then derive into the same geometry moved by the difference of
+//       the frames, which lets the memo leave the frame out of its keys.
+//       Successors without a frame that leave geometry take it away.
+//       Every type starts with a candidate and loses it as long as it breaks
+//       the rules of its own or those of a successor that lost its frame.
+void l_find_frames(l_system_t *sys)
+{
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        l_type_t *type = sys->types.data + t;
+        type->frame = L_NO_FRAME;
+
+        for (unsigned p = 0; p < type->params_count; ++p) {
+            if (sys->param_types.data[type->params_index + p] == l_basic_Mat4) {
+                type->frame = p;
+                break;
+            }
+        }
+    }
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (unsigned t = 0; t < sys->types.count; ++t) {
+            if (sys->types.data[t].frame != L_NO_FRAME && !keeps_frame(sys, t)) {
+                sys->types.data[t].frame = L_NO_FRAME;
+                changed = true;
+            }
+        }
+    }
+}
+
+// NOTE: Copies code carried by a frame without it. Dropping the parameter and
+//       the product that takes the bottom of the stack first leaves the
+//       product of the rest, the transform relative to the frame.
+static l_expr_t localize(l_system_t *sys, l_expr_t expr)
+{
+    if (expr.count == 1)
+        return (l_expr_t) {0};
+
+    unsigned index = sys->instructions.count;
+    unsigned size = 1;
+    bool dropped = false;
+
+    dck_stretchy_reserve(sys->instructions, expr.count);
+
+    for (unsigned i = 1; i < expr.count; ++i) {
+        l_instruction_t inst = sys->instructions.data[expr.index + i];
+
+        if (!dropped && inst.id == l_inst_MulM && size == 2) {
+            dropped = true;
+            size = 1;
+            continue;
+        }
+
+        size = size - inst_eats[inst.id] + 1;
+        sys->instructions.data[sys->instructions.count++] = inst;
+    }
+
+    return l_compile_code(sys, index, l_basic_Mat4);
+}
+
+void l_inherit_frames(l_system_t *sys)
+{
+    if (!sys->hierarchical)
+        return;
+
+    for (unsigned t = 0; t < sys->types.count; ++t) {
+        l_type_t type = sys->types.data[t];
+
+        if (type.frame == L_NO_FRAME)
+            continue;
+
+        for (unsigned l = 0; l < type.load_count; ++l) {
+            l_type_load_t *load = sys->type_loads.data + type.load_index + l;
+            load->local = localize(sys, load->expr);
+        }
+    }
+
+    for (unsigned r = 0; r < sys->rules.count; ++r) {
+        l_rule_t *rule = sys->rules.data + r;
+        unsigned frame = sys->types.data[rule->left.type].frame;
+
+        rule->frame_count = 0;
+
+        for (unsigned ri = 0; ri < rule->right_size; ++ri) {
+            l_result_t *result = sys->results.data + rule->right_index + ri;
+            l_type_t successor = sys->types.data[result->type];
+
+            if (successor.frame == L_NO_FRAME)
+                continue;
+
+            ++rule->frame_count;
+
+            if (frame != L_NO_FRAME) {
+                result->local = localize(sys, sys->params.data[result->params_index + successor.frame]);
+            }
+        }
+    }
+
+    /* the axiom */
+    dck_stretchy_push(sys->frame_levels, sys->frames.count);
+
+    for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
+        l_symbol_t symbol = sys->symbols[sys->id].data[i];
+        unsigned frame = sys->types.data[symbol.type].frame;
+
+        if (frame == L_NO_FRAME)
+            continue;
+
+        l_value_t *value = sys->values[sys->id].data + symbol.data_index + frame;
+
+        l_frame_t root = {
+            .parent = L_NO_FRAME,
+            .local = sys->matrices[sys->id].data[value->data.matrix],
+        };
+
+        value->data.matrix = sys->frames.count;
+        dck_stretchy_push(sys->frames, root);
+    }
+}
+
+// NOTE: The memo has to undo the frame, a singular one is never recorded.
+static bool invert_frame(affine_t frame, affine_t *inverse)
+{
+    if (!affine_inverse(frame, inverse))
+        return false;
+
+    affine_t product = affine_multiply(frame, *inverse);
+    affine_t identity = affine_identity();
+
+    for (int i = 0; i < 12; ++i) {
+        if (fabsf(product.data[i] - identity.data[i]) > 1e-4f)
+            return false;
+    }
+
+    return true;
+}
+
+// NOTE: FNV-1a like the cache key of the native code.
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t hash_value(uint64_t hash, l_value_t value, const affine_t *matrices)
+{
+    switch (value.type) {
+        case l_basic_Int:   return hash_bytes(hash, &value.data.integer,  sizeof(int));
+        case l_basic_Float: return hash_bytes(hash, &value.data.floating, sizeof(float));
+        case l_basic_Bool:  return hash_bytes(hash, &value.data.boolean,  sizeof(bool));
+        case l_basic_Mat4:  return hash_bytes(hash, matrices + value.data.matrix, sizeof(affine_t));
+
+        case L_BASIC_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+// NOTE: Matrices are compared by content, the keys keep them elsewhere.
+static bool same_param(l_value_t a, const affine_t *a_matrices,
+                       l_value_t b, const affine_t *b_matrices)
+{
+    if (a.type == l_basic_Mat4 && b.type == l_basic_Mat4)
+        return memcmp(a_matrices + a.data.matrix, b_matrices + b.data.matrix, sizeof(affine_t)) == 0;
+
+    return same_value(a, b);
+}
+
+static uint64_t memo_hash(l_system_t *sys, l_symbol_t symbol, unsigned depth)
+{
+    unsigned type = symbol.type;
+    unsigned params_count = sys->types.data[type].params_count;
+    unsigned frame = sys->types.data[type].frame;
+
+    l_value_t *values = sys->values[sys->id].data + symbol.data_index;
+    affine_t *matrices = sys->matrices[sys->id].data;
+
+    uint64_t hash = 14695981039346656037ull;
+    hash = hash_bytes(hash, &type,  sizeof(type));
+    hash = hash_bytes(hash, &depth, sizeof(depth));
+
+    for (unsigned p = 0; p < params_count; ++p) {
+        if (p != frame) {
+            hash = hash_value(hash, values[p], matrices);
+        }
+    }
+
+    return hash;
+}
+
+// NOTE: Returns the slot of the entry of the symbol or the empty slot for it.
+static unsigned *memo_find(l_system_t *sys, l_symbol_t symbol, unsigned depth, uint64_t hash)
+{
+    unsigned params_count = sys->types.data[symbol.type].params_count;
+    unsigned frame = sys->types.data[symbol.type].frame;
+
+    l_value_t *values = sys->values[sys->id].data + symbol.data_index;
+    affine_t *matrices = sys->matrices[sys->id].data;
+
+    unsigned mask = sys->memo_slots.count - 1;
+
+    for (unsigned i = hash & mask;; i = (i + 1) & mask) {
+        unsigned *slot = sys->memo_slots.data + i;
+
+        if (*slot == 0)
+            return slot;
+
+        l_memo_t memo = sys->memo.data[*slot - 1];
+
+        if (memo.hash != hash || memo.type != symbol.type || memo.depth != depth)
+            continue;
+
+        l_value_t *key = sys->memo_keys.data + memo.key_index;
+        unsigned p = 0;
+
+        while (p < params_count && (p == frame || same_param(values[p], matrices, key[p], sys->memo_matrices.data))) {
+            ++p;
+        }
+
+        if (p == params_count)
+            return slot;
+    }
 }
 
+static size_t memo_size(l_system_t *sys)
+{
+    return sys->memo.count          * sizeof(l_memo_t)
+         + sys->memo_slots.count    * sizeof(unsigned)
+         + sys->memo_keys.count     * sizeof(l_value_t)
+         + sys->memo_matrices.count * sizeof(affine_t);
+}
+
+static void memo_clear(l_system_t *sys)
+{
+    sys->memo.count = 0;
+    sys->memo_keys.count = 0;
+    sys->memo_matrices.count = 0;
+
+    sys->memo_hits = 0;
+    sys->memo_misses = 0;
+
+    if (sys->memo_budget == 0)
+        return;
+
+    sys->memo_slots.count = 0;
+    dck_stretchy_reserve(sys->memo_slots, L_MEMO_MIN_SLOTS);
+    sys->memo_slots.count = L_MEMO_MIN_SLOTS;
+
+    memset(sys->memo_slots.data, 0, sizeof(unsigned) * L_MEMO_MIN_SLOTS);
+}
+
+static void memo_grow(l_system_t *sys)
+{
+    unsigned slot_count = sys->memo_slots.count * 2;
+
+    sys->memo_slots.count = 0;
+    dck_stretchy_reserve(sys->memo_slots, slot_count);
+    sys->memo_slots.count = slot_count;
+
+    memset(sys->memo_slots.data, 0, sizeof(unsigned) * slot_count);
+
+    unsigned mask = slot_count - 1;
+
+    for (unsigned m = 0; m < sys->memo.count; ++m) {
+        unsigned i = sys->memo.data[m].hash & mask;
+
+        while (sys->memo_slots.data[i]) {
+            i = (i + 1) & mask;
+        }
+
+        sys->memo_slots.data[i] = m + 1;
+    }
+}
+
+// NOTE: Starts the entry of the symbol at the current end of `emit`, returns
+//       its index plus one or 0 when it does not fit into the budget.
+static unsigned memo_insert(l_system_t *sys, l_symbol_t symbol, unsigned depth, uint64_t hash)
+{
+    l_type_t type = sys->types.data[symbol.type];
+    l_value_t *values = sys->values[sys->id].data + symbol.data_index;
+
+    bool grows = (sys->memo.count + 1) * 2 > sys->memo_slots.count;
+
+    size_t size = memo_size(sys) + sizeof(l_memo_t)
+                + type.params_count * (sizeof(l_value_t) + sizeof(affine_t))
+                + (grows ? sys->memo_slots.count * sizeof(unsigned) : 0);
+
+    if (size > sys->memo_budget)
+        return 0;
+
+    unsigned inverse = L_NO_FRAME;
+
+    if (type.frame != L_NO_FRAME) {
+        affine_t frame = sys->matrices[sys->id].data[values[type.frame].data.matrix];
+        affine_t frame_inverse;
+
+        if (!invert_frame(frame, &frame_inverse))
+            return 0;
+
+        inverse = sys->memo_matrices.count;
+        dck_stretchy_push(sys->memo_matrices, frame_inverse);
+    }
+
+    if (grows) {
+        memo_grow(sys);
+    }
+
+    unsigned key_index = sys->memo_keys.count;
+    dck_stretchy_reserve(sys->memo_keys, type.params_count);
+
+    for (unsigned p = 0; p < type.params_count; ++p) {
+        l_value_t value = values[p];
+
+        // NOTE: The frame is not a part of the key, its place points to the inverse.
+        if (p == type.frame) {
+            value.data.matrix = inverse;
+        }
+        else if (value.type == l_basic_Mat4) {
+            dck_stretchy_push(sys->memo_matrices, sys->matrices[sys->id].data[value.data.matrix]);
+            value.data.matrix = sys->memo_matrices.count - 1;
+        }
+
+        sys->memo_keys.data[key_index + p] = value;
+    }
+
+    sys->memo_keys.count += type.params_count;
+
+    l_memo_t memo = {
+        .hash = hash,
+        .type = symbol.type,
+        .depth = depth,
+        .key_index = key_index,
+        .inverse = inverse,
+        .vertex_begin = sys->emit->data.vertex_count,
+        .index_begin  = sys->emit->data.index_count,
+    };
+
+    dck_stretchy_push(sys->memo, memo);
+
+    *memo_find(sys, symbol, depth, hash) = sys->memo.count;
+
+    return sys->memo.count;
+}
+
+
+static char *derive_depth_first(l_system_t *sys, unsigned generations)
+{
+    char *flatten_error = l_system_flatten(sys);
+    if (flatten_error)
+        return flatten_error;
+
+    unsigned id = sys->id;
+    unsigned spare_id = 1 - id;
+
+    sys->pending.count = 0;
+    dck_stretchy_reserve(sys->pending, sys->symbols[id].count);
+
+    for (unsigned i = sys->symbols[id].count; i-- > 0;) {
+        sys->pending.data[sys->pending.count++] = (l_pending_t) {
+            .symbol = sys->symbols[id].data[i],
+            .depth = generations,
+            .value_top = sys->values[id].count,
+            .matrix_top = sys->matrices[id].count,
+        };
+    }
+
+    sys->symbols[id].count = 0;
+
+    // NOTE: The symbols of every generation are taken in their order, so
+    //       counting them gives each its index for `l_random_counter`.
+    unsigned base = sys->random_generation;
+
+    sys->depth_indices.count = 0;
+    dck_stretchy_reserve(sys->depth_indices, generations + 1);
+    memset(sys->depth_indices.data, 0, sizeof(unsigned) * (generations + 1));
+
+    memo_clear(sys);
+
+    while (sys->pending.count > 0) {
+        l_pending_t pending = sys->pending.data[--sys->pending.count];
+
+        sys->values  [id].count = pending.value_top;
+        sys->matrices[id].count = pending.matrix_top;
+
+        if (pending.memo) {
+            l_memo_t *memo = sys->memo.data + pending.memo - 1;
+
+            memo->vertex_end = sys->emit->data.vertex_count;
+            memo->index_end  = sys->emit->data.index_count;
+            memo->complete = true;
+            continue;
+        }
+
+        uint64_t counter = l_random_counter(base + generations - pending.depth,
+                                            sys->depth_indices.data[pending.depth]++);
+
+        // NOTE: A frozen symbol is already what it will be at the end.
+        if (pending.depth == 0 || pending.symbol.frozen) {
+            uint64_t vertices = 0, indices = 0;
+            predict_model(sys, pending.symbol.type, &vertices, &indices);
+
+            char *error = check_model(sys, sys->emit, vertices, indices);
+            if (error)
+                return error;
+
+            error = build_symbol(sys, sys->emit, pending.symbol, counter);
+            if (error)
+                return error;
 
-void l_system_add_rule(l_system_t *sys,
-                       l_match_t left,
-                       unsigned *right_types,
-                       l_expr_t *params,
-                       int right_size)
-{
-    unsigned acc_param_count = 0;
+            continue;
+        }
 
-    for (int i = 0; i < right_size; ++i) {
-        unsigned type = right_types[i];
-        acc_param_count += sys->types.data[type].params_count;
-    }
+        unsigned memo_index = 0;
 
-    dck_stretchy_reserve(sys->params, acc_param_count);
-    dck_stretchy_reserve(sys->results, right_size);
+        // NOTE: A repeated subtree would repeat the draws of the first one.
+        if (sys->memo_budget && !sys->stochastic) {
+            uint64_t hash = memo_hash(sys, pending.symbol, pending.depth);
+            unsigned slot = *memo_find(sys, pending.symbol, pending.depth, hash);
 
-    unsigned right_index = sys->results.count;
-    unsigned param_pos = 0;
+            if (slot && sys->memo.data[slot - 1].complete) {
+                l_memo_t memo = sys->memo.data[slot - 1];
 
-    for (int ri = 0; ri < right_size; ++ri) {
-        unsigned type = right_types[ri];
-        unsigned params_count = sys->types.data[type].params_count;
-        unsigned params_index = sys->params.count;
+                char *error = check_model(sys, sys->emit, memo.vertex_end - memo.vertex_begin,
+                                                          memo.index_end  - memo.index_begin);
+                if (error)
+                    return error;
 
-        for (unsigned pi = 0; pi < params_count; ++pi) {
-            sys->params.data[params_index + pi] = params[param_pos + pi];
-        }
+                if (memo.inverse == L_NO_FRAME) {
+                    model_builder_repeat(sys->emit, memo.vertex_begin, memo.vertex_end,
+                                                    memo.index_begin,  memo.index_end);
+                }
+                else {
+                    l_value_t frame = sys->values[id].data[pending.symbol.data_index + sys->types.data[pending.symbol.type].frame];
 
-        sys->params.count += params_count;
+                    affine_t transform = affine_multiply(sys->matrices[id].data[frame.data.matrix],
+                                                         sys->memo_matrices.data[memo.inverse]);
 
+                    model_builder_repeat_transformed(sys->emit, memo.vertex_begin, memo.vertex_end,
+                                                                memo.index_begin,  memo.index_end,
+                                                                transform);
+                }
 
-        sys->results.data[right_index + ri] = (l_result_t) {
-            .type = type,
-            .params_index = params_index,
-        };
+                ++sys->memo_hits;
+                continue;
+            }
 
-        param_pos += params_count;
-    }
+            ++sys->memo_misses;
 
-    sys->results.count += right_size;
+            if (!slot) {
+                memo_index = memo_insert(sys, pending.symbol, pending.depth, hash);
+            }
+        }
 
+        sys->symbols[spare_id].count = 0;
 
-    l_rule_t rule = {
-        .left = left,
-        .right_index = right_index,
-        .right_size = right_size,
-    };
+        char *error = rewrite_symbol(sys, pending.symbol, counter, id, spare_id);
+        if (error)
+            return error;
 
-    dck_stretchy_push(sys->rules, rule);
+        unsigned successor_count = sys->symbols[spare_id].count;
+        dck_stretchy_reserve(sys->pending, successor_count + 1);
+
+        // NOTE: Taken once the geometry of all the successors is there.
+        if (memo_index) {
+            sys->pending.data[sys->pending.count++] = (l_pending_t) {
+                .value_top = pending.value_top,
+                .matrix_top = pending.matrix_top,
+                .memo = memo_index,
+            };
+        }
+
+        for (unsigned i = successor_count; i-- > 0;) {
+            sys->pending.data[sys->pending.count++] = (l_pending_t) {
+                .symbol = sys->symbols[spare_id].data[i],
+                .depth = pending.depth - 1,
+                .value_top = sys->values[id].count,
+                .matrix_top = sys->matrices[id].count,
+            };
+        }
+    }
+
+    sys->symbols[spare_id].count = 0;
+    sys->values  [id].count = 0;
+    sys->matrices[id].count = 0;
+
+    sys->advanced = generations;
+    sys->random_generation = base + generations;
+    return NULL;
 }
 
 
-void l_system_append(l_system_t *sys, unsigned type, l_value_t *params)
+char *l_system_advance(l_system_t *sys, unsigned generations)
 {
-    unsigned param_count = sys->types.data[type].params_count;
-    unsigned data_index = sys->values[sys->id].count;
+    unsigned step = sys->composed_generations;
 
-    dck_stretchy_reserve(sys->values[sys->id], param_count);
+    sys->advanced = 0;
 
-    for (unsigned i = 0; i < param_count; ++i) {
-        sys->values[sys->id].data[data_index + i] = params[i];
+    // NOTE: The depth first derivation carries whole frames.
+    if (sys->depth_first && sys->emit && !sys->hierarchical)
+        return derive_depth_first(sys, generations);
+
+    // NOTE: Past a fixed point every generation is the same.
+    while (generations > 0 && !sys->fixed) {
+        bool composed = step > 1 && generations >= step;
+
+        if (composed) {
+            swap_composed_types(sys);
+        }
+
+        char *error = l_system_update(sys);
+
+        if (composed) {
+            swap_composed_types(sys);
+        }
+
+        if (error)
+            return error;
+
+        generations   -= composed ? step : 1;
+        sys->advanced += composed ? step : 1;
+
+        sys->random_generation += composed ? step : 1;
     }
 
-    sys->values[sys->id].count += param_count;
+    return NULL;
+}
 
 
-    l_symbol_t symbol = {
-        .type = type,
-        .data_index = data_index,
-    };
+/* generation history */
 
-    dck_stretchy_push(sys->symbols[sys->id], symbol);
+static size_t snapshot_size(l_snapshot_t snapshot)
+{
+    return sizeof(l_snapshot_t)
+         + snapshot.symbol_count * sizeof(l_symbol_t)
+         + snapshot.value_count  * sizeof(l_value_t)
+         + snapshot.matrix_count * sizeof(affine_t);
 }
 
+static size_t history_size(l_system_t *sys)
+{
+    return sys->history.count          * sizeof(l_snapshot_t)
+         + sys->history_symbols.count  * sizeof(l_symbol_t)
+         + sys->history_values.count   * sizeof(l_value_t)
+         + sys->history_matrices.count * sizeof(affine_t);
+}
 
-char *l_system_update(l_system_t *sys)
+// NOTE: Drops the oldest snapshot after the axiom.
+static void forget_snapshot(l_system_t *sys)
 {
-    unsigned next_id = 1 - sys->id;
+    assert(sys->history.count > 1);
+
+    l_snapshot_t *history = sys->history.data;
+    l_snapshot_t gone = history[1];
+
+    memmove(sys->history_symbols.data + gone.symbol_index,
+            sys->history_symbols.data + gone.symbol_index + gone.symbol_count,
+            (sys->history_symbols.count - gone.symbol_index - gone.symbol_count) * sizeof(l_symbol_t));
+    memmove(sys->history_values.data + gone.value_index,
+            sys->history_values.data + gone.value_index + gone.value_count,
+            (sys->history_values.count - gone.value_index - gone.value_count) * sizeof(l_value_t));
+    memmove(sys->history_matrices.data + gone.matrix_index,
+            sys->history_matrices.data + gone.matrix_index + gone.matrix_count,
+            (sys->history_matrices.count - gone.matrix_index - gone.matrix_count) * sizeof(affine_t));
+
+    sys->history_symbols.count  -= gone.symbol_count;
+    sys->history_values.count   -= gone.value_count;
+    sys->history_matrices.count -= gone.matrix_count;
+
+    for (unsigned i = 2; i < sys->history.count; ++i) {
+        history[i].symbol_index -= gone.symbol_count;
+        history[i].value_index  -= gone.value_count;
+        history[i].matrix_index -= gone.matrix_count;
+        history[i - 1] = history[i];
+    }
 
-    sys->values [next_id].count = 0;
-    sys->symbols[next_id].count = 0;
+    --sys->history.count;
+}
 
-    for (unsigned sym_id = 0; sym_id < sys->symbols[sys->id].count; ++sym_id) {
-        l_symbol_t symbol = sys->symbols[sys->id].data[sym_id];
+// NOTE: Keeps the current generation unless it is kept already or does not
+//       fit. The axiom is kept whatever its size.
+static char *record_generation(l_system_t *sys)
+{
+    if (sys->generation == L_NO_GENERATION)
+        return NULL;
 
-        for (unsigned rule_id = 0; rule_id < sys->rules.count; ++rule_id) {
-            l_rule_t rule = sys->rules.data[rule_id];
+    char *error = l_system_flatten(sys);
+    if (error)
+        return error;
 
-            if (rule.left.type != symbol.type)
-                continue;
+    for (unsigned i = 0; i < sys->history.count; ++i) {
+        if (sys->history.data[i].generation == sys->generation)
+            return NULL;
+    }
 
-            l_eval_res_t res = l_evaluate(sys,
-                                          rule.left.predicate,
-                                          true,
-                                          rule.left.type,
-                                          symbol.data_index,
-                                          true);
+    unsigned id = sys->id;
 
-            if (res.error)
-                return res.error;
+    l_snapshot_t snapshot = {
+        .generation   = sys->generation,
+        .fixed        = sys->fixed,
+        .symbol_count = sys->symbols [id].count,
+        .value_count  = sys->values  [id].count,
+        .matrix_count = sys->matrices[id].count,
+        .frame_count  = sys->frames.count,
+    };
 
-            assert(res.val.type == l_basic_Bool);
+    if (sys->history.count > 0) {
+        size_t size = snapshot_size(snapshot);
 
-            if (!res.val.data.boolean)
-                continue;
+        if (size > sys->history_budget)
+            return NULL;
 
-            unsigned acc_param_count = 0;
+        while (history_size(sys) + size > sys->history_budget && sys->history.count > 1) {
+            forget_snapshot(sys);
+        }
+    }
 
-            for (unsigned i = 0; i < rule.right_size; ++i) {
-                l_type_t type = sys->types.data[sys->results.data[rule.right_index + i].type];
-                acc_param_count += type.params_count;
-            }
+    unsigned at = sys->history.count;
 
-            dck_stretchy_reserve(sys->values [next_id], acc_param_count);
-            dck_stretchy_reserve(sys->symbols[next_id], rule.right_size);
+    while (at > 0 && sys->history.data[at - 1].generation > sys->generation) {
+        --at;
+    }
 
-            unsigned symbol_index = sys->symbols[next_id].count;
+    // NOTE: Snapshots are copied in order, a later one moves up to make room.
+    l_snapshot_t *next = at < sys->history.count ? sys->history.data + at : NULL;
+
+    snapshot.symbol_index = next ? next->symbol_index : sys->history_symbols.count;
+    snapshot.value_index  = next ? next->value_index  : sys->history_values.count;
+    snapshot.matrix_index = next ? next->matrix_index : sys->history_matrices.count;
+
+    dck_stretchy_reserve(sys->history_symbols,  snapshot.symbol_count);
+    dck_stretchy_reserve(sys->history_values,   snapshot.value_count);
+    dck_stretchy_reserve(sys->history_matrices, snapshot.matrix_count);
+
+    memmove(sys->history_symbols.data + snapshot.symbol_index + snapshot.symbol_count,
+            sys->history_symbols.data + snapshot.symbol_index,
+            (sys->history_symbols.count - snapshot.symbol_index) * sizeof(l_symbol_t));
+    memmove(sys->history_values.data + snapshot.value_index + snapshot.value_count,
+            sys->history_values.data + snapshot.value_index,
+            (sys->history_values.count - snapshot.value_index) * sizeof(l_value_t));
+    memmove(sys->history_matrices.data + snapshot.matrix_index + snapshot.matrix_count,
+            sys->history_matrices.data + snapshot.matrix_index,
+            (sys->history_matrices.count - snapshot.matrix_index) * sizeof(affine_t));
+
+    memcpy(sys->history_symbols.data + snapshot.symbol_index, sys->symbols[id].data,
+           snapshot.symbol_count * sizeof(l_symbol_t));
+    memcpy(sys->history_values.data + snapshot.value_index, sys->values[id].data,
+           snapshot.value_count * sizeof(l_value_t));
+    memcpy(sys->history_matrices.data + snapshot.matrix_index, sys->matrices[id].data,
+           snapshot.matrix_count * sizeof(affine_t));
+
+    sys->history_symbols.count  += snapshot.symbol_count;
+    sys->history_values.count   += snapshot.value_count;
+    sys->history_matrices.count += snapshot.matrix_count;
+
+    dck_stretchy_reserve(sys->history, 1);
+    memmove(sys->history.data + at + 1, sys->history.data + at,
+            (sys->history.count - at) * sizeof(l_snapshot_t));
+
+    for (unsigned i = at + 1; i <= sys->history.count; ++i) {
+        sys->history.data[i].symbol_index += snapshot.symbol_count;
+        sys->history.data[i].value_index  += snapshot.value_count;
+        sys->history.data[i].matrix_index += snapshot.matrix_count;
+    }
 
-            for (unsigned ri = 0; ri < rule.right_size; ++ri) {
-                unsigned data_index = sys->values[next_id].count;
+    sys->history.data[at] = snapshot;
+    ++sys->history.count;
 
-                l_result_t result = sys->results.data[rule.right_index + ri];
+    return NULL;
+}
 
-                l_type_t type = sys->types.data[result.type];
-                l_basic_t *param_types = sys->param_types.data + type.params_index;
+static char *restore_generation(l_system_t *sys, l_snapshot_t snapshot)
+{
+    unsigned id = sys->id;
+
+    sys->symbols [id].count = 0;
+    sys->values  [id].count = 0;
+    sys->matrices[id].count = 0;
+
+    char *error = reserve_generation(sys, id, (l_output_t) {
+        .symbols  = snapshot.symbol_count,
+        .values   = snapshot.value_count,
+        .matrices = snapshot.matrix_count,
+    });
+
+    // NOTE: The generation is gone, the next seek restores from the history.
+    if (error) {
+        sys->generation = L_NO_GENERATION;
+        return error;
+    }
 
-                for (unsigned pi = 0; pi < type.params_count; ++pi) {
-                    l_eval_res_t ret = l_evaluate(sys,
-                                                  sys->params.data[result.params_index + pi],
-                                                  true,
-                                                  result.type,
-                                                  symbol.data_index,
-                                                  true);
+    memcpy(sys->symbols[id].data, sys->history_symbols.data + snapshot.symbol_index,
+           snapshot.symbol_count * sizeof(l_symbol_t));
+    memcpy(sys->values[id].data, sys->history_values.data + snapshot.value_index,
+           snapshot.value_count * sizeof(l_value_t));
+    memcpy(sys->matrices[id].data, sys->history_matrices.data + snapshot.matrix_index,
+           snapshot.matrix_count * sizeof(affine_t));
+
+    sys->symbols [id].count = snapshot.symbol_count;
+    sys->values  [id].count = snapshot.value_count;
+    sys->matrices[id].count = snapshot.matrix_count;
+
+    sys->columnar = false;
+    sys->fixed = snapshot.fixed;
+    sys->generation = snapshot.generation;
+    sys->random_generation = snapshot.generation;
+
+    // NOTE: Only the generation that is left behind may point past the
+    //       frames of every snapshot.
+    unsigned frame_count = 0;
+
+    for (unsigned i = 0; i < sys->history.count; ++i) {
+        if (frame_count < sys->history.data[i].frame_count) {
+            frame_count = sys->history.data[i].frame_count;
+        }
+    }
 
-                    if (ret.error)
-                        return ret.error;
+    drop_frames(sys, frame_count);
+    return NULL;
+}
 
-                    assert(ret.val.type == param_types[pi]);
+// NOTE: Only the current generation is left, the pages of the bigger ones
+//       that were there go back to the system.
+static void trim_generations(l_system_t *sys)
+{
+    unsigned spare_id = 1 - sys->id;
 
-                    sys->values[next_id].data[data_index + pi] = ret.val;
-                }
+    sys->symbols [spare_id].count = 0;
+    sys->values  [spare_id].count = 0;
+    sys->matrices[spare_id].count = 0;
 
-                sys->values[next_id].count += type.params_count;
+    for (unsigned i = 0; i < 2; ++i) {
+        dck_arena_trim(sys->symbols [i]);
+        dck_arena_trim(sys->values  [i]);
+        dck_arena_trim(sys->matrices[i]);
+    }
+}
 
-                sys->symbols[next_id].data[symbol_index] = (l_symbol_t) {
-                    .type = result.type,
-                    .data_index = data_index
-                };
+char *l_system_seek(l_system_t *sys, unsigned generation)
+{
+    char *error;
 
-                ++symbol_index;
-            }
+    // NOTE: The first call finds the axiom.
+    if (sys->history.count == 0) {
+        error = record_generation(sys);
+        if (error)
+            return error;
+    }
+
+    // NOTE: With `emit` the generations lose their symbols to the model as
+    //       they go, only the axiom is whole.
+    if (sys->emit || sys->generation == L_NO_GENERATION || sys->generation > generation) {
+        error = record_generation(sys);
+        if (error)
+            return error;
+
+        unsigned at = 0;
 
-            sys->symbols[next_id].count += rule.right_size;
+        while (!sys->emit && at + 1 < sys->history.count
+            && sys->history.data[at + 1].generation <= generation) {
+            ++at;
         }
+
+        error = restore_generation(sys, sys->history.data[at]);
+        if (error)
+            return error;
+
+        trim_generations(sys);
+    }
+    else if (sys->generation < generation) {
+        error = record_generation(sys);
+        if (error)
+            return error;
     }
 
-    sys->id = next_id;
-    return NULL;
-}
+    unsigned start = sys->generation;
+
+    error = l_system_advance(sys, generation - start);
+
+    sys->generation = error || sys->emit ? L_NO_GENERATION : start + sys->advanced;
+    sys->advanced += start;
 
+    return error;
+}
 
 void l_system_print(l_system_t *sys)
 {
+    if (l_system_flatten(sys))
+        return;
+
     for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
         l_symbol_t sym = sys->symbols[sys->id].data[i];
 
@@ -268,12 +4920,17 @@ void l_system_print(l_system_t *sys)
 }
 
 
-// NOTE: `compute` flag determines if we also compute the values or not.
+// NOTE: Generic checked instructions, the parser uses this for type checking.
+//       See `l_evaluate` for the statically typed ones.
+//
+//       `compute` flag determines if we also compute the values or not.
 //       If `compute` is 'false', only the `type` attribute is valid.
 //       If it is 'true' the `data` is valid as well.
 //
 //       This is useful for example to avoid divide by zero on integer values
 //       when doing type checking.
+//
+//       Matrices live outside of values, so matrix results never carry data.
 l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
                                     l_value_t *params, unsigned param_count,
                                     l_value_t *data_top, unsigned data_size,
@@ -389,10 +5046,6 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
 
                 l_value_t res = { .type = l_basic_Mat4 };
 
-                if (compute) {
-                    res.data.matrix = matrix_multiply(a.data.matrix, b.data.matrix);
-                }
-
                 return (l_eval_res_t) { res, 2 };
             }
 
@@ -614,6 +5267,29 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
             return (l_eval_res_t) { res, 1 };
         } break;
 
+        case l_inst_Select:
+        {
+            assert(data_size >= 3);
+
+            l_value_t c = data_top[-2];
+            l_value_t a = data_top[-1];
+            l_value_t b = data_top[ 0];
+
+            if (c.type != l_basic_Bool)
+                return (l_eval_res_t) { .error = "Condition of select has to be a boolean!" };
+
+            if (a.type != b.type)
+                return (l_eval_res_t) { .error = "Branches of select have to be of the same type!" };
+
+            l_value_t res = { .type = a.type };
+
+            if (compute) {
+                res = c.data.boolean ? a : b;
+            }
+
+            return (l_eval_res_t) { res, 3 };
+        } break;
+
         case l_inst_CastInt:   /* fallthrough */
         case l_inst_CastFloat: /* fallthrough */
         case l_inst_CastBool:
@@ -667,24 +5343,6 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
 
             l_value_t res = { .type = l_basic_Mat4 };
 
-            if (compute) {
-                if (inst.id == l_inst_Position) {
-                    res.data.matrix = matrix_translation(x.data.floating,
-                                                         y.data.floating,
-                                                         z.data.floating);
-                }
-                else if (inst.id == l_inst_Stretch) {
-                    res.data.matrix = matrix_scale(x.data.floating,
-                                                   y.data.floating,
-                                                   z.data.floating);
-                }
-                else {
-                    res.data.matrix = matrix_multiply(matrix_rotation_z(z.data.floating),
-                                          matrix_multiply(matrix_rotation_y(y.data.floating),
-                                              matrix_rotation_x(x.data.floating)));
-                }
-            }
-
             return (l_eval_res_t) { res, 3 };
         } break;
 
@@ -698,11 +5356,39 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
 
             l_value_t res = { .type = l_basic_Mat4 };
 
+            return (l_eval_res_t) { res, 1 };
+        } break;
+
+        case l_inst_Sin:   /* fallthrough */
+        case l_inst_Cos:   /* fallthrough */
+        case l_inst_Sqrt:  /* fallthrough */
+        case l_inst_Pow:   /* fallthrough */
+        case l_inst_Min:   /* fallthrough */
+        case l_inst_Max:   /* fallthrough */
+        case l_inst_Lerp:  /* fallthrough */
+        case l_inst_Clamp:
+        {
+            unsigned eats = inst_eats[inst.id];
+            assert(data_size >= eats);
+
+            l_value_t *args = data_top - (eats - 1);
+
+            for (unsigned i = 0; i < eats; ++i) {
+                if (args[i].type != l_basic_Float)
+                    return (l_eval_res_t) { .error = "Math functions can take only float values!" };
+            }
+
+            l_value_t res = { .type = l_basic_Float };
+
             if (compute) {
-                res.data.matrix = matrix_scale(x.data.floating, x.data.floating, x.data.floating);
+                float a = args[0].data.floating;
+                float b = eats > 1 ? args[1].data.floating : 0.0f;
+                float c = eats > 2 ? args[2].data.floating : 0.0f;
+
+                res.data.floating = l_math(inst.id, false, a, b, c);
             }
 
-            return (l_eval_res_t) { res, 1 };
+            return (l_eval_res_t) { res, eats };
         } break;
 
         case l_inst_Noop: {
@@ -713,6 +5399,10 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
             return (l_eval_res_t) { a, 1 };
         } break;
 
+        case l_inst_Random: {
+            return (l_eval_res_t) { .val.type = l_basic_Float };
+        } break;
+
         default: {
             return (l_eval_res_t) { .error = "Unimplemented instruction!" };
         }
@@ -720,68 +5410,654 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
 }
 
 
-l_eval_res_t l_evaluate(l_system_t *sys,
-                        l_expr_t expr,
-                        bool has_params,
-                        unsigned type_index,
-                        unsigned data_index,
-                        bool compute)
+/* register machine
+ *
+ * With GCC and Clang the handlers jump straight to each other through
+ * a label table (direct threading), elsewhere it's a plain switch loop.
+ */
+#ifdef __GNUC__
+    #define L_THREADED_DISPATCH
+#endif
+
+static_assert(L_INST_COUNT <= 256, "instruction ids must fit into `l_reg_inst_t.op`");
+
+#ifdef L_THREADED_DISPATCH
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+
+    #define REG_CASE(name) op_##name
+    #define REG_NEXT       goto *labels[(++ip)->op]
+#else
+    #define REG_CASE(name) case l_inst_##name
+    #define REG_NEXT       ++ip; continue
+#endif
+
+#define OPERAND(x) (base[(x) >> L_OPERAND_SHIFT] + ((x) & L_OPERAND_MASK))
+
+// NOTE: Matrix operands are either registers or parameters, constant matrices
+//       are first copied into a register by `l_inst_Matrix`.
+#define MATRIX(x) ((x) >> L_OPERAND_SHIFT == l_operand_Register ? mats + ((x) & L_OPERAND_MASK)  \
+                                                                : pool + OPERAND(x)->data.matrix)
+
+#define REG_BINARY(field, res_field, op)                                                    \
+do {                                                                                        \
+    regs[ip->dst].data.res_field = OPERAND(ip->a)->data.field op OPERAND(ip->b)->data.field; \
+} while (0)
+
+// NOTE: The builtins taking fewer arguments never read the operands they lack.
+#define REG_MATH(id)                                                                        \
+do {                                                                                        \
+    float b = inst_eats[id] > 1 ? OPERAND(ip->b)->data.floating : 0.0f;                     \
+    float c = inst_eats[id] > 2 ? OPERAND(ip->c)->data.floating : 0.0f;                     \
+                                                                                            \
+    regs[ip->dst].data.floating = l_math(id, sys->exact_math,                               \
+                                         OPERAND(ip->a)->data.floating, b, c);              \
+} while (0)
+
+static l_eval_res_t evaluate_registers(l_system_t *sys, l_stack_t *stack,
+                                       l_expr_t expr, l_value_t *params)
 {
-    l_value_t *params = sys->values[sys->id].data + data_index;
-    l_instruction_t *code = sys->instructions.data + expr.index;
+    dck_stretchy_reserve(stack->values,   expr.depth);
+    dck_stretchy_reserve(stack->matrices, expr.depth);
+
+    l_value_t *regs = stack->values.data;
+    affine_t  *mats = stack->matrices.data;
+    affine_t  *pool = sys->matrices[sys->id].data;
+
+    l_value_t *base[L_OPERAND_COUNT] = {
+        [l_operand_Register] = regs,
+        [l_operand_Param]    = params,
+        [l_operand_Const]    = sys->reg_consts.data + expr.const_index,
+    };
+
+    l_reg_inst_t *ip = sys->reg_code.data + expr.reg_index;
+
+#ifdef L_THREADED_DISPATCH
+    static void *labels[L_INST_COUNT] = {
+        [l_inst_AddI] = &&op_AddI, [l_inst_AddF] = &&op_AddF,
+        [l_inst_SubI] = &&op_SubI, [l_inst_SubF] = &&op_SubF,
+        [l_inst_MulI] = &&op_MulI, [l_inst_MulF] = &&op_MulF, [l_inst_MulM] = &&op_MulM,
+        [l_inst_DivI] = &&op_DivI, [l_inst_DivF] = &&op_DivF,
+        [l_inst_ModI] = &&op_ModI,
+        [l_inst_NegI] = &&op_NegI, [l_inst_NegF] = &&op_NegF,
+
+        [l_inst_LessI]     = &&op_LessI,     [l_inst_LessF]     = &&op_LessF,
+        [l_inst_MoreI]     = &&op_MoreI,     [l_inst_MoreF]     = &&op_MoreF,
+        [l_inst_LessEqI]   = &&op_LessEqI,   [l_inst_LessEqF]   = &&op_LessEqF,
+        [l_inst_MoreEqI]   = &&op_MoreEqI,   [l_inst_MoreEqF]   = &&op_MoreEqF,
+        [l_inst_EqualI]    = &&op_EqualI,    [l_inst_EqualF]    = &&op_EqualF,
+        [l_inst_NotEqualI] = &&op_NotEqualI, [l_inst_NotEqualF] = &&op_NotEqualF,
+
+        [l_inst_And] = &&op_And, [l_inst_Or] = &&op_Or, [l_inst_Not] = &&op_Not,
+        [l_inst_AndJump] = &&op_AndJump, [l_inst_OrJump] = &&op_OrJump,
+        [l_inst_Noop] = &&op_Noop,
+
+        [l_inst_IntToFloat]  = &&op_IntToFloat,
+        [l_inst_FloatToInt]  = &&op_FloatToInt,
+        [l_inst_BoolToInt]   = &&op_BoolToInt,
+        [l_inst_BoolToFloat] = &&op_BoolToFloat,
+        [l_inst_IntToBool]   = &&op_IntToBool,
+        [l_inst_FloatToBool] = &&op_FloatToBool,
+
+        [l_inst_Rotation] = &&op_Rotation,
+        [l_inst_Stretch]  = &&op_Stretch,
+        [l_inst_Position] = &&op_Position,
+        [l_inst_Scale]    = &&op_Scale,
+        [l_inst_Matrix]   = &&op_Matrix,
+
+        [l_inst_Sin]  = &&op_Sin,  [l_inst_Cos]   = &&op_Cos,   [l_inst_Sqrt] = &&op_Sqrt,
+        [l_inst_Pow]  = &&op_Pow,  [l_inst_Min]   = &&op_Min,   [l_inst_Max]  = &&op_Max,
+        [l_inst_Lerp] = &&op_Lerp, [l_inst_Clamp] = &&op_Clamp,
+
+        [l_inst_Return] = &&op_Return,
+    };
 
-    unsigned param_count = 0;
+    goto *labels[ip->op];
+#else
+    for (;;) switch (ip->op) {
+#endif
+
+    REG_CASE(AddI): REG_BINARY(integer,  integer,  +); REG_NEXT;
+    REG_CASE(AddF): REG_BINARY(floating, floating, +); REG_NEXT;
+    REG_CASE(SubI): REG_BINARY(integer,  integer,  -); REG_NEXT;
+    REG_CASE(SubF): REG_BINARY(floating, floating, -); REG_NEXT;
+    REG_CASE(MulI): REG_BINARY(integer,  integer,  *); REG_NEXT;
+    REG_CASE(MulF): REG_BINARY(floating, floating, *); REG_NEXT;
+    REG_CASE(DivF): REG_BINARY(floating, floating, /); REG_NEXT;
+
+    REG_CASE(MulM):
+        mats[ip->dst] = affine_multiply(*MATRIX(ip->a), *MATRIX(ip->b));
+        REG_NEXT;
+
+    REG_CASE(DivI):
+        if (OPERAND(ip->b)->data.integer == 0)
+            return (l_eval_res_t) { .error = "Division by zero!" };
+
+        REG_BINARY(integer, integer, /);
+        REG_NEXT;
+
+    REG_CASE(ModI):
+        if (OPERAND(ip->b)->data.integer == 0)
+            return (l_eval_res_t) { .error = "Modulo by zero!" };
+
+        REG_BINARY(integer, integer, %);
+        REG_NEXT;
+
+    REG_CASE(NegI): regs[ip->dst].data.integer  = -OPERAND(ip->a)->data.integer;  REG_NEXT;
+    REG_CASE(NegF): regs[ip->dst].data.floating = -OPERAND(ip->a)->data.floating; REG_NEXT;
+
+    REG_CASE(LessI):     REG_BINARY(integer,  boolean, < ); REG_NEXT;
+    REG_CASE(LessF):     REG_BINARY(floating, boolean, < ); REG_NEXT;
+    REG_CASE(MoreI):     REG_BINARY(integer,  boolean, > ); REG_NEXT;
+    REG_CASE(MoreF):     REG_BINARY(floating, boolean, > ); REG_NEXT;
+    REG_CASE(LessEqI):   REG_BINARY(integer,  boolean, <=); REG_NEXT;
+    REG_CASE(LessEqF):   REG_BINARY(floating, boolean, <=); REG_NEXT;
+    REG_CASE(MoreEqI):   REG_BINARY(integer,  boolean, >=); REG_NEXT;
+    REG_CASE(MoreEqF):   REG_BINARY(floating, boolean, >=); REG_NEXT;
+    REG_CASE(EqualI):    REG_BINARY(integer,  boolean, ==); REG_NEXT;
+    REG_CASE(EqualF):    REG_BINARY(floating, boolean, ==); REG_NEXT;
+    REG_CASE(NotEqualI): REG_BINARY(integer,  boolean, !=); REG_NEXT;
+    REG_CASE(NotEqualF): REG_BINARY(floating, boolean, !=); REG_NEXT;
+
+    REG_CASE(And): REG_BINARY(boolean, boolean, &&); REG_NEXT;
+    REG_CASE(Or):  REG_BINARY(boolean, boolean, ||); REG_NEXT;
+    REG_CASE(Not): regs[ip->dst].data.boolean = !OPERAND(ip->a)->data.boolean; REG_NEXT;
+
+    // NOTE: The jumps keep their operand in `dst` and skip `b` instructions.
+    REG_CASE(AndJump):
+        regs[ip->dst].data.boolean = OPERAND(ip->a)->data.boolean;
+
+        if (!regs[ip->dst].data.boolean) {
+            ip += ip->b - 1;
+        }
+        REG_NEXT;
+
+    REG_CASE(OrJump):
+        regs[ip->dst].data.boolean = OPERAND(ip->a)->data.boolean;
+
+        if (regs[ip->dst].data.boolean) {
+            ip += ip->b - 1;
+        }
+        REG_NEXT;
+
+    REG_CASE(Noop): regs[ip->dst] = *OPERAND(ip->a); REG_NEXT;
+
+    REG_CASE(IntToFloat):
+        regs[ip->dst].data.floating = (float)OPERAND(ip->a)->data.integer;
+        REG_NEXT;
+
+    REG_CASE(FloatToInt):
+        regs[ip->dst].data.integer = (int)OPERAND(ip->a)->data.floating;
+        REG_NEXT;
+
+    REG_CASE(BoolToInt):
+        regs[ip->dst].data.integer = (int)OPERAND(ip->a)->data.boolean;
+        REG_NEXT;
+
+    REG_CASE(BoolToFloat):
+        regs[ip->dst].data.floating = (float)OPERAND(ip->a)->data.boolean;
+        REG_NEXT;
+
+    REG_CASE(IntToBool):
+        regs[ip->dst].data.boolean = (bool)OPERAND(ip->a)->data.integer;
+        REG_NEXT;
+
+    REG_CASE(FloatToBool):
+        regs[ip->dst].data.boolean = (bool)OPERAND(ip->a)->data.floating;
+        REG_NEXT;
+
+    REG_CASE(Rotation): {
+        float x = OPERAND(ip->a)->data.floating;
+        float y = OPERAND(ip->b)->data.floating;
+        float z = OPERAND(ip->c)->data.floating;
+
+        mats[ip->dst] = affine_rotation(x, y, z);
+    } REG_NEXT;
+
+    REG_CASE(Stretch): {
+        float x = OPERAND(ip->a)->data.floating;
+        float y = OPERAND(ip->b)->data.floating;
+        float z = OPERAND(ip->c)->data.floating;
+
+        mats[ip->dst] = affine_scale(x, y, z);
+    } REG_NEXT;
+
+    REG_CASE(Position): {
+        float x = OPERAND(ip->a)->data.floating;
+        float y = OPERAND(ip->b)->data.floating;
+        float z = OPERAND(ip->c)->data.floating;
+
+        mats[ip->dst] = affine_translation(x, y, z);
+    } REG_NEXT;
+
+    REG_CASE(Scale): {
+        float x = OPERAND(ip->a)->data.floating;
+
+        mats[ip->dst] = affine_scale(x, x, x);
+    } REG_NEXT;
+
+    REG_CASE(Matrix):
+        mats[ip->dst] = sys->const_matrices.data[ip->a];
+        REG_NEXT;
+
+    REG_CASE(Sin):   REG_MATH(l_inst_Sin);   REG_NEXT;
+    REG_CASE(Cos):   REG_MATH(l_inst_Cos);   REG_NEXT;
+    REG_CASE(Sqrt):  REG_MATH(l_inst_Sqrt);  REG_NEXT;
+    REG_CASE(Pow):   REG_MATH(l_inst_Pow);   REG_NEXT;
+    REG_CASE(Min):   REG_MATH(l_inst_Min);   REG_NEXT;
+    REG_CASE(Max):   REG_MATH(l_inst_Max);   REG_NEXT;
+    REG_CASE(Lerp):  REG_MATH(l_inst_Lerp);  REG_NEXT;
+    REG_CASE(Clamp): REG_MATH(l_inst_Clamp); REG_NEXT;
+
+    // NOTE: Only the live member is copied, copying the whole value right
+    //       after a narrow store stalls on store forwarding.
+    REG_CASE(Return): {
+        l_value_t *val = OPERAND(ip->a);
+        l_eval_res_t res = { .val.type = (l_basic_t)ip->b };
+
+        switch (res.val.type) {
+            case l_basic_Int:   res.val.data.integer  = val->data.integer;  break;
+            case l_basic_Float: res.val.data.floating = val->data.floating; break;
+            case l_basic_Bool:  res.val.data.boolean  = val->data.boolean;  break;
+            case l_basic_Mat4:  mats[0] = *MATRIX(ip->a); break;
+
+            case L_BASIC_COUNT: unreachable();
+        }
+
+        return res;
+    }
 
-    if (has_params) {
-        l_type_t type = sys->types.data[type_index];
-        param_count = type.params_count;
+#ifndef L_THREADED_DISPATCH
+        default: {
+            return (l_eval_res_t) { .error = "Unknown register instruction!" };
+        }
     }
+#endif
+}
 
+#undef REG_MATH
+#undef REG_BINARY
+#undef MATRIX
+#undef OPERAND
+#undef REG_NEXT
+#undef REG_CASE
 
-    for (unsigned i = 0; i < expr.count; ++i) {
-        l_instruction_t inst = code[i];
+#ifdef L_THREADED_DISPATCH
+    #pragma GCC diagnostic pop
+#endif
 
-        l_eval_res_t res = l_evaluate_instruction(inst, params, param_count,
-                                                  sys->eval_stack.data + sys->eval_stack.count - 1,
-                                                  sys->eval_stack.count,
-                                                  compute);
-        if (res.error)
-            return res;
 
-        sys->eval_stack.count -= res.eaten;
+static l_eval_res_t evaluate_native(l_system_t *sys, l_stack_t *stack,
+                                    l_expr_t expr, l_value_t *params)
+{
+    l_eval_res_t res = {0};
+
+    dck_stretchy_reserve(stack->matrices, 1);
+
+    switch (sys->native_fns[expr.native_index](params, sys->matrices[sys->id].data,
+                                               &res.val, stack->matrices.data)) {
+        case l_native_error_None: break;
+        case l_native_error_DivByZero: res.error = "Division by zero!"; break;
+        case l_native_error_ModByZero: res.error = "Modulo by zero!";   break;
+        default: res.error = "Unknown native error!"; break;
+    }
+
+    return res;
+}
+
+
+#define BINARY_OP(field, res_field, res_type, op)                      \
+do {                                                                    \
+    sp[-2].data.res_field = sp[-2].data.field op sp[-1].data.field;     \
+    sp[-2].type = res_type;                                             \
+    --sp;                                                               \
+} while (0)
+
+// NOTE: Trusted path. The parser type checks every expression and emits
+//       only statically typed instructions, so nothing is checked here
+//       apart from integer division by zero. The generic instructions
+//       are only ever run by `l_evaluate_instruction` during type checking.
+//       The code runs on the stack from slot `base` up, the slots below hold
+//       the temporaries of rule bodies. Returns the top of the stack or NULL
+//       with the message in `error`.
+static inline l_value_t *run_trusted(l_system_t *sys, l_stack_t *stack,
+                                     l_instruction_t *code, unsigned count, unsigned base,
+                                     l_value_t *params, unsigned param_count,
+                                     char **error)
+{
+#ifdef NDEBUG
+    (void)param_count;
+#endif
+
+    l_value_t *sp = stack->values.data + base;
+
+    // NOTE: The matrix of the slot at `sp[i]` is `MATRIX_AT(i)`.
+    affine_t *pool = sys->matrices[sys->id].data;
+#define MATRIX_AT(i) stack->matrices.data[sp - stack->values.data + (i)]
+
+    for (l_instruction_t *inst = code, *end = code + count; inst != end; ++inst) {
+        switch (inst->id) {
+            case l_inst_Value: {
+                assert(inst->op.type != l_basic_Mat4);
+                *sp++ = inst->op;
+            } break;
+
+            case l_inst_Param: {
+                assert((unsigned)inst->op.data.integer < param_count);
+                *sp = params[inst->op.data.integer];
+
+                if (sp->type == l_basic_Mat4) {
+                    MATRIX_AT(0) = pool[sp->data.matrix];
+                }
+
+                ++sp;
+            } break;
+
+            case l_inst_Matrix: {
+                sp->type = l_basic_Mat4;
+                MATRIX_AT(0) = sys->const_matrices.data[inst->op.data.matrix];
+                ++sp;
+            } break;
+
+            case l_inst_Store: {
+                unsigned k = (unsigned)inst->op.data.integer;
+                stack->values.data[k] = sp[-1];
+
+                if (sp[-1].type == l_basic_Mat4) {
+                    stack->matrices.data[k] = MATRIX_AT(-1);
+                }
+            } break;
+
+            case l_inst_Load: {
+                unsigned k = (unsigned)inst->op.data.integer;
+                *sp = stack->values.data[k];
+
+                if (sp->type == l_basic_Mat4) {
+                    MATRIX_AT(0) = stack->matrices.data[k];
+                }
+
+                ++sp;
+            } break;
+
+            case l_inst_AddI: { BINARY_OP(integer,  integer,  l_basic_Int,   +); } break;
+            case l_inst_AddF: { BINARY_OP(floating, floating, l_basic_Float, +); } break;
+            case l_inst_SubI: { BINARY_OP(integer,  integer,  l_basic_Int,   -); } break;
+            case l_inst_SubF: { BINARY_OP(floating, floating, l_basic_Float, -); } break;
+            case l_inst_MulI: { BINARY_OP(integer,  integer,  l_basic_Int,   *); } break;
+            case l_inst_MulF: { BINARY_OP(floating, floating, l_basic_Float, *); } break;
+            case l_inst_DivF: { BINARY_OP(floating, floating, l_basic_Float, /); } break;
+
+            case l_inst_MulM: {
+                MATRIX_AT(-2) = affine_multiply(MATRIX_AT(-2), MATRIX_AT(-1));
+                --sp;
+            } break;
+
+            case l_inst_DivI: {
+                if (sp[-1].data.integer == 0) {
+                    *error = "Division by zero!";
+                    return NULL;
+                }
+
+                BINARY_OP(integer, integer, l_basic_Int, /);
+            } break;
+
+            case l_inst_ModI: {
+                if (sp[-1].data.integer == 0) {
+                    *error = "Modulo by zero!";
+                    return NULL;
+                }
+
+                BINARY_OP(integer, integer, l_basic_Int, %);
+            } break;
+
+            case l_inst_NegI: { sp[-1].data.integer  = -sp[-1].data.integer;  } break;
+            case l_inst_NegF: { sp[-1].data.floating = -sp[-1].data.floating; } break;
+
+            case l_inst_LessI:     { BINARY_OP(integer,  boolean, l_basic_Bool, < ); } break;
+            case l_inst_LessF:     { BINARY_OP(floating, boolean, l_basic_Bool, < ); } break;
+            case l_inst_MoreI:     { BINARY_OP(integer,  boolean, l_basic_Bool, > ); } break;
+            case l_inst_MoreF:     { BINARY_OP(floating, boolean, l_basic_Bool, > ); } break;
+            case l_inst_LessEqI:   { BINARY_OP(integer,  boolean, l_basic_Bool, <=); } break;
+            case l_inst_LessEqF:   { BINARY_OP(floating, boolean, l_basic_Bool, <=); } break;
+            case l_inst_MoreEqI:   { BINARY_OP(integer,  boolean, l_basic_Bool, >=); } break;
+            case l_inst_MoreEqF:   { BINARY_OP(floating, boolean, l_basic_Bool, >=); } break;
+            case l_inst_EqualI:    { BINARY_OP(integer,  boolean, l_basic_Bool, ==); } break;
+            case l_inst_EqualF:    { BINARY_OP(floating, boolean, l_basic_Bool, ==); } break;
+            case l_inst_NotEqualI: { BINARY_OP(integer,  boolean, l_basic_Bool, !=); } break;
+            case l_inst_NotEqualF: { BINARY_OP(floating, boolean, l_basic_Bool, !=); } break;
+
+            case l_inst_And: { BINARY_OP(boolean, boolean, l_basic_Bool, &&); } break;
+            case l_inst_Or:  { BINARY_OP(boolean, boolean, l_basic_Bool, ||); } break;
+            case l_inst_Not: { sp[-1].data.boolean = !sp[-1].data.boolean; } break;
+
+            // NOTE: A taken jump leaves its operand as the value of the branch.
+            case l_inst_AndJump: {
+                if (!sp[-1].data.boolean) {
+                    inst += inst->op.data.integer - 1;
+                }
+                else {
+                    --sp;
+                }
+            } break;
+
+            case l_inst_OrJump: {
+                if (sp[-1].data.boolean) {
+                    inst += inst->op.data.integer - 1;
+                }
+                else {
+                    --sp;
+                }
+            } break;
+
+            case l_inst_JumpIfNot: {
+                --sp;
 
-        dck_stretchy_push(sys->eval_stack, res.val);
+                if (!sp->data.boolean) {
+                    inst += inst->op.data.integer - 1;
+                }
+            } break;
+
+            case l_inst_Jump: { inst += inst->op.data.integer - 1; } break;
+
+            case l_inst_IntToFloat: {
+                sp[-1].data.floating = (float)sp[-1].data.integer;
+                sp[-1].type = l_basic_Float;
+            } break;
+
+            case l_inst_IntToFloatBelow: {
+                sp[-2].data.floating = (float)sp[-2].data.integer;
+                sp[-2].type = l_basic_Float;
+            } break;
+
+            case l_inst_FloatToInt: {
+                sp[-1].data.integer = (int)sp[-1].data.floating;
+                sp[-1].type = l_basic_Int;
+            } break;
+
+            case l_inst_BoolToInt: {
+                sp[-1].data.integer = (int)sp[-1].data.boolean;
+                sp[-1].type = l_basic_Int;
+            } break;
+
+            case l_inst_BoolToFloat: {
+                sp[-1].data.floating = (float)sp[-1].data.boolean;
+                sp[-1].type = l_basic_Float;
+            } break;
+
+            case l_inst_IntToBool: {
+                sp[-1].data.boolean = (bool)sp[-1].data.integer;
+                sp[-1].type = l_basic_Bool;
+            } break;
+
+            case l_inst_FloatToBool: {
+                sp[-1].data.boolean = (bool)sp[-1].data.floating;
+                sp[-1].type = l_basic_Bool;
+            } break;
+
+            case l_inst_Rotation: {
+                float x = sp[-3].data.floating;
+                float y = sp[-2].data.floating;
+                float z = sp[-1].data.floating;
+
+                MATRIX_AT(-3) = affine_rotation(x, y, z);
+                sp[-3].type = l_basic_Mat4;
+                sp -= 2;
+            } break;
+
+            case l_inst_Stretch: {
+                float x = sp[-3].data.floating;
+                float y = sp[-2].data.floating;
+                float z = sp[-1].data.floating;
+
+                MATRIX_AT(-3) = affine_scale(x, y, z);
+                sp[-3].type = l_basic_Mat4;
+                sp -= 2;
+            } break;
+
+            case l_inst_Position: {
+                float x = sp[-3].data.floating;
+                float y = sp[-2].data.floating;
+                float z = sp[-1].data.floating;
+
+                MATRIX_AT(-3) = affine_translation(x, y, z);
+                sp[-3].type = l_basic_Mat4;
+                sp -= 2;
+            } break;
+
+            case l_inst_Scale: {
+                float x = sp[-1].data.floating;
+
+                MATRIX_AT(-1) = affine_scale(x, x, x);
+                sp[-1].type = l_basic_Mat4;
+            } break;
+
+            case l_inst_Sin:
+            case l_inst_Cos:
+            case l_inst_Sqrt: {
+                sp[-1].data.floating = l_math(inst->id, sys->exact_math, sp[-1].data.floating, 0.0f, 0.0f);
+            } break;
+
+            case l_inst_Pow:
+            case l_inst_Min:
+            case l_inst_Max: {
+                sp[-2].data.floating = l_math(inst->id, sys->exact_math,
+                                              sp[-2].data.floating, sp[-1].data.floating, 0.0f);
+                --sp;
+            } break;
+
+            case l_inst_Lerp:
+            case l_inst_Clamp: {
+                sp[-3].data.floating = l_math(inst->id, sys->exact_math, sp[-3].data.floating,
+                                              sp[-2].data.floating, sp[-1].data.floating);
+                sp -= 2;
+            } break;
+
+            case l_inst_Noop: break;
+
+            case l_inst_Random: {
+                sp->data.floating = l_random(sys->seed, (unsigned)inst->op.data.integer, stack->random);
+                sp->type = l_basic_Float;
+                ++sp;
+            } break;
+
+            default: {
+                *error = "Untyped instruction in trusted code!";
+                return NULL;
+            }
+        }
     }
 
-    assert(sys->eval_stack.count == 1);
+#undef MATRIX_AT
+
+    return sp;
+}
+
+l_eval_res_t l_evaluate_params(l_system_t *sys,
+                               l_stack_t *stack,
+                               l_expr_t expr,
+                               l_value_t *params,
+                               unsigned param_count)
+{
+    if (sys->engine == l_engine_Register && expr.reg_index != L_NO_REG_CODE)
+        return evaluate_registers(sys, stack, expr, params);
+
+    if (sys->engine == l_engine_Native && expr.native_index < sys->native_count)
+        return evaluate_native(sys, stack, expr, params);
+
+    dck_stretchy_reserve(stack->values,   expr.depth);
+    dck_stretchy_reserve(stack->matrices, expr.depth);
+
+    char *error;
+    l_value_t *sp = run_trusted(sys, stack, sys->instructions.data + expr.index, expr.count, 0,
+                                params, param_count, &error);
+    if (!sp)
+        return (l_eval_res_t) { .error = error };
+
+    assert(sp == stack->values.data + 1);
+
+    return (l_eval_res_t) { stack->values.data[0] };
+}
+
+char *l_evaluate_body(l_system_t *sys,
+                      l_stack_t *stack,
+                      l_expr_t body,
+                      unsigned base,
+                      l_value_t *params,
+                      unsigned param_count)
+{
+    dck_stretchy_reserve(stack->values,   base + body.depth);
+    dck_stretchy_reserve(stack->matrices, base + body.depth);
+
+    char *error;
+    l_value_t *sp = run_trusted(sys, stack, sys->instructions.data + body.index, body.count, base,
+                                params, param_count, &error);
+    return sp ? NULL : error;
+}
+
+#undef BINARY_OP
+
 
-    l_value_t res = sys->eval_stack.data[sys->eval_stack.count - 1];
-    sys->eval_stack.count = 0;
+l_eval_res_t l_evaluate(l_system_t *sys,
+                        l_stack_t *stack,
+                        l_expr_t expr,
+                        bool has_params,
+                        unsigned type_index,
+                        unsigned data_index)
+{
+    unsigned param_count = has_params ? sys->types.data[type_index].params_count : 0;
 
-    return (l_eval_res_t) { res };
+    return l_evaluate_params(sys, stack, expr,
+                             sys->values[sys->id].data + data_index,
+                             param_count);
 }
 
 
 l_build_t l_system_build(l_system_t *sys, model_builder_t *builder)
 {
+    char *flatten_error = l_system_flatten(sys);
+    if (flatten_error)
+        return (l_build_t) { .error = flatten_error };
+
+    uint64_t vertices = 0, indices = 0;
+
     for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
-        l_symbol_t sym = sys->symbols[sys->id].data[i];
-        l_type_t type = sys->types.data[sym.type];
+        predict_model(sys, sys->symbols[sys->id].data[i].type, &vertices, &indices);
+    }
 
-        for (unsigned lid = 0; lid < type.load_count; ++lid) {
-            l_type_load_t load = sys->type_loads.data[type.load_index + lid];
-            
-            l_eval_res_t res = l_evaluate(sys, load.expr, true, sym.type, sym.data_index, true);
+    char *budget = check_model(sys, builder, vertices, indices);
+    if (budget)
+        return (l_build_t) { .error = budget };
 
-            if (res.error)
-                return (l_build_t) { .error = res.error };
+    if (!model_builder_reserve(builder, (int)vertices, (int)indices))
+        return (l_build_t) { .error = memory_error };
 
-            assert(res.val.type == l_basic_Mat4);
+    resolve_frames(sys);
 
-            model_builder_merge(builder,
-                                sys->resources.data[load.resource_index].model,
-                                res.val.data.matrix);
-        }
+    for (unsigned i = 0; i < sys->symbols[sys->id].count; ++i) {
+        char *error = build_symbol(sys, builder, sys->symbols[sys->id].data[i],
+                                  l_random_counter(sys->random_generation, i));
+        if (error)
+            return (l_build_t) { .error = error };
     }
 
     if (builder->data.index_count == 0)
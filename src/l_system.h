@@ -6,6 +6,10 @@
 #include "res.h"
 #include "core.h"
 #include "generator.h"
+#include "arena.h"
+#include "l_math.h"
+
+#include <stdint.h>
 
 
 typedef enum
@@ -42,10 +46,13 @@ typedef struct
         float floating;
         bool boolean;
 
-        // TODO: Rework the whole literal approach
-        //       because of this fat boy.
-        //       For now we use VLIW architecture.
-        matrix_t matrix;
+        // NOTE: Matrices are stored out of line, this is an index into
+        //       `l_system_t.matrices` of the generation the value belongs to.
+        //       There are no matrix literals, folded constants are pushed
+        //       by `l_inst_Matrix`. Every matrix is a product of `position`,
+        //       `rotation`, `stretch` and `scale`, so it is kept as an
+        //       `affine_t` without the bottom row.
+        unsigned matrix;
     } data;
 } l_value_t;
 
@@ -71,6 +78,7 @@ typedef enum
     l_inst_And,
     l_inst_Or,
     l_inst_Not,
+    l_inst_Select,
 
     l_inst_CastInt,
     l_inst_CastFloat,
@@ -81,8 +89,73 @@ typedef enum
     l_inst_Position,
     l_inst_Scale,
 
+    /* math builtins, floats only, see `l_sin` */
+    l_inst_Sin,
+    l_inst_Cos,
+    l_inst_Sqrt,
+    l_inst_Pow,
+    l_inst_Min,
+    l_inst_Max,
+    l_inst_Lerp,
+    l_inst_Clamp,
+
     l_inst_Noop,
 
+    /* statically typed variants emitted by the parser */
+    l_inst_AddI,
+    l_inst_AddF,
+    l_inst_SubI,
+    l_inst_SubF,
+    l_inst_MulI,
+    l_inst_MulF,
+    l_inst_MulM,
+    l_inst_DivI,
+    l_inst_DivF,
+    l_inst_ModI,
+    l_inst_NegI,
+    l_inst_NegF,
+
+    l_inst_LessI,
+    l_inst_LessF,
+    l_inst_MoreI,
+    l_inst_MoreF,
+    l_inst_LessEqI,
+    l_inst_LessEqF,
+    l_inst_MoreEqI,
+    l_inst_MoreEqF,
+    l_inst_EqualI,
+    l_inst_EqualF,
+    l_inst_NotEqualI,
+    l_inst_NotEqualF,
+
+    l_inst_IntToFloat,
+    l_inst_IntToFloatBelow,
+    l_inst_FloatToInt,
+    l_inst_BoolToInt,
+    l_inst_BoolToFloat,
+    l_inst_IntToBool,
+    l_inst_FloatToBool,
+
+    /* emitted by the optimizer, pushes `const_matrices[op.data.matrix]` */
+    l_inst_Matrix,
+
+    /* rule bodies only, copy the top to or push the temporary `op.data.integer` */
+    l_inst_Store,
+    l_inst_Load,
+
+    /* lowered `&&`, `||` and `select`, jump by `op.data.integer` instructions
+     * from themselves, see `l_lower_branches` */
+    l_inst_AndJump,
+    l_inst_OrJump,
+    l_inst_JumpIfNot,
+    l_inst_Jump,
+
+    /* register machine only */
+    l_inst_Return,
+
+    /* pushes a float in [0, 1) drawn for site `op.data.integer`, see `l_random` */
+    l_inst_Random,
+
     L_INST_COUNT
 } l_inst_id_t;
 
@@ -92,6 +165,14 @@ typedef struct
     l_value_t op;
 } l_instruction_t;
 
+// NOTE: Open `&&`, `||` or `select` of lowered code, `id` is the eager
+//       instruction that stands at `target` once the jumps are undone.
+typedef struct
+{
+    l_inst_id_t id;
+    unsigned target;
+} l_join_t;
+
 static inline void fprint_instruction(l_instruction_t inst, FILE *file)
 {
     switch (inst.id) {
@@ -133,6 +214,7 @@ static inline void fprint_instruction(l_instruction_t inst, FILE *file)
         case l_inst_And: { fprintf(file, "and\n"); } break;
         case l_inst_Or: { fprintf(file, "or\n"); } break;
         case l_inst_Not: { fprintf(file, "not\n"); } break;
+        case l_inst_Select: { fprintf(file, "select\n"); } break;
         case l_inst_CastInt: { fprintf(file, "cast int\n"); } break;
         case l_inst_CastFloat: { fprintf(file, "cast float\n"); } break;
         case l_inst_CastBool: { fprintf(file, "cast bool\n"); } break;
@@ -140,32 +222,169 @@ static inline void fprint_instruction(l_instruction_t inst, FILE *file)
         case l_inst_Stretch: { fprintf(file, "stretch\n"); } break;
         case l_inst_Position: { fprintf(file, "position\n"); } break;
         case l_inst_Scale: { fprintf(file, "scale\n"); } break;
+        case l_inst_Sin: { fprintf(file, "sin\n"); } break;
+        case l_inst_Cos: { fprintf(file, "cos\n"); } break;
+        case l_inst_Sqrt: { fprintf(file, "sqrt\n"); } break;
+        case l_inst_Pow: { fprintf(file, "pow\n"); } break;
+        case l_inst_Min: { fprintf(file, "min\n"); } break;
+        case l_inst_Max: { fprintf(file, "max\n"); } break;
+        case l_inst_Lerp: { fprintf(file, "lerp\n"); } break;
+        case l_inst_Clamp: { fprintf(file, "clamp\n"); } break;
         case l_inst_Noop: { fprintf(file, "noop\n"); } break;
+        case l_inst_Matrix: { fprintf(file, "matrix { %u }\n", inst.op.data.matrix); } break;
+        case l_inst_Store: { fprintf(file, "store { %d }\n", inst.op.data.integer); } break;
+        case l_inst_Load: { fprintf(file, "load { %d }\n", inst.op.data.integer); } break;
+        case l_inst_AndJump: { fprintf(file, "and jump { %d }\n", inst.op.data.integer); } break;
+        case l_inst_OrJump: { fprintf(file, "or jump { %d }\n", inst.op.data.integer); } break;
+        case l_inst_JumpIfNot: { fprintf(file, "jump if not { %d }\n", inst.op.data.integer); } break;
+        case l_inst_Jump: { fprintf(file, "jump { %d }\n", inst.op.data.integer); } break;
+
+        case l_inst_AddI: { fprintf(file, "add int\n"); } break;
+        case l_inst_AddF: { fprintf(file, "add float\n"); } break;
+        case l_inst_SubI: { fprintf(file, "sub int\n"); } break;
+        case l_inst_SubF: { fprintf(file, "sub float\n"); } break;
+        case l_inst_MulI: { fprintf(file, "mul int\n"); } break;
+        case l_inst_MulF: { fprintf(file, "mul float\n"); } break;
+        case l_inst_MulM: { fprintf(file, "mul mat\n"); } break;
+        case l_inst_DivI: { fprintf(file, "div int\n"); } break;
+        case l_inst_DivF: { fprintf(file, "div float\n"); } break;
+        case l_inst_ModI: { fprintf(file, "mod int\n"); } break;
+        case l_inst_NegI: { fprintf(file, "neg int\n"); } break;
+        case l_inst_NegF: { fprintf(file, "neg float\n"); } break;
+        case l_inst_LessI: { fprintf(file, "less int\n"); } break;
+        case l_inst_LessF: { fprintf(file, "less float\n"); } break;
+        case l_inst_MoreI: { fprintf(file, "more int\n"); } break;
+        case l_inst_MoreF: { fprintf(file, "more float\n"); } break;
+        case l_inst_LessEqI: { fprintf(file, "less eq int\n"); } break;
+        case l_inst_LessEqF: { fprintf(file, "less eq float\n"); } break;
+        case l_inst_MoreEqI: { fprintf(file, "more eq int\n"); } break;
+        case l_inst_MoreEqF: { fprintf(file, "more eq float\n"); } break;
+        case l_inst_EqualI: { fprintf(file, "equal int\n"); } break;
+        case l_inst_EqualF: { fprintf(file, "equal float\n"); } break;
+        case l_inst_NotEqualI: { fprintf(file, "not equal int\n"); } break;
+        case l_inst_NotEqualF: { fprintf(file, "not equal float\n"); } break;
+        case l_inst_IntToFloat: { fprintf(file, "int to float\n"); } break;
+        case l_inst_IntToFloatBelow: { fprintf(file, "int to float below\n"); } break;
+        case l_inst_FloatToInt: { fprintf(file, "float to int\n"); } break;
+        case l_inst_BoolToInt: { fprintf(file, "bool to int\n"); } break;
+        case l_inst_BoolToFloat: { fprintf(file, "bool to float\n"); } break;
+        case l_inst_IntToBool: { fprintf(file, "int to bool\n"); } break;
+        case l_inst_FloatToBool: { fprintf(file, "float to bool\n"); } break;
+        case l_inst_Return: { fprintf(file, "return\n"); } break;
+        case l_inst_Random: { fprintf(file, "random { %d }\n", inst.op.data.integer); } break;
 
         case L_INST_COUNT: unreachable();
     }
 }
 
+/* register machine encoding
+ *
+ * Operands are 16 bit, the top two bits select the register file, the
+ * parameters of the evaluated symbol or the constants of the expression.
+ * Results always go to a register. `l_inst_Return` hands back operand `a`
+ * with the static type stored in `b`.
+ */
+typedef enum
+{
+    l_operand_Register,
+    l_operand_Param,
+    l_operand_Const,
+
+    L_OPERAND_COUNT
+} l_operand_t;
+
+#define L_OPERAND_SHIFT 14
+#define L_OPERAND_MASK  ((1u << L_OPERAND_SHIFT) - 1)
+#define L_OPERAND(kind, index) ((uint16_t)((unsigned)(kind) << L_OPERAND_SHIFT | (index)))
+
+typedef struct
+{
+    uint8_t op, dst;
+    uint16_t a, b, c;
+} l_reg_inst_t;
+
+#define L_NO_REG_CODE ((unsigned)-1)
+
+/* native code, returns 0 or one of `l_native_error_t` */
+typedef int (*l_native_fn_t)(const l_value_t *params, const affine_t *matrices,
+                             l_value_t *out, affine_t *out_matrix);
+
+typedef enum
+{
+    l_native_error_None,
+    l_native_error_DivByZero,
+    l_native_error_ModByZero,
+} l_native_error_t;
+
+#define L_NO_NATIVE_CODE ((unsigned)-1)
+
+#define L_NO_DECISION ((unsigned)-1)
+
+#define L_NO_RULE ((unsigned)-1)
+
+#define L_NO_FRAME ((unsigned)-1)
+
 typedef struct
 {
     unsigned index, count;
+
+    /* maximum evaluation stack size */
+    unsigned depth;
+
+    /* register machine code and constants, `reg_index` may be `L_NO_REG_CODE` */
+    unsigned reg_index, const_index;
+
+    /* index into `l_system_t.native_fns`, may be `L_NO_NATIVE_CODE` */
+    unsigned native_index;
+
+    /* no matrices anywhere in the code, the batch engine can run it */
+    bool scalar;
+
+    /* instructions removed by `l_optimize_code` */
+    unsigned saved;
 } l_expr_t;
 
 typedef struct
 {
     unsigned resource_index;
     l_expr_t expr;
+
+    // NOTE: The code without the frame of the type it is carried by, empty
+    //       when the model sits right at the frame, see `l_inherit_frames`.
+    l_expr_t local;
 } l_type_load_t;
 
 typedef struct
 {
     unsigned params_index, params_count;
     unsigned load_index, load_count;
+    unsigned rule_index, rule_count;
+
+    // NOTE: Decision table of the rules, `mask_index` may be `L_NO_DECISION`.
+    //       The code of `atoms` leaves `atom_count` booleans on the stack,
+    //       see `l_compile_decisions`.
+    l_expr_t atoms;
+    unsigned atom_count;
+    unsigned mask_index;
+
+    // NOTE: The rule frozen symbols are copied with, may be `L_NO_RULE`.
+    unsigned identity_rule;
+
+    // NOTE: The matrix parameter all the models and the whole subtree of a
+    //       symbol are placed by from the left, may be `L_NO_FRAME`.
+    //       See `l_find_frames`.
+    unsigned frame;
+
+    // NOTE: Some of the rules have weights, only one of those is applied.
+    bool weighted;
 } l_type_t;
 
+// NOTE: A frozen symbol came out of an identity rule that was the only rule
+//       to match it, no rule can change it anymore so its rules are skipped.
 typedef struct
 {
-    unsigned type;
+    unsigned type : 31;
+    unsigned frozen : 1;
     unsigned data_index;
 } l_symbol_t;
 
@@ -179,6 +398,11 @@ typedef struct
 {
     unsigned type;
     unsigned params_index;
+
+    // NOTE: The code of the frame of the successor without the frame of the
+    //       symbol it is carried by, empty when it keeps the very same frame.
+    //       See `l_inherit_frames`.
+    l_expr_t local;
 } l_result_t;
 
 typedef struct
@@ -187,6 +411,29 @@ typedef struct
 
     unsigned right_index;
     unsigned right_size;
+
+    /* sum of parameter counts of the right side */
+    unsigned param_count;
+    /* number of those parameters that are matrices */
+    unsigned matrix_count;
+    /* number of those matrices that are frames of the successors */
+    unsigned frame_count;
+
+    // NOTE: Code of all the parameters at once with the shared subterms kept
+    //       in `temp_count` temporaries, it leaves the parameters on the stack
+    //       in order. Empty when nothing is shared, see `l_compile_rule`.
+    l_expr_t body;
+    unsigned temp_count;
+
+    // NOTE: An identity rule rewrites a symbol into itself, its parameters
+    //       are copied without running any code. Only the rules that are not
+    //       `composed` freeze symbols.
+    bool identity;
+    bool composed;
+
+    // NOTE: Of the matching rules with a weight only one is applied, picked
+    //       with the chance of its weight among them. 0 for plain rules.
+    float weight;
 } l_rule_t;
 
 typedef struct
@@ -195,15 +442,268 @@ typedef struct
     unsigned texture_index;
 } l_resource_t;
 
+// NOTE: Slot `i` of a matrix type keeps its matrix in `matrices.data[i]`.
+//       `random` is the counter of the symbol the code runs for.
+typedef struct
+{
+    dck_stretchy_t (l_value_t, unsigned) values;
+    dck_stretchy_t (affine_t,  unsigned) matrices;
+
+    uint64_t random;
+} l_stack_t;
+
+
+/* randomness
+ *
+ * A counter based generator after Widynski's "Squares". Every draw is a pure
+ * function of the seed, the site that draws and the counter, which is the
+ * generation of the symbol and its index in that generation. There is no
+ * state, so the same symbol gets the same numbers whichever thread rewrites
+ * it and in whichever order. Sites `0` up are the `random()` calls of the
+ * code, the choice of weighted rule `r` draws from site `~r`.
+ */
+
+static inline uint64_t l_random_counter(unsigned generation, unsigned index)
+{
+    return (uint64_t)generation << 32 | index;
+}
+
+// NOTE: splitmix64 spreads the bits of the seed and the site over the key.
+static inline uint64_t l_random_key(uint32_t seed, unsigned site)
+{
+    uint64_t z = ((uint64_t)seed << 32 | site) + 0x9E3779B97F4A7C15ull;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+    return (z ^ (z >> 31)) | 1;
+}
+
+static inline uint32_t l_squares(uint64_t counter, uint64_t key)
+{
+    uint64_t x, y, z;
+
+    y = x = counter * key;
+    z = y + key;
+
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+
+    return (uint32_t)((x * x + z) >> 32);
+}
+
+// NOTE: The top 24 bits, so every float in [0, 1) is equally likely.
+static inline float l_random(uint32_t seed, unsigned site, uint64_t counter)
+{
+    return (float)(l_squares(counter, l_random_key(seed, site)) >> 8) * (1.0f / 16777216.0f);
+}
+
+
+/* batch engine
+ *
+ * Scalar expressions run over `L_BATCH_LANES` symbols of one type at once,
+ * every stack slot holds a column of values, bools are stored as 0 or 1 ints.
+ */
+#define L_BATCH_LANES  16
+#define L_BATCH_WINDOW 1024
+
+typedef union
+{
+    int   i[L_BATCH_LANES];
+    float f[L_BATCH_LANES];
+} l_lanes_t;
+
+typedef struct
+{
+    unsigned symbol, value_pos, matrix_pos;
+} l_hit_t;
+
+typedef struct
+{
+    unsigned begin, end, cursor;
+} l_rule_hits_t;
+
+// NOTE: Scratch memory of one worker, only valid inside of `l_system_update`.
+typedef struct
+{
+    dck_stretchy_t (l_lanes_t,     unsigned) lanes;
+    dck_stretchy_t (l_join_t,      unsigned) joins;
+    dck_stretchy_t (unsigned,      unsigned) buckets;
+    dck_stretchy_t (unsigned,      unsigned) bucket_index;
+    dck_stretchy_t (l_hit_t,       unsigned) hits;
+    dck_stretchy_t (l_rule_hits_t, unsigned) rule_hits;
+
+    /* column layout */
+    dck_stretchy_t (unsigned,  unsigned) cursors;
+    dck_stretchy_t (unsigned,  unsigned) type_counts;
+    dck_stretchy_t (l_value_t, unsigned) params;
+} l_batch_t;
+
+/* column layout
+ *
+ * Every type keeps the symbols of a generation in its own bucket with one
+ * column per parameter, parameter `p` of symbol `i` is `columns[p * stride + i]`.
+ * `order` holds the position of every symbol in the generation, so printing
+ * and building see the same sequence as with the symbol layout.
+ */
+typedef struct
+{
+    unsigned count, stride, param_count;
+
+    l_value_t *columns;
+    unsigned *order;
+} l_bucket_t;
+
+typedef enum
+{
+    l_layout_Symbols,
+    l_layout_Columns,
+
+    L_LAYOUT_COUNT
+} l_layout_t;
+
+static inline const char *l_layout_name(l_layout_t layout)
+{
+    switch (layout) {
+        case l_layout_Symbols: return "symbols";
+        case l_layout_Columns: return "columns";
+
+        case L_LAYOUT_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+typedef enum
+{
+    l_engine_Stack,
+    l_engine_Register,
+    l_engine_Native,
+    l_engine_Batch,
+
+    L_ENGINE_COUNT
+} l_engine_t;
+
+static inline const char *l_engine_name(l_engine_t engine)
+{
+    switch (engine) {
+        case l_engine_Stack:    return "stack";
+        case l_engine_Register: return "register";
+        case l_engine_Native:   return "native";
+        case l_engine_Batch:    return "batch";
+
+        case L_ENGINE_COUNT: unreachable();
+    }
+
+    unreachable();
+}
+
+// NOTE: A symbol waiting for the depth first derivation with `depth`
+//       generations to go. Taking it drops the parameters above `value_top`
+//       and `matrix_top`, they belong to finished siblings. With `memo` set
+//       it only marks the end of the geometry of memo entry `memo - 1`.
+typedef struct
+{
+    l_symbol_t symbol;
+    unsigned depth;
+    unsigned value_top, matrix_top;
+    unsigned memo;
+} l_pending_t;
+
+/* subtree memo
+ *
+ * The depth first derivation remembers which range of `emit` a symbol with
+ * given parameters and generations to go turned into, the next such symbol
+ * repeats the range instead of being derived again. The parameters of the
+ * key are kept in `memo_keys` with their matrices in `memo_matrices`. The
+ * frame of a type is left out of the key, the range is repeated transformed
+ * from the recorded frame to the new one.
+ */
+typedef struct
+{
+    uint64_t hash;
+    unsigned type, depth;
+    unsigned key_index;
+
+    // NOTE: Index of the inverse of the recorded frame in `memo_matrices`,
+    //       `L_NO_FRAME` for types without one.
+    unsigned inverse;
+
+    int vertex_begin, vertex_end;
+    int index_begin, index_end;
+    bool complete;
+} l_memo_t;
+
+/* generation history
+ *
+ * A copy of a whole generation in the symbol layout, its symbols, values and
+ * matrices are ranges of `history_symbols`, `history_values` and
+ * `history_matrices`. A `fixed` one stands for every later generation too.
+ */
+typedef struct
+{
+    unsigned generation;
+    bool fixed;
+    unsigned symbol_index, symbol_count;
+    unsigned value_index,  value_count;
+    unsigned matrix_index, matrix_count;
+
+    /* the frames of `l_system_t.frames` it may point to */
+    unsigned frame_count;
+} l_snapshot_t;
+
+#define L_NO_GENERATION ((unsigned)-1)
+
+/* hierarchical transforms
+ *
+ * The frame of a symbol is the product of the local transforms of all the
+ * frames up to the one of the axiom, `local` places it in the frame of
+ * `parent`. A frame is only ever added after its parent, so going through
+ * them in order resolves every world transform from a resolved one.
+ */
 typedef struct
 {
-    dck_stretchy_t (l_value_t,  unsigned) values [2];
-    dck_stretchy_t (l_symbol_t, unsigned) symbols[2];
+    unsigned parent;
+    affine_t local;
+} l_frame_t;
+
+// NOTE: Fewer symbols than this are always rewritten on the calling thread.
+#define L_PARALLEL_MIN_SYMBOLS 4096
+
+#define L_MAX_COMPOSE 4
+
+typedef struct
+{
+    // NOTE: The generations live in arenas, growing them never moves them.
+    dck_arena_t (l_value_t,  unsigned) values [2];
+    dck_arena_t (l_symbol_t, unsigned) symbols[2];
+    dck_arena_t (affine_t,   unsigned) matrices[2];
 
     unsigned id;
 
+    // NOTE: With `l_layout_Columns` the generations live in `buckets` and
+    //       `columnar` tells that `symbols` and `values` of `id` are stale,
+    //       `l_system_flatten` brings them back.
+    l_layout_t layout;
+    bool columnar;
+    dck_stretchy_t (l_bucket_t, unsigned) buckets[2];
+
     /* code */
     dck_stretchy_t (l_instruction_t, unsigned) instructions;
+    dck_stretchy_t (affine_t,        unsigned) const_matrices;
+
+    /* totals of all the parsed expressions */
+    unsigned code_count, code_saved;
+
+    l_engine_t engine;
+    dck_stretchy_t (l_reg_inst_t, unsigned) reg_code;
+    dck_stretchy_t (l_value_t,    unsigned) reg_consts;
+
+    // NOTE: Filled by `l_native_load`, stays valid until the next load.
+    void *native_handle;
+    l_native_fn_t *native_fns;
+    unsigned native_count;
 
     /* types */
     dck_stretchy_t (l_type_load_t, unsigned) type_loads;
@@ -213,11 +713,111 @@ typedef struct
     /* rules */
     dck_stretchy_t (l_expr_t,   unsigned) params;
     dck_stretchy_t (l_result_t, unsigned) results;
+    // NOTE: After `l_system_index_rules` the rules are sorted by left type
+    //       and each type holds the range of rules that can match it.
     dck_stretchy_t (l_rule_t,   unsigned) rules;
-    // TODO: Optimize type matching. We can make an offset list on top for individual type indices.
+
+    /* decision tables */
+    dck_stretchy_t (uint32_t, unsigned) decision_masks;
+
+    /* rule composition */
+    // NOTE: `compose` generations are asked for, `l_compose_rules` puts the
+    //       `composed_generations` it managed into the rule ranges and the
+    //       decision tables of `composed_types`, 0 and 1 compose nothing.
+    unsigned compose;
+    unsigned composed_generations;
+    dck_stretchy_t (l_type_t, unsigned) composed_types;
+
+    /* fixed point */
+    // NOTE: `fixed` is set once the current generation rewrites into itself,
+    //       `advanced` generations were rewritten by the last `l_system_advance`,
+    //       fewer than asked for when it stopped at a fixed point.
+    bool fixed;
+    unsigned advanced;
+
+    /* early emission */
+    // NOTE: When set, `l_system_update` merges the models of frozen symbols
+    //       into `emit` as soon as they appear and drops them from the
+    //       generation. `l_system_build` has to get the same builder.
+    model_builder_t *emit;
+
+    /* depth first derivation */
+    // NOTE: With `emit` set as well `l_system_advance` never stores a whole
+    //       generation, it derives the symbols one by one into `emit`.
+    bool depth_first;
+    dck_stretchy_t (l_pending_t, unsigned) pending;
+    dck_stretchy_t (unsigned,    unsigned) depth_indices;
+
+    /* subtree memo */
+    // NOTE: The memo takes `memo_budget` bytes at most, 0 turns it off. The
+    //       counters are those of the last derivation.
+    size_t memo_budget;
+    unsigned memo_hits, memo_misses;
+    dck_stretchy_t (l_memo_t,  unsigned) memo;
+    dck_stretchy_t (unsigned,  unsigned) memo_slots;
+    dck_stretchy_t (l_value_t, unsigned) memo_keys;
+    dck_stretchy_t (affine_t,  unsigned) memo_matrices;
+
+    /* generation history */
+    // NOTE: `generation` counts the generations the current one is past the
+    //       axiom, `L_NO_GENERATION` when it is only partly there because of
+    //       an error or `emit`. The snapshots are sorted by generation and
+    //       take `history_budget` bytes at most, the first one is the axiom
+    //       and always stays, see `l_system_seek`.
+    unsigned generation;
+    size_t history_budget;
+    dck_stretchy_t (l_snapshot_t, unsigned) history;
+    dck_stretchy_t (l_symbol_t,   unsigned) history_symbols;
+    dck_stretchy_t (l_value_t,    unsigned) history_values;
+    dck_stretchy_t (affine_t,     unsigned) history_matrices;
+
+    /* randomness */
+    // NOTE: A `stochastic` system has weighted rules or `random()` calls.
+    //       Nothing freezes in it and it is rewritten symbol by symbol in
+    //       the symbol layout, without composed rules or the subtree memo,
+    //       so every symbol knows its index. `random_generation` is the
+    //       generation of `id` counted from the axiom, unlike `generation`
+    //       it stays valid with `emit`.
+    uint32_t seed;
+    unsigned random_sites;
+    bool stochastic;
+    unsigned random_generation;
+
+    /* hierarchical transforms */
+    // NOTE: Has to be set before parsing. The frame parameter of a symbol
+    //       then holds an index into `frames` instead of `matrices`, its
+    //       successors keep the index or add a frame with only their local
+    //       transform. `l_system_build` resolves the new ones into
+    //       `frame_worlds` a level at a time, `frame_levels` are the first
+    //       frames added by every update. Such a system is rewritten symbol
+    //       by symbol in the symbol layout, without composed rules or the
+    //       depth first derivation.
+    bool hierarchical;
+    dck_stretchy_t (l_frame_t, unsigned) frames;
+    dck_stretchy_t (affine_t,  unsigned) frame_worlds;
+    dck_stretchy_t (unsigned,  unsigned) frame_levels;
+
+    /* math builtins */
+    // NOTE: Has to be set before parsing, constants are folded with it.
+    //       Runs `sin`, `cos` and `pow` through the C library instead of
+    //       the series, see `l_sin`.
+    bool exact_math;
+
+    /* memory budget */
+    // NOTE: The two live generations and the model take `memory_budget` bytes
+    //       at most, 0 is no limit. A step that would go over it stops with an
+    //       error before allocating anything, `memory_needed` is what it asked for.
+    size_t memory_budget;
+    size_t memory_needed;
 
     /* evaluation stack */
-    dck_stretchy_t (l_value_t, unsigned) eval_stack;
+    l_stack_t eval_stack;
+
+    /* parallel update */
+    // NOTE: 0 uses every core, 1 forces the serial update.
+    unsigned thread_count;
+    dck_stretchy_t (l_stack_t, unsigned) worker_stacks;
+    dck_stretchy_t (l_batch_t, unsigned) worker_batches;
 
     /* resources */
     dck_stretchy_t (texture_data_t, unsigned) textures;
@@ -233,15 +833,28 @@ typedef struct
 static inline void l_system_reset(l_system_t *sys)
 {
     sys->instructions.count = 0;
+    sys->reg_code.count     = 0;
+    sys->reg_consts.count   = 0;
+    sys->native_count       = 0;
     sys->type_loads.count   = 0;
     sys->param_types.count  = 0;
     sys->types.count        = 0;
     sys->params.count       = 0;
     sys->results.count      = 0;
     sys->rules.count        = 0;
-    sys->eval_stack.count   = 0;
     sys->views.count        = 0;
 
+    sys->const_matrices.count = 0;
+    sys->decision_masks.count = 0;
+    sys->composed_types.count = 0;
+    sys->composed_generations = 0;
+    sys->random_sites = 0;
+    sys->stochastic = false;
+    sys->code_count = 0;
+    sys->code_saved = 0;
+
+    sys->eval_stack.values.count = 0;
+
     for (unsigned i = 0; i < sys->textures.count; ++i) {
         free_texture_data(sys->textures.data[i]);
     }
@@ -261,8 +874,11 @@ static inline void l_system_reset(l_system_t *sys)
     free_texture_data(sys->atlas);
     sys->atlas.data = NULL;
 
-    glDeleteTextures(1, &sys->atlas_texture);
-    sys->atlas_texture = 0;
+    // NOTE: Nothing was uploaded without a GL context, see `engine_bench.c`.
+    if (sys->atlas_texture) {
+        glDeleteTextures(1, &sys->atlas_texture);
+        sys->atlas_texture = 0;
+    }
 }
 
 static inline void l_system_empty(l_system_t *sys)
@@ -273,6 +889,24 @@ static inline void l_system_empty(l_system_t *sys)
     sys->symbols[0].count = 0;
     sys->symbols[1].count = 0;
 
+    sys->matrices[0].count = 0;
+    sys->matrices[1].count = 0;
+
+    sys->columnar = false;
+    sys->fixed = false;
+    sys->advanced = 0;
+
+    sys->generation = 0;
+    sys->random_generation = 0;
+    sys->history.count = 0;
+    sys->history_symbols.count = 0;
+    sys->history_values.count = 0;
+    sys->history_matrices.count = 0;
+
+    sys->frames.count = 0;
+    sys->frame_worlds.count = 0;
+    sys->frame_levels.count = 0;
+
     sys->id = 0;
 }
 
@@ -284,12 +918,51 @@ unsigned l_system_add_type(l_system_t *sys,
 
 l_expr_t l_system_add_code(l_system_t *sys, l_instruction_t *instructions, int count);
 
+unsigned l_code_depth(l_instruction_t *code, unsigned count);
+
+bool l_code_is_scalar(l_instruction_t *code, unsigned count, l_basic_t type);
+
+void l_compile_registers(l_system_t *sys, l_expr_t *expr, l_basic_t type);
+
+// NOTE: Folds constants and drops needless instructions of the code at
+//       `index` in place, returns the new instruction count.
+unsigned l_optimize_code(l_system_t *sys, unsigned index, unsigned count);
+
+// NOTE: Turns `And`, `Or` and `Select` of the code at the end of
+//       `sys->instructions` into jumps, returns the new instruction count.
+unsigned l_lower_branches(l_system_t *sys, unsigned index, unsigned count);
+
+// NOTE: Optimizes, lowers and compiles the freshly parsed code from `index`
+//       to the end of `sys->instructions`, `type` is the type of its value.
+l_expr_t l_compile_code(l_system_t *sys, unsigned index, l_basic_t type);
+
+void l_compile_rule(l_system_t *sys, l_rule_t *rule);
+
+// NOTE: Needs the rules indexed by `l_system_index_rules`.
+void l_compile_decisions(l_system_t *sys);
+
+// NOTE: Needs the decision tables of the rules, see `l_system_advance`.
+void l_compose_rules(l_system_t *sys);
+
+// NOTE: Needs the rules indexed by `l_system_index_rules`.
+void l_find_frames(l_system_t *sys);
+
+// NOTE: Needs the frames found by `l_find_frames`, does nothing unless
+//       `hierarchical` is set. Compiles the frames of the successors and
+//       the models relative to the frame they are carried by and moves the
+//       frames of the axiom into `frames`.
+void l_inherit_frames(l_system_t *sys);
+
 void l_system_add_rule(l_system_t *sys,
                        l_match_t left,
                        unsigned *right_types,
                        l_expr_t *params,
                        int right_size);
 
+void l_system_index_rules(l_system_t *sys);
+
+unsigned l_system_add_matrix(l_system_t *sys, affine_t matrix);
+
 void l_system_append(l_system_t *sys, unsigned type, l_value_t *params);
 
 typedef struct
@@ -304,14 +977,45 @@ l_eval_res_t l_evaluate_instruction(l_instruction_t inst,
                                     l_value_t *data_top, unsigned data_size,
                                     bool compute);
 
+// NOTE: A matrix result is left in `stack->matrices.data[0]`.
 l_eval_res_t l_evaluate(l_system_t *sys,
+                        l_stack_t *stack,
                         l_expr_t expr,
                         bool has_params,
                         unsigned type_index,
-                        unsigned data_index,
-                        bool compute);
+                        unsigned data_index);
+
+// NOTE: Same as `l_evaluate` with the parameters passed directly.
+l_eval_res_t l_evaluate_params(l_system_t *sys,
+                               l_stack_t *stack,
+                               l_expr_t expr,
+                               l_value_t *params,
+                               unsigned param_count);
+
+// NOTE: Runs code that leaves several values, like the body of a rule, on the
+//       stack above the `base` slots of temporaries. The values are left in
+//       order at `stack->values.data + base` with their matrices at the same
+//       slots of `stack->matrices`.
+char *l_evaluate_body(l_system_t *sys,
+                      l_stack_t *stack,
+                      l_expr_t body,
+                      unsigned base,
+                      l_value_t *params,
+                      unsigned param_count);
 
 char *l_system_update(l_system_t *sys);
+
+// NOTE: Rewrites `generations` generations, as many at once as the composed
+//       rules allow and the rest one by one. Stops early at a fixed point.
+char *l_system_advance(l_system_t *sys, unsigned generations);
+
+// NOTE: Brings the system to `generation` from the current generation or the
+//       closest earlier snapshot, keeping the generations it leaves behind.
+//       `advanced` is counted from the axiom.
+char *l_system_seek(l_system_t *sys, unsigned generation);
+
+// NOTE: Fails only when out of memory, the generation stays columnar then.
+char *l_system_flatten(l_system_t *sys);
 void l_system_print(l_system_t *sys);
 
 
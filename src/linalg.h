@@ -9,6 +9,25 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/* SIMD
+ *
+ * `matrix_multiply`, `vector_transform`, `affine_multiply` and the affine
+ * point and vector transforms use SSE when the target has it, and
+ * `matrix_multiply` uses AVX when it has that too. It is picked when
+ * compiling, `LINALG_SCALAR` forces the `_scalar` versions every kernel
+ * keeps. The lanes add the products in the same order as the scalar loops,
+ * so both give the same floats.
+ */
+#if !defined(LINALG_SCALAR) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+    #define LINALG_SSE
+    #include <xmmintrin.h>
+#endif
+
+#if defined(LINALG_SSE) && defined(__AVX__)
+    #define LINALG_AVX
+    #include <immintrin.h>
+#endif
+
 typedef struct {
     float data[16];
 } matrix_t;
@@ -184,7 +203,7 @@ static inline matrix_t matrix_projection(
 }
 
 
-static inline matrix_t matrix_multiply(matrix_t mat1, matrix_t mat2)
+static inline matrix_t matrix_multiply_scalar(matrix_t mat1, matrix_t mat2)
 {
     const float *m1 = mat1.data;
     const float *m2 = mat2.data;
@@ -205,6 +224,86 @@ static inline matrix_t matrix_multiply(matrix_t mat1, matrix_t mat2)
     return res;
 }
 
+#if defined(LINALG_AVX)
+// NOTE: `matrix_t` is only aligned to a float, the column is loaded
+//       unaligned and copied to the upper half.
+static inline __m256 matrix_column_pair(const float *column)
+{
+    __m128 c = _mm_loadu_ps(column);
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(c), c, 1);
+}
+#endif
+
+// NOTE: Column `j` of the product is the columns of `mat1` weighted by
+//       column `j` of `mat2`, AVX does two columns at once.
+static inline matrix_t matrix_multiply(matrix_t mat1, matrix_t mat2)
+{
+#if defined(LINALG_AVX)
+    const float *m2 = mat2.data;
+
+    __m256 c0 = matrix_column_pair(mat1.data + 0);
+    __m256 c1 = matrix_column_pair(mat1.data + 4);
+    __m256 c2 = matrix_column_pair(mat1.data + 8);
+    __m256 c3 = matrix_column_pair(mat1.data + 12);
+
+    matrix_t res;
+
+    for (int j = 0; j < 4; j += 2) {
+        const float *a = m2 + j * 4;
+        const float *b = m2 + j * 4 + 4;
+
+        __m256 r = _mm256_mul_ps(c0, _mm256_setr_ps(a[0], a[0], a[0], a[0], b[0], b[0], b[0], b[0]));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_setr_ps(a[1], a[1], a[1], a[1], b[1], b[1], b[1], b[1])));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_setr_ps(a[2], a[2], a[2], a[2], b[2], b[2], b[2], b[2])));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c3, _mm256_setr_ps(a[3], a[3], a[3], a[3], b[3], b[3], b[3], b[3])));
+
+        _mm256_storeu_ps(res.data + j * 4, r);
+    }
+
+    return res;
+#elif defined(LINALG_SSE)
+    const float *m2 = mat2.data;
+
+    __m128 c0 = _mm_loadu_ps(mat1.data + 0);
+    __m128 c1 = _mm_loadu_ps(mat1.data + 4);
+    __m128 c2 = _mm_loadu_ps(mat1.data + 8);
+    __m128 c3 = _mm_loadu_ps(mat1.data + 12);
+
+    matrix_t res;
+
+    for (int j = 0; j < 4; j++) {
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(m2[j * 4 + 0]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(m2[j * 4 + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(m2[j * 4 + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(m2[j * 4 + 3])));
+
+        _mm_storeu_ps(res.data + j * 4, r);
+    }
+
+    return res;
+#else
+    return matrix_multiply_scalar(mat1, mat2);
+#endif
+}
+
+// NOTE: The same product as `matrix_multiply(matrix_rotation_z(z),
+//       matrix_multiply(matrix_rotation_y(y), matrix_rotation_x(x)))`
+//       written out, three sines and cosines and no products of zeros.
+static inline matrix_t matrix_rotation(float x, float y, float z)
+{
+    float cx = cosf(x), sx = sinf(x);
+    float cy = cosf(y), sy = sinf(y);
+    float cz = cosf(z), sz = sinf(z);
+
+    matrix_t res = {{
+         cz * cy,                sz * cy,                -sy,     0.0f,
+         cz * sy * sx - sz * cx, sz * sy * sx + cz * cx,  cy * sx, 0.0f,
+         cz * sy * cx + sz * sx, sz * sy * cx - cz * sx,  cy * cx, 0.0f,
+         0.0f,                   0.0f,                    0.0f,    1.0f,
+    }};
+    return res;
+}
+
 
 static inline void print_matrix(const matrix_t *mat)
 {
@@ -230,7 +329,7 @@ typedef union
 
 typedef vector_t color_t;
 
-static inline vector_t vector_transform(vector_t v, matrix_t m)
+static inline vector_t vector_transform_scalar(vector_t v, matrix_t m)
 {
     vector_t res = {{ 0.0f, 0.0f, 0.0f, 0.0f }};
 
@@ -243,6 +342,23 @@ static inline vector_t vector_transform(vector_t v, matrix_t m)
     return res;
 }
 
+static inline vector_t vector_transform(vector_t v, matrix_t m)
+{
+#if defined(LINALG_SSE)
+    __m128 r = _mm_mul_ps(_mm_loadu_ps(m.data + 0), _mm_set1_ps(v.data[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 4),  _mm_set1_ps(v.data[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 8),  _mm_set1_ps(v.data[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 12), _mm_set1_ps(v.data[3])));
+
+    vector_t res;
+    _mm_storeu_ps(res.data, r);
+
+    return res;
+#else
+    return vector_transform_scalar(v, m);
+#endif
+}
+
 static inline color_t color_from_uint(unsigned x)
 {
     return (color_t) {{
@@ -418,6 +534,376 @@ static inline float clamp(float x, float mn, float mx)
 }
 
 
+/* affine transforms
+ *
+ * The top three rows of a matrix with 0 0 0 1 for the bottom one, by columns
+ * like `matrix_t`. Columns 0 to 2 are the linear part, column 3 is the
+ * translation.
+ */
+typedef struct {
+    float data[12];
+} affine_t;
+
+
+static inline affine_t affine_identity(void)
+{
+    affine_t res = {{
+         1.0f, 0.0f, 0.0f,
+         0.0f, 1.0f, 0.0f,
+         0.0f, 0.0f, 1.0f,
+         0.0f, 0.0f, 0.0f,
+    }};
+    return res;
+}
+
+
+static inline affine_t affine_scale(float x, float y, float z)
+{
+    affine_t res = {{
+         x,    0.0f, 0.0f,
+         0.0f, y,    0.0f,
+         0.0f, 0.0f, z,
+         0.0f, 0.0f, 0.0f,
+    }};
+    return res;
+}
+
+
+static inline affine_t affine_translation(float x, float y, float z)
+{
+    affine_t res = {{
+         1.0f, 0.0f, 0.0f,
+         0.0f, 1.0f, 0.0f,
+         0.0f, 0.0f, 1.0f,
+         x,    y,    z,
+    }};
+    return res;
+}
+
+
+static inline affine_t affine_rotation_x(float angle)
+{
+    affine_t res = {{
+         1.0f, 0.0f,        0.0f,
+         0.0f, cosf(angle), sinf(angle),
+         0.0f,-sinf(angle), cosf(angle),
+         0.0f, 0.0f,        0.0f,
+    }};
+    return res;
+}
+
+
+static inline affine_t affine_rotation_y(float angle)
+{
+    affine_t res = {{
+         cosf(angle), 0.0f,-sinf(angle),
+         0.0f,        1.0f, 0.0f,
+         sinf(angle), 0.0f, cosf(angle),
+         0.0f,        0.0f, 0.0f,
+    }};
+    return res;
+}
+
+
+static inline affine_t affine_rotation_z(float angle)
+{
+    affine_t res = {{
+         cosf(angle), sinf(angle), 0.0f,
+        -sinf(angle), cosf(angle), 0.0f,
+         0.0f,        0.0f,        1.0f,
+         0.0f,        0.0f,        0.0f,
+    }};
+    return res;
+}
+
+
+// NOTE: Same as `matrix_multiply` without the bottom row, 36 products
+//       instead of 64.
+static inline affine_t affine_multiply_scalar(affine_t aff1, affine_t aff2)
+{
+    const float *a = aff1.data;
+    const float *b = aff2.data;
+
+    affine_t res;
+
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 3; i++) {
+            res.data[j * 3 + i] = a[i] * b[j * 3] + a[3 + i] * b[j * 3 + 1] + a[6 + i] * b[j * 3 + 2];
+        }
+    }
+
+    res.data[9]  += a[9];
+    res.data[10] += a[10];
+    res.data[11] += a[11];
+
+    return res;
+}
+
+
+#if defined(LINALG_SSE)
+// NOTE: The 12 floats are moved as three whole vectors and the columns are
+//       shuffled out of them. Loading a column straight from `m + 3` would
+//       read across two stores, which the CPU can not forward from.
+//       The fourth lane of every column is junk.
+static inline void affine_load_columns(const float *m, __m128 columns[4])
+{
+    __m128 l0 = _mm_loadu_ps(m + 0);
+    __m128 l1 = _mm_loadu_ps(m + 4);
+    __m128 l2 = _mm_loadu_ps(m + 8);
+
+    __m128 t = _mm_shuffle_ps(l0, l1, _MM_SHUFFLE(0, 0, 3, 3));
+
+    columns[0] = l0;
+    columns[1] = _mm_shuffle_ps(t, l1, _MM_SHUFFLE(2, 1, 2, 0));
+    columns[2] = _mm_shuffle_ps(l1, l2, _MM_SHUFFLE(0, 0, 3, 2));
+    columns[3] = _mm_shuffle_ps(l2, l2, _MM_SHUFFLE(3, 3, 2, 1));
+}
+
+static inline void affine_store_columns(float *m, const __m128 columns[4])
+{
+    __m128 t0 = _mm_shuffle_ps(columns[0], columns[1], _MM_SHUFFLE(0, 0, 2, 2));
+    __m128 t2 = _mm_shuffle_ps(columns[2], columns[3], _MM_SHUFFLE(0, 0, 2, 2));
+
+    _mm_storeu_ps(m + 0, _mm_shuffle_ps(columns[0], t0, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(m + 4, _mm_shuffle_ps(columns[1], columns[2], _MM_SHUFFLE(1, 0, 2, 1)));
+    _mm_storeu_ps(m + 8, _mm_shuffle_ps(t2, columns[3], _MM_SHUFFLE(2, 1, 2, 0)));
+}
+#endif
+
+static inline affine_t affine_multiply(affine_t aff1, affine_t aff2)
+{
+#if defined(LINALG_SSE)
+    const float *b = aff2.data;
+
+    __m128 c[4], r[4];
+    affine_load_columns(aff1.data, c);
+
+    for (int j = 0; j < 4; j++) {
+        r[j] = _mm_mul_ps(c[0], _mm_set1_ps(b[j * 3 + 0]));
+        r[j] = _mm_add_ps(r[j], _mm_mul_ps(c[1], _mm_set1_ps(b[j * 3 + 1])));
+        r[j] = _mm_add_ps(r[j], _mm_mul_ps(c[2], _mm_set1_ps(b[j * 3 + 2])));
+    }
+
+    r[3] = _mm_add_ps(r[3], c[3]);
+
+    affine_t res;
+    affine_store_columns(res.data, r);
+
+    return res;
+#else
+    return affine_multiply_scalar(aff1, aff2);
+#endif
+}
+
+// NOTE: The same product as `affine_multiply(affine_rotation_z(z),
+//       affine_multiply(affine_rotation_y(y), affine_rotation_x(x)))`
+//       written out, see `matrix_rotation`.
+static inline affine_t affine_rotation(float x, float y, float z)
+{
+    float cx = cosf(x), sx = sinf(x);
+    float cy = cosf(y), sy = sinf(y);
+    float cz = cosf(z), sz = sinf(z);
+
+    affine_t res = {{
+         cz * cy,                sz * cy,                -sy,
+         cz * sy * sx - sz * cx, sz * sy * sx + cz * cx,  cy * sx,
+         cz * sy * cx + sz * sx, sz * sy * cx - cz * sx,  cy * cx,
+         0.0f,                   0.0f,                    0.0f,
+    }};
+    return res;
+}
+
+
+static inline matrix_t affine_to_matrix(affine_t a)
+{
+    const float *m = a.data;
+
+    matrix_t res = {{
+         m[0], m[1],  m[2],  0.0f,
+         m[3], m[4],  m[5],  0.0f,
+         m[6], m[7],  m[8],  0.0f,
+         m[9], m[10], m[11], 1.0f,
+    }};
+    return res;
+}
+
+
+static inline vec3_t affine_transform_point_scalar(affine_t a, vec3_t p)
+{
+    const float *m = a.data;
+
+    return (vec3_t) {{
+        m[0] * p.x + m[3] * p.y + m[6] * p.z + m[9],
+        m[1] * p.x + m[4] * p.y + m[7] * p.z + m[10],
+        m[2] * p.x + m[5] * p.y + m[8] * p.z + m[11],
+    }};
+}
+
+// NOTE: Only the linear part, the translation does not move directions.
+static inline vec3_t affine_transform_vector_scalar(affine_t a, vec3_t v)
+{
+    const float *m = a.data;
+
+    return (vec3_t) {{
+        m[0] * v.x + m[3] * v.y + m[6] * v.z,
+        m[1] * v.x + m[4] * v.y + m[7] * v.z,
+        m[2] * v.x + m[5] * v.y + m[8] * v.z,
+    }};
+}
+
+#if defined(LINALG_SSE)
+static inline vec3_t affine_transform_lanes(affine_t a, vec3_t v, bool point)
+{
+    __m128 c[4];
+    affine_load_columns(a.data, c);
+
+    __m128 r = _mm_mul_ps(c[0], _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_set1_ps(v.z)));
+
+    if (point)
+        r = _mm_add_ps(r, c[3]);
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, r);
+
+    return (vec3_t) {{ lanes[0], lanes[1], lanes[2] }};
+}
+#endif
+
+static inline vec3_t affine_transform_point(affine_t a, vec3_t p)
+{
+#if defined(LINALG_SSE)
+    return affine_transform_lanes(a, p, true);
+#else
+    return affine_transform_point_scalar(a, p);
+#endif
+}
+
+static inline vec3_t affine_transform_vector(affine_t a, vec3_t v)
+{
+#if defined(LINALG_SSE)
+    return affine_transform_lanes(a, v, false);
+#else
+    return affine_transform_vector_scalar(a, v);
+#endif
+}
+
+
+// NOTE: Tells whether the linear part is a rotation times a uniform scale,
+//       its columns are orthogonal and all have the squared length `scale2`.
+//       Every product of `affine_rotation_*`, `affine_translation` and
+//       uniform `affine_scale` is one.
+static inline bool affine_is_similarity(affine_t a, float *scale2)
+{
+    const float *m = a.data;
+
+    float xx = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+    float yy = m[3] * m[3] + m[4] * m[4] + m[5] * m[5];
+    float zz = m[6] * m[6] + m[7] * m[7] + m[8] * m[8];
+    float xy = m[0] * m[3] + m[1] * m[4] + m[2] * m[5];
+    float xz = m[0] * m[6] + m[1] * m[7] + m[2] * m[8];
+    float yz = m[3] * m[6] + m[4] * m[7] + m[5] * m[8];
+
+    float eps = xx * 1e-6f;
+
+    *scale2 = xx;
+
+    return xx > 0.0f
+        && fabsf(yy - xx) <= eps && fabsf(zz - xx) <= eps
+        && fabsf(xy) <= eps && fabsf(xz) <= eps && fabsf(yz) <= eps;
+}
+
+// NOTE: The cofactors of the linear part by columns, column `i` is the cross
+//       product of the other two. Returns the determinant.
+static inline float affine_cofactors(affine_t a, affine_t *res)
+{
+    float *m = a.data;
+
+    cross(res->data,     m + 3, m + 6);
+    cross(res->data + 3, m + 6, m);
+    cross(res->data + 6, m,     m + 3);
+
+    res->data[9] = res->data[10] = res->data[11] = 0.0f;
+
+    return dot(m, res->data);
+}
+
+// NOTE: The inverse transpose of the linear part for transforming normals,
+//       the cofactors over the determinant. A rotation is its own and a
+//       similarity only has to undo the scale twice. A singular one comes
+//       back transposed like with `matrix_inverse`.
+static inline affine_t affine_normal(affine_t a)
+{
+    affine_t res = {0};
+    float scale2;
+
+    if (affine_is_similarity(a, &scale2)) {
+        float s = 1.0f / scale2;
+
+        for (int i = 0; i < 9; ++i) {
+            res.data[i] = a.data[i] * s;
+        }
+
+        return res;
+    }
+
+    float det = affine_cofactors(a, &res);
+
+    if (det == 0.0f) {
+        for (int j = 0; j < 3; ++j) {
+            for (int i = 0; i < 3; ++i) {
+                res.data[j * 3 + i] = a.data[i * 3 + j];
+            }
+        }
+
+        return res;
+    }
+
+    float inv = 1.0f / det;
+
+    for (int i = 0; i < 9; ++i) {
+        res.data[i] *= inv;
+    }
+
+    return res;
+}
+
+// NOTE: The linear part is the transpose of `affine_normal`, the translation
+//       is moved back by it. Returns false for a singular transform.
+static inline bool affine_inverse(affine_t a, affine_t *inverse)
+{
+    affine_t normal;
+    float scale2;
+
+    if (affine_is_similarity(a, &scale2)) {
+        normal = a;
+    }
+    else {
+        scale2 = affine_cofactors(a, &normal);
+
+        if (scale2 == 0.0f)
+            return false;
+    }
+
+    float inv = 1.0f / scale2;
+
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 3; ++i) {
+            inverse->data[j * 3 + i] = normal.data[i * 3 + j] * inv;
+        }
+    }
+
+    vec3_t t = affine_transform_vector(*inverse, (vec3_t) {{ a.data[9], a.data[10], a.data[11] }});
+
+    inverse->data[9]  = -t.x;
+    inverse->data[10] = -t.y;
+    inverse->data[11] = -t.z;
+
+    return true;
+}
+
+
 typedef struct
 {
     int x, y, w, h;
@@ -0,0 +1,242 @@
+#include "linalg.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define INPUT_COUNT 1024
+#define ROUNDS      4096
+
+// NOTE: Everything the kernels return is folded in here, so none of the
+//       calls can be thrown away.
+static volatile float sink;
+
+// NOTE: Read at the start of every round, so a round can not be worked out
+//       once and reused.
+static volatile float zero;
+
+static matrix_t matrices[INPUT_COUNT];
+static affine_t affines[INPUT_COUNT];
+static float angles[INPUT_COUNT][3];
+
+static double now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// NOTE: A small xorshift, the inputs only have to be the same every run.
+static float next_float(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return (float)(x >> 8) / (float)(1u << 24) * 2.0f - 1.0f;
+}
+
+static float max_diff(const float *a, const float *b, int count)
+{
+    float diff = 0.0f;
+
+    for (int k = 0; k < count; k++) {
+        float d = fabsf(a[k] - b[k]);
+        if (d > diff)
+            diff = d;
+    }
+
+    return diff;
+}
+
+static void report(const char *name, double scalar, double simd, float diff)
+{
+    double ops = (double)INPUT_COUNT * ROUNDS;
+
+    printf("%-24s %8.2f ns %8.2f ns %6.2fx   max diff %g\n", name,
+           scalar * 1e9 / ops, simd * 1e9 / ops, scalar / simd, diff);
+}
+
+
+/* kernels */
+
+// NOTE: Each step feeds the last result back in, so one call can not start
+//       before the one before it is done, the same as a chain of transforms.
+#define BENCH(result_t, init, step, out)                                       \
+    {                                                                          \
+        double begin = now();                                                  \
+        for (int r = 0; r < ROUNDS; r++) {                                     \
+            result_t acc = init;                                               \
+            acc.data[0] += zero;                                               \
+            for (int i = 0; i < INPUT_COUNT; i++)                              \
+                acc = step;                                                    \
+            sink += acc.data[0];                                               \
+        }                                                                      \
+        out = now() - begin;                                                   \
+    }
+
+static void bench_matrix_multiply(void)
+{
+    double scalar, simd;
+
+    BENCH(matrix_t, matrix_identity(), matrix_multiply_scalar(acc, matrices[i]), scalar);
+    BENCH(matrix_t, matrix_identity(), matrix_multiply(acc, matrices[i]), simd);
+
+    float diff = 0.0f;
+    for (int i = 0; i + 1 < INPUT_COUNT; i++) {
+        matrix_t a = matrix_multiply_scalar(matrices[i], matrices[i + 1]);
+        matrix_t b = matrix_multiply(matrices[i], matrices[i + 1]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 16));
+    }
+
+    report("matrix_multiply", scalar, simd, diff);
+}
+
+static void bench_vector_transform(void)
+{
+    double scalar, simd;
+    vector_t init = {{ 1.0f, 1.0f, 1.0f, 1.0f }};
+
+    BENCH(vector_t, init, vector_transform_scalar(acc, matrices[i]), scalar);
+    BENCH(vector_t, init, vector_transform(acc, matrices[i]), simd);
+
+    float diff = 0.0f;
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        vector_t a = vector_transform_scalar(init, matrices[i]);
+        vector_t b = vector_transform(init, matrices[i]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 4));
+    }
+
+    report("vector_transform", scalar, simd, diff);
+}
+
+static void bench_affine_multiply(void)
+{
+    double scalar, simd;
+
+    BENCH(affine_t, affine_identity(), affine_multiply_scalar(acc, affines[i]), scalar);
+    BENCH(affine_t, affine_identity(), affine_multiply(acc, affines[i]), simd);
+
+    float diff = 0.0f;
+    for (int i = 0; i + 1 < INPUT_COUNT; i++) {
+        affine_t a = affine_multiply_scalar(affines[i], affines[i + 1]);
+        affine_t b = affine_multiply(affines[i], affines[i + 1]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 12));
+    }
+
+    report("affine_multiply", scalar, simd, diff);
+}
+
+// NOTE: Unlike the others this one is not a chain, one transform moves a
+//       whole array of points, the same as `model_builder_merge`.
+#define BENCH_POINTS(transform, out)                                           \
+    {                                                                          \
+        double begin = now();                                                  \
+        for (int r = 0; r < ROUNDS; r++) {                                     \
+            affine_t a = affines[r % INPUT_COUNT];                             \
+            for (int i = 0; i < INPUT_COUNT; i++)                              \
+                points[i] = transform(a, vertices[i]);                         \
+            sink += points[r % INPUT_COUNT].x;                                 \
+        }                                                                      \
+        out = now() - begin;                                                   \
+    }
+
+static void bench_affine_transform(void)
+{
+    static vec3_t vertices[INPUT_COUNT], points[INPUT_COUNT];
+
+    for (int i = 0; i < INPUT_COUNT; i++)
+        vertices[i] = (vec3_t) {{ angles[i][0], angles[i][1], angles[i][2] }};
+
+    double scalar, simd;
+
+    BENCH_POINTS(affine_transform_point_scalar, scalar);
+    BENCH_POINTS(affine_transform_point, simd);
+
+    float diff = 0.0f;
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        vec3_t a = affine_transform_point_scalar(affines[i], vertices[i]);
+        vec3_t b = affine_transform_point(affines[i], vertices[i]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 3));
+
+        a = affine_transform_vector_scalar(affines[i], vertices[i]);
+        b = affine_transform_vector(affines[i], vertices[i]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 3));
+    }
+
+    report("affine_transform_point", scalar, simd, diff);
+}
+
+static affine_t rotation_chain(float x, float y, float z)
+{
+    return affine_multiply(affine_rotation_z(z),
+               affine_multiply(affine_rotation_y(y),
+                   affine_rotation_x(x)));
+}
+
+// NOTE: Every angle takes a bit of the last result, so neither version can
+//       skip the entries the checksum does not read.
+static void bench_rotation(void)
+{
+    double chain, fused;
+
+    BENCH(affine_t, affine_identity(),
+          rotation_chain(angles[i][0] + acc.data[8] * 1e-3f,
+                         angles[i][1] + acc.data[0] * 1e-3f,
+                         angles[i][2] + acc.data[4] * 1e-3f), chain);
+    BENCH(affine_t, affine_identity(),
+          affine_rotation(angles[i][0] + acc.data[8] * 1e-3f,
+                          angles[i][1] + acc.data[0] * 1e-3f,
+                          angles[i][2] + acc.data[4] * 1e-3f), fused);
+
+    float diff = 0.0f;
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        affine_t a = rotation_chain(angles[i][0], angles[i][1], angles[i][2]);
+        affine_t b = affine_rotation(angles[i][0], angles[i][1], angles[i][2]);
+        diff = fmaxf(diff, max_diff(a.data, b.data, 12));
+    }
+
+    report("rotation (chain/fused)", chain, fused, diff);
+}
+
+
+int main(void)
+{
+    uint32_t state = 0x9E3779B9u;
+
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        // NOTE: Close to the identity, so long chains neither blow up nor
+        //       fade to zero.
+        for (int k = 0; k < 16; k++)
+            matrices[i].data[k] = (k % 5 == 0 ? 1.0f : 0.0f) + next_float(&state) * 0.05f;
+
+        for (int k = 0; k < 12; k++)
+            affines[i].data[k] = (k % 4 == 0 ? 1.0f : 0.0f) + next_float(&state) * 0.05f;
+
+        for (int k = 0; k < 3; k++)
+            angles[i][k] = next_float(&state) * (float)M_PI;
+    }
+
+#if defined(LINALG_AVX)
+    const char *kernels = "AVX";
+#elif defined(LINALG_SSE)
+    const char *kernels = "SSE";
+#else
+    const char *kernels = "scalar";
+#endif
+
+    printf("kernels: %s, %d x %d calls each\n\n", kernels, ROUNDS, INPUT_COUNT);
+    printf("%-24s %11s %11s %7s\n", "", "scalar", "selected", "");
+
+    bench_matrix_multiply();
+    bench_vector_transform();
+    bench_affine_multiply();
+    bench_affine_transform();
+    bench_rotation();
+
+    return sink != sink;
+}
@@ -32,12 +32,15 @@
 
 #include "editor.h"
 #include "generator.h"
+#include "arena.h"
 #include "l_system.h"
+#include "l_native.h"
 #include "parser.h"
 #include "obj_parser.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <time.h>
 #include <stdbool.h>
 
@@ -86,22 +89,59 @@ static color_t background = { 0.2f, 0.2f, 0.2f, 0.7f };
 
 
 static editor_t editor = {0};
-static l_system_t l_system = {0};
+// NOTE: The history keeps the generations `<` and `>` go through.
+static l_system_t l_system = {
+    .history_budget = (size_t)256 << 20,
+    .memory_budget  = (size_t)4 << 30,
+};
 
 static parse_state_t parse_state = {0};
 
 #define ERROR_MESSAGE_CAPACITY 256
 static char error_message_buffer[ERROR_MESSAGE_CAPACITY] = {0};
 
+// NOTE: Shown under the editor in place of the errors, the first line is of
+//       the last iteration and the second of the last compilation.
+#define STATS_CAPACITY 96
+static char iterate_stats[STATS_CAPACITY] = {0};
+static char compile_stats[STATS_CAPACITY] = {0};
+
 static bool has_model = false;
+// NOTE: The system can be iterated again without parsing it anew, as long
+//       as the text is still the one it was parsed from.
+static bool compiled = false;
+static unsigned compiled_version = 0;
 static model_builder_t builder = {0};
 static model_object_t model_object;
 
 static int iteration_count = 8;
 
+// NOTE: The choice of the emit button, the depth first derivation builds
+//       everything early regardless and leaves it as it was.
+static bool emit_early = false;
+
+static void update_emit(void)
+{
+    l_system.emit = emit_early || l_system.depth_first ? &builder : NULL;
+}
+
+
+static void append_stats(char *stats, const char *format, ...)
+{
+    size_t size = strlen(stats);
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(stats + size, STATS_CAPACITY - size, format, args);
+    va_end(args);
+}
+
 
 static void try_rebuild(void)
 {
+    memset(error_message_buffer, 0, ERROR_MESSAGE_CAPACITY);
+    iterate_stats[0] = '\0';
+
     builder.data.vertex_count = 0;
     builder.data.index_count  = 0;
 
@@ -111,23 +151,51 @@ static void try_rebuild(void)
     }
 
     /* iterate the system */
-    for (int i = 0; i < iteration_count; ++i) {
-        char *error = l_system_update(&l_system);
-        if (error) {
-            snprintf(error_message_buffer, ERROR_MESSAGE_CAPACITY,
-                    "runtime error: %s\n", error);
-        }
+    int64_t iterate_start = bagT_getTime();
+
+    l_system.memory_needed = 0;
+
+    char *error = l_system_seek(&l_system, iteration_count);
+    if (error && l_system.memory_needed) {
+        snprintf(error_message_buffer, ERROR_MESSAGE_CAPACITY,
+                "runtime error: %s %zu MB needed\n", error, l_system.memory_needed >> 20);
+        return;
+    }
+    else if (error) {
+        snprintf(error_message_buffer, ERROR_MESSAGE_CAPACITY,
+                "runtime error: %s\n", error);
+        return;
+    }
+
+    int64_t iterate_time = bagT_getTime() - iterate_start;
+
+    append_stats(iterate_stats, "%d iterations: %.3f ms", iteration_count,
+                 (double)iterate_time * 1000.0 / (double)bagT_getFreq());
+
+    if (l_system.advanced < (unsigned)iteration_count) {
+        append_stats(iterate_stats, ", fixed point after %u", l_system.advanced);
+    }
+
+    if (l_system.depth_first && l_system.memo_budget) {
+        append_stats(iterate_stats, ", memo %u hits %u misses",
+                     l_system.memo_hits, l_system.memo_misses);
     }
 
     l_build_t build = l_system_build(&l_system, &builder);
 
-    if (build.error) {
+    if (build.error && l_system.memory_needed) {
+        snprintf(error_message_buffer, ERROR_MESSAGE_CAPACITY,
+                "build error: %s %zu MB needed\n", build.error, l_system.memory_needed >> 20);
+        return;
+    }
+    else if (build.error) {
         snprintf(error_message_buffer, ERROR_MESSAGE_CAPACITY,
                 "build error: %s\n", build.error);
         return;
     }
 
     model_object = create_model_object(builder.data);
+    model_builder_trim(&builder);
 
     has_model = true;
 }
@@ -136,6 +204,9 @@ static void try_rebuild(void)
 static void try_compile(void)
 {
     memset(error_message_buffer, 0, ERROR_MESSAGE_CAPACITY);
+    iterate_stats[0] = '\0';
+    compile_stats[0] = '\0';
+    compiled = false;
 
     if (has_model) {
         free_model_object(model_object);
@@ -154,10 +225,44 @@ static void try_compile(void)
         return;
     }
 
+    append_stats(compile_stats, "optimizer saved %u of %u instructions",
+                 l_system.code_saved, l_system.code_count);
+
+    if (l_system.engine == l_engine_Native) {
+        int64_t native_start = bagT_getTime();
+
+        // NOTE: Without native code the expressions run on the stack vm.
+        char *error = l_native_load(&l_system, editor.text_buffer, editor.text_size);
+        if (error) {
+            compile_stats[0] = '\0';
+            append_stats(compile_stats, "%s Running on the stack vm.", error);
+        }
+        else {
+            int64_t native_time = bagT_getTime() - native_start;
+
+            append_stats(compile_stats, ", native code ready: %.3f ms",
+                         (double)native_time * 1000.0 / (double)bagT_getFreq());
+        }
+    }
+
+    compiled = true;
+    compiled_version = editor.version;
     try_rebuild();
 }
 
 
+// NOTE: Edited text has to be parsed again before it is iterated.
+static void try_iterate(void)
+{
+    if (compiled && compiled_version == editor.version) {
+        try_rebuild();
+    }
+    else {
+        try_compile();
+    }
+}
+
+
 typedef struct
 {
     ivec2_t mouse;
@@ -311,15 +416,26 @@ static void render_gui(void)
         int err_y = editor_rows * EDITOR_SCALE * 2;
         int gap = 4;
 
-        char *text = "Compilation successful!";
+        int err_w = 81 * EDITOR_SCALE;
+        int err_h = window_height - err_y - gap;
+
         if (error_message_buffer[0]) {
-            text = error_message_buffer;
+            if (im_label(0, err_y + gap, err_w, err_h, 1, fg, bg, error_message_buffer)) {
+                im.hot_id = -2;
+            }
         }
+        else {
+            char *text = iterate_stats[0] ? iterate_stats : "Compilation successful!";
+            int line_h = err_h / 2;
 
-        if (im_label(0, err_y + gap, 81 * EDITOR_SCALE,
-                     window_height - err_y - gap, 1, fg, bg, text))
-        {
-            im.hot_id = -2;
+            bool hovered = im_label(0, err_y + gap, err_w, line_h, 1, fg, bg, text);
+            hovered |= im_label(0, err_y + gap + line_h, err_w, err_h - line_h,
+                                1, fg, bg, compile_stats);
+
+            if (hovered) {
+                tool_tip = "Whole generations, the engine only runs the expressions of them.";
+                im.hot_id = -2;
+            }
         }
     }
 
@@ -359,15 +475,13 @@ static void render_gui(void)
             --iteration_count;
         }
 
-        // TODO: Implement rebuild so that we don't have to recompile the whole system again.
-        try_compile();
+        try_iterate();
     }
 
     if (im_button(++id, butt_x + butt_slim * 7, butt_y, butt_slim, butt_h, ">")) {
         ++iteration_count;
 
-        // TODO: Implement rebuild so that we don't have to recompile the whole system again.
-        try_compile();
+        try_iterate();
     }
 
     {
@@ -402,6 +516,188 @@ static void render_gui(void)
 
     butt_y += butt_h + butt_gap;
 
+    int engine_id = ++id;
+    char engine_text[32];
+    snprintf(engine_text, sizeof(engine_text), "%s vm", l_engine_name(l_system.engine));
+
+    if (im_button(engine_id, butt_x, butt_y, butt_w, butt_h, engine_text)) {
+        l_system.engine = (l_system.engine + 1) % L_ENGINE_COUNT;
+        try_compile();
+    }
+
+    if (im.hot_id == engine_id) {
+        tool_tip = "Switches the expression engine, generation timings show under the editor.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int layout_id = ++id;
+    char layout_text[32];
+    snprintf(layout_text, sizeof(layout_text), "%s layout", l_layout_name(l_system.layout));
+
+    if (im_button(layout_id, butt_x, butt_y, butt_w, butt_h, layout_text)) {
+        l_system.layout = (l_system.layout + 1) % L_LAYOUT_COUNT;
+        try_compile();
+    }
+
+    if (im.hot_id == layout_id) {
+        tool_tip = "Switches between symbol records and per type columns.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int compose_id = ++id;
+    char compose_text[32];
+    snprintf(compose_text, sizeof(compose_text), "%u gens per pass",
+             l_system.compose > 1 ? l_system.compose : 1);
+
+    if (im_button(compose_id, butt_x, butt_y, butt_w, butt_h, compose_text)) {
+        l_system.compose = l_system.compose % L_MAX_COMPOSE + 1;
+        try_compile();
+    }
+
+    if (im.hot_id == compose_id) {
+        tool_tip = "Rewrites several generations per pass with composed rules.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int emit_id = ++id;
+    if (im_button(emit_id, butt_x, butt_y, butt_w, butt_h,
+                  l_system.emit ? "emit early" : "emit at end")) {
+        emit_early = !emit_early;
+        update_emit();
+        try_compile();
+    }
+
+    if (im.hot_id == emit_id) {
+        tool_tip = l_system.depth_first
+                 ? "Depth first derivation always builds while iterating."
+                 : "Builds symbols no rule can change while iterating.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int derive_id = ++id;
+    if (im_button(derive_id, butt_x, butt_y, butt_w, butt_h,
+                  l_system.depth_first ? "depth first" : "breadth first")) {
+        l_system.depth_first = !l_system.depth_first;
+        update_emit();
+        try_compile();
+    }
+
+    if (im.hot_id == derive_id) {
+        tool_tip = "Derives symbol by symbol into the model, saves memory.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int frames_id = ++id;
+    if (im_button(frames_id, butt_x, butt_y, butt_w, butt_h,
+                  l_system.hierarchical ? "local frames" : "world frames")) {
+        l_system.hierarchical = !l_system.hierarchical;
+        try_compile();
+    }
+
+    if (im.hot_id == frames_id) {
+        tool_tip = "Keeps frames relative to the parent, resolved when building.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int math_id = ++id;
+    if (im_button(math_id, butt_x, butt_y, butt_w, butt_h,
+                  l_system.exact_math ? "exact math" : "fast math")) {
+        l_system.exact_math = !l_system.exact_math;
+        try_compile();
+    }
+
+    if (im.hot_id == math_id) {
+        tool_tip = "Runs sin, cos and pow through the C library instead of the series.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int memo_id = ++id;
+    char memo_text[32];
+
+    if (l_system.memo_budget) {
+        snprintf(memo_text, sizeof(memo_text), "memo %zu MB", l_system.memo_budget >> 20);
+    }
+    else {
+        snprintf(memo_text, sizeof(memo_text), "memo off");
+    }
+
+    if (im_button(memo_id, butt_x, butt_y, butt_w, butt_h, memo_text)) {
+        switch (l_system.memo_budget >> 20) {
+            case 0:  l_system.memo_budget = (size_t)16  << 20; break;
+            case 16: l_system.memo_budget = (size_t)256 << 20; break;
+            default: l_system.memo_budget = 0;                 break;
+        }
+
+        try_compile();
+    }
+
+    if (im.hot_id == memo_id) {
+        tool_tip = "Remembers derived subtrees depth first, hits show under the editor.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int budget_id = ++id;
+    char budget_text[32];
+
+    if (l_system.memory_budget) {
+        snprintf(budget_text, sizeof(budget_text), "budget %zu GB", l_system.memory_budget >> 30);
+    }
+    else {
+        snprintf(budget_text, sizeof(budget_text), "no budget");
+    }
+
+    if (im_button(budget_id, butt_x, butt_y, butt_w, butt_h, budget_text)) {
+        switch (l_system.memory_budget >> 30) {
+            case 1:  l_system.memory_budget = (size_t)4  << 30; break;
+            case 4:  l_system.memory_budget = (size_t)16 << 30; break;
+            case 16: l_system.memory_budget = 0;                break;
+            default: l_system.memory_budget = (size_t)1  << 30; break;
+        }
+
+        try_iterate();
+    }
+
+    if (im.hot_id == budget_id) {
+        tool_tip = "Stops iterating before the memory runs out.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int seed_id = ++id;
+    char seed_text[32];
+    snprintf(seed_text, sizeof(seed_text), "seed %u", l_system.seed);
+
+    if (im_button(seed_id, butt_x, butt_y, butt_w, butt_h, seed_text)) {
+        ++l_system.seed;
+        try_compile();
+    }
+
+    if (im.hot_id == seed_id) {
+        tool_tip = "Draws another set of weighted rules and random() values.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
+    int pages_id = ++id;
+    if (im_button(pages_id, butt_x, butt_y, butt_w, butt_h,
+                  arena_huge_pages() ? "huge pages" : "small pages")) {
+        arena_use_huge_pages(!arena_huge_pages());
+    }
+
+    if (im.hot_id == pages_id) {
+        tool_tip = "Backs new generation and model memory with huge pages.";
+    }
+
+    butt_y += butt_h + butt_gap;
+
     int save_to_clip_id = ++id;
     if (im_button(save_to_clip_id, butt_x, butt_y, butt_w, butt_h, "copy code")) {
         bagE_clipCopy(editor.text_buffer, editor.text_size);
@@ -417,6 +713,7 @@ static void render_gui(void)
     int clear_id = ++id;
     if (im_button(clear_id, butt_x, butt_y, butt_w, butt_h, "clear code")) {
         editor.text_size = 0;
+        ++editor.version;
         editor.cursor_index = 0;
         editor.screen_index = 0;
         editor.selecting = false;
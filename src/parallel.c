@@ -0,0 +1,107 @@
+#include "parallel.h"
+
+#include "utils.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+#endif // _WIN32
+
+
+#define MAX_WORKERS 256
+
+typedef struct
+{
+    parallel_fn_t fn;
+    void *context;
+    unsigned worker_index;
+} worker_t;
+
+
+unsigned parallel_core_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    long count = (long)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif // _WIN32
+
+    if (count < 1)
+        return 1;
+
+    if (count > MAX_WORKERS)
+        return MAX_WORKERS;
+
+    return (unsigned)count;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI worker_start(LPVOID param)
+{
+    worker_t *worker = param;
+    worker->fn(worker->context, worker->worker_index);
+    return 0;
+}
+#else
+static void *worker_start(void *param)
+{
+    worker_t *worker = param;
+    worker->fn(worker->context, worker->worker_index);
+    return NULL;
+}
+#endif // _WIN32
+
+
+// NOTE: Threads are spawned per call. The callers hand out work measured
+//       in milliseconds at least, so a persistent pool isn't worth it yet.
+void parallel_run(parallel_fn_t fn, void *context, unsigned worker_count)
+{
+    assert(worker_count > 0 && worker_count <= MAX_WORKERS);
+
+#ifdef _WIN32
+    HANDLE threads[MAX_WORKERS];
+#else
+    pthread_t threads[MAX_WORKERS];
+#endif // _WIN32
+
+    worker_t workers[MAX_WORKERS];
+    bool spawned[MAX_WORKERS] = {0};
+
+    for (unsigned i = 1; i < worker_count; ++i) {
+        workers[i] = (worker_t) { fn, context, i };
+
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, worker_start, workers + i, 0, NULL);
+        spawned[i] = threads[i] != NULL;
+#else
+        spawned[i] = pthread_create(threads + i, NULL, worker_start, workers + i) == 0;
+#endif // _WIN32
+    }
+
+    fn(context, 0);
+
+    /* run the work of workers that failed to spawn on this thread */
+    for (unsigned i = 1; i < worker_count; ++i) {
+        if (!spawned[i]) {
+            fn(context, i);
+        }
+    }
+
+    for (unsigned i = 1; i < worker_count; ++i) {
+        if (!spawned[i])
+            continue;
+
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif // _WIN32
+    }
+}
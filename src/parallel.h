@@ -0,0 +1,16 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* Minimal fork-join helper.
+ * `parallel_run` calls `fn` once for every worker index in [0, worker_count)
+ * and returns after all of them have finished.
+ * Worker 0 runs on the calling thread.
+ */
+
+typedef void (*parallel_fn_t)(void *context, unsigned worker_index);
+
+unsigned parallel_core_count(void);
+
+void parallel_run(parallel_fn_t fn, void *context, unsigned worker_count);
+
+#endif // PARALLEL_H
@@ -43,6 +43,17 @@ static const char *keywords[] = {
     [token_kw_Stretch]  = "stretch",
     [token_kw_Position] = "position",
     [token_kw_Scale]    = "scale",
+    [token_kw_Select]   = "select",
+    [token_kw_Random]   = "random",
+
+    [token_kw_Sin]      = "sin",
+    [token_kw_Cos]      = "cos",
+    [token_kw_Sqrt]     = "sqrt",
+    [token_kw_Pow]      = "pow",
+    [token_kw_Min]      = "min",
+    [token_kw_Max]      = "max",
+    [token_kw_Lerp]     = "lerp",
+    [token_kw_Clamp]    = "clamp",
 
     [token_kw_PI]       = "PI",
     [token_kw_PHI]      = "PHI",
@@ -131,6 +142,17 @@ static int kw_arg_counts[] = {
     [token_kw_Stretch] = 3,
     [token_kw_Position] = 3,
     [token_kw_Scale] = 1,
+    [token_kw_Select] = 3,
+    [token_kw_Random] = 0,
+
+    [token_kw_Sin] = 1,
+    [token_kw_Cos] = 1,
+    [token_kw_Sqrt] = 1,
+    [token_kw_Pow] = 2,
+    [token_kw_Min] = 2,
+    [token_kw_Max] = 2,
+    [token_kw_Lerp] = 3,
+    [token_kw_Clamp] = 3,
 
     [token_kw_PI] = 0,
     [token_kw_PHI] = 0,
@@ -157,6 +179,17 @@ static l_instruction_t kw_instructions[] = {
     [token_kw_Stretch] = { .id = l_inst_Stretch },
     [token_kw_Position] = { .id = l_inst_Position },
     [token_kw_Scale] = { .id = l_inst_Scale },
+    [token_kw_Select] = { .id = l_inst_Select },
+    [token_kw_Random] = { .id = l_inst_Random },
+
+    [token_kw_Sin] = { .id = l_inst_Sin },
+    [token_kw_Cos] = { .id = l_inst_Cos },
+    [token_kw_Sqrt] = { .id = l_inst_Sqrt },
+    [token_kw_Pow] = { .id = l_inst_Pow },
+    [token_kw_Min] = { .id = l_inst_Min },
+    [token_kw_Max] = { .id = l_inst_Max },
+    [token_kw_Lerp] = { .id = l_inst_Lerp },
+    [token_kw_Clamp] = { .id = l_inst_Clamp },
 
     [token_kw_PI] = { .id = l_inst_Value,
                       .op = { .type = l_basic_Float, .data.floating = 3.1415927f } },
@@ -165,6 +198,23 @@ static l_instruction_t kw_instructions[] = {
 };
 static_assert(length(kw_instructions) == TOKEN_KW_COUNT, "array length missmatch");
 
+/* statically typed { int, float } variants of the generic instructions */
+static l_inst_id_t typed_inst_ids[][2] = {
+    [l_inst_Add]      = { l_inst_AddI,      l_inst_AddF      },
+    [l_inst_Sub]      = { l_inst_SubI,      l_inst_SubF      },
+    [l_inst_Mul]      = { l_inst_MulI,      l_inst_MulF      },
+    [l_inst_Div]      = { l_inst_DivI,      l_inst_DivF      },
+    [l_inst_Mod]      = { l_inst_ModI,      l_inst_ModI      },
+    [l_inst_Neg]      = { l_inst_NegI,      l_inst_NegF      },
+
+    [l_inst_Less]     = { l_inst_LessI,     l_inst_LessF     },
+    [l_inst_More]     = { l_inst_MoreI,     l_inst_MoreF     },
+    [l_inst_LessEq]   = { l_inst_LessEqI,   l_inst_LessEqF   },
+    [l_inst_MoreEq]   = { l_inst_MoreEqI,   l_inst_MoreEqF   },
+    [l_inst_Equal]    = { l_inst_EqualI,    l_inst_EqualF    },
+    [l_inst_NotEqual] = { l_inst_NotEqualI, l_inst_NotEqualF },
+};
+
 #define NO_PRECEDENCE 666
 
 static const char true_literal[]  = "true";
@@ -597,6 +647,75 @@ static expr_rec_t expr_err(tokenizer_t *toki, token_t token, char *msg)
 }
 
 
+static inline void push_inst(l_system_t *sys, l_inst_id_t id)
+{
+    l_instruction_t inst = { .id = id };
+    dck_stretchy_push(sys->instructions, inst);
+}
+
+// NOTE: Emits the statically typed form of an already type checked
+//       instruction. `operands` are the types of the values it eats.
+static void push_typed(l_system_t *sys, l_instruction_t inst, l_value_t *operands)
+{
+    switch (inst.id) {
+        case l_inst_Add:    /* fallthrough */
+        case l_inst_Sub:    /* fallthrough */
+        case l_inst_Mul:    /* fallthrough */
+        case l_inst_Div:    /* fallthrough */
+        case l_inst_Mod:    /* fallthrough */
+        case l_inst_Less:   /* fallthrough */
+        case l_inst_More:   /* fallthrough */
+        case l_inst_LessEq: /* fallthrough */
+        case l_inst_MoreEq: /* fallthrough */
+        case l_inst_Equal:  /* fallthrough */
+        case l_inst_NotEqual:
+        {
+            l_basic_t a = operands[0].type;
+            l_basic_t b = operands[1].type;
+
+            if (a == l_basic_Mat4) {
+                assert(inst.id == l_inst_Mul);
+                push_inst(sys, l_inst_MulM);
+                return;
+            }
+
+            if (a == l_basic_Int && b == l_basic_Float) {
+                push_inst(sys, l_inst_IntToFloatBelow);
+            }
+            else if (a == l_basic_Float && b == l_basic_Int) {
+                push_inst(sys, l_inst_IntToFloat);
+            }
+
+            bool has_float = a == l_basic_Float || b == l_basic_Float;
+            push_inst(sys, typed_inst_ids[inst.id][has_float]);
+        } return;
+
+        case l_inst_Neg: {
+            push_inst(sys, typed_inst_ids[inst.id][operands[0].type == l_basic_Float]);
+        } return;
+
+        case l_inst_CastInt: {
+            if      (operands[0].type == l_basic_Float) push_inst(sys, l_inst_FloatToInt);
+            else if (operands[0].type == l_basic_Bool)  push_inst(sys, l_inst_BoolToInt);
+        } return;
+
+        case l_inst_CastFloat: {
+            if      (operands[0].type == l_basic_Int)  push_inst(sys, l_inst_IntToFloat);
+            else if (operands[0].type == l_basic_Bool) push_inst(sys, l_inst_BoolToFloat);
+        } return;
+
+        case l_inst_CastBool: {
+            if      (operands[0].type == l_basic_Int)   push_inst(sys, l_inst_IntToBool);
+            else if (operands[0].type == l_basic_Float) push_inst(sys, l_inst_FloatToBool);
+        } return;
+
+        default: {
+            dck_stretchy_push(sys->instructions, inst);
+        } return;
+    }
+}
+
+
 #define next_checked_token(token, toki) \
 do {                                    \
     token = tokenizer_next(toki, true); \
@@ -718,7 +837,8 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
             if (argc == -1)
                 return expr_err(toki, token, "Illegal keyword in context!");
 
-            if (argc > 0) {
+            // NOTE: `random` is a call without arguments, not a constant.
+            if (argc > 0 || kw == token_kw_Random) {
                 next_checked_token(token, toki);
 
                 if (token.type != token_type_Separator || token.meta.sep != '(') {
@@ -753,6 +873,12 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
 
             l_instruction_t inst = kw_instructions[kw];
 
+            // NOTE: Every call draws its own numbers.
+            if (kw == token_kw_Random) {
+                inst.op = (l_value_t) { .type = l_basic_Int, .data.integer = (int)sys->random_sites++ };
+                sys->stochastic = true;
+            }
+
             /* type check */
             l_eval_res_t eval_res = l_evaluate_instruction(inst, params, param_count,
                                                            temp_stack + temp_size - 1, temp_size,
@@ -761,10 +887,11 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
                 return expr_err(toki, token, eval_res.error);
 
             assert(temp_size == eval_res.eaten);
+
+            push_typed(sys, inst, temp_stack);
+
             temp_size -= eval_res.eaten;
             temp_stack[temp_size++].type = eval_res.val.type;
-
-            dck_stretchy_push(sys->instructions, inst);
         } break;
 
         /* unary operators */
@@ -796,7 +923,8 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
             next_checked_token(token, toki);
 
             if (token.type == token_type_Empty)
-                return (expr_rec_t) { .res = { .success = true } };
+                return (expr_rec_t) { .res = { .success = true },
+                                      .type = temp_stack[0].type, };
 
             if (token.type == token_type_Separator) {
                 if (token.meta.sep == '(')
@@ -829,7 +957,10 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
         else {
             tokenizer_store(toki, token);
 
-            return (expr_rec_t) { .res = { .success = true } };
+            assert(temp_size == 1);
+
+            return (expr_rec_t) { .res = { .success = true },
+                                  .type = temp_stack[0].type, };
         }
 
         has_unary = false;
@@ -844,10 +975,11 @@ static expr_rec_t expression_rec(tokenizer_t *toki, l_system_t *sys,
             return expr_err(toki, token, eval_res.error);
 
         assert(temp_size == eval_res.eaten);
+
+        push_typed(sys, instruction, temp_stack);
+
         temp_size -= eval_res.eaten;
         temp_stack[temp_size++].type = eval_res.val.type;
-
-        dck_stretchy_push(sys->instructions, instruction);
     }
 
 bad_token:
@@ -874,12 +1006,16 @@ parse_expr_res_t parse_expression(tokenizer_t *toki, l_system_t *sys,
     if (!ret.res.success)
         return (parse_expr_res_t) { ret.res };
 
-    unsigned count = sys->instructions.count - index;
+    unsigned parsed_count = sys->instructions.count - index;
+    l_expr_t expr = l_compile_code(sys, index, ret.type);
+
+    sys->code_count += parsed_count;
+    sys->code_saved += expr.saved;
 
     return (parse_expr_res_t) {
         .res = { .success = true },
         .type = ret.type,
-        .expr = { .index = index, .count = count },
+        .expr = expr,
     };
 }
 
@@ -1044,7 +1180,7 @@ static parse_result_t parse_resource(parse_state_t *state, tokenizer_t *toki, l_
         if (ret.type != l_basic_Int)
             return err(toki, token, "Expression needs to be of type `int`!");
 
-        l_eval_res_t res = l_evaluate(sys, ret.expr, false, 0, 0, true);
+        l_eval_res_t res = l_evaluate(sys, &sys->eval_stack, ret.expr, false, 0, 0);
 
         assert(res.val.type == l_basic_Int);
 
@@ -1341,6 +1477,33 @@ static parse_result_t parse_rule(parse_state_t *state, tokenizer_t *toki, l_syst
 
     next_checked_token(token, toki);
 
+    /* weight */
+    float weight = 0.0f;
+
+    if (token.type == token_type_Separator && token.meta.sep == ':') {
+        ret = parse_expression(toki, sys, NULL, NULL, 0);
+        if (!ret.res.success)
+            return ret.res;
+
+        if (ret.type != l_basic_Int && ret.type != l_basic_Float)
+            return err(toki, token, "Rule weight needs to be a number!");
+
+        l_eval_res_t val = l_evaluate(sys, &sys->eval_stack, ret.expr, false, 0, 0);
+
+        if (val.error)
+            return err(toki, token, val.error);
+
+        weight = ret.type == l_basic_Int ? (float)val.val.data.integer
+                                         : val.val.data.floating;
+
+        if (!(weight > 0.0f))
+            return err(toki, token, "Rule weight needs to be positive!");
+
+        sys->stochastic = true;
+
+        next_checked_token(token, toki);
+    }
+
     if (token.type != token_type_Separator || token.meta.sep != '{')
         return err(toki, token, "Expected '{', opening braces!");
 
@@ -1422,6 +1585,8 @@ static parse_result_t parse_rule(parse_state_t *state, tokenizer_t *toki, l_syst
 
     l_system_add_rule(sys, left, temp_body_types, temp_exprs, type_count);
 
+    sys->rules.data[sys->rules.count - 1].weight = weight;
+
     return (parse_result_t) { .success = true };
 
 bad_token:
@@ -1504,6 +1669,9 @@ static parse_result_t parse_document(parse_state_t *state, tokenizer_t *toki, l_
 
             l_type_t type = sys->types.data[type_index];
 
+            // NOTE: The arguments draw as the symbol they make in the axiom.
+            sys->eval_stack.random = l_random_counter(0, sys->symbols[sys->id].count);
+
             for (unsigned i = 0; i < type.params_count; ++i) {
                 if (i > 0) {
                     next_checked_token(token, toki);
@@ -1519,11 +1687,15 @@ static parse_result_t parse_document(parse_state_t *state, tokenizer_t *toki, l_
                 if (ret.type != sys->param_types.data[type.params_index + i])
                     return err(toki, token, "Expression type doesn't match argument!");
 
-                l_eval_res_t val = l_evaluate(sys, ret.expr, false, 0, 0, true);
+                l_eval_res_t val = l_evaluate(sys, &sys->eval_stack, ret.expr, false, 0, 0);
 
                 if (val.error)
                     return err(toki, token, val.error);
 
+                if (val.val.type == l_basic_Mat4) {
+                    val.val.data.matrix = l_system_add_matrix(sys, sys->eval_stack.matrices.data[0]);
+                }
+
                 assert(i < MAX_TEMP_VALS);
                 temp_vals[i] = val.val;
             }
@@ -1566,6 +1738,13 @@ void parse(l_system_t *sys, parse_state_t *state, char *text, size_t text_size)
     if (!state->res.success)
         return;
 
+    /* rule dispatch */
+    l_system_index_rules(sys);
+    l_compile_decisions(sys);
+    l_find_frames(sys);
+    l_inherit_frames(sys);
+    l_compose_rules(sys);
+
     /* create texture atlas */
     if (sys->textures.count == 0) {
         state->res.success = false;
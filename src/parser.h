@@ -42,6 +42,17 @@ typedef enum
     token_kw_Stretch,
     token_kw_Position,
     token_kw_Scale,
+    token_kw_Select,
+    token_kw_Random,
+
+    token_kw_Sin,
+    token_kw_Cos,
+    token_kw_Sqrt,
+    token_kw_Pow,
+    token_kw_Min,
+    token_kw_Max,
+    token_kw_Lerp,
+    token_kw_Clamp,
 
     token_kw_PI,
     token_kw_PHI,